@@ -0,0 +1,24 @@
+/**
+ * bench.h
+ *
+ * Benchmark interface
+ * Searches a fixed set of positions and prints a node count signature
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+    constexpr int DEFAULT_DEPTH = 7;
+    constexpr int DEFAULT_HASH = 16;
+    constexpr int DEFAULT_THREADS = 1;
+
+    // The embedded position suite
+    extern const std::vector<std::string> positions;
+
+    // Runs the search over every position, usage: bench [depth] [hash] [threads]
+    void run (int depth = DEFAULT_DEPTH, int hash_mb = DEFAULT_HASH, int threads = DEFAULT_THREADS);
+}
@@ -2,55 +2,21 @@
  * bitboard.cpp
  * 
  * Main Bitboard Implementation 
- * Contains an initialization function, run once before making any analysis
- * Also has square bitboards
+ * Every table is built at compile time into read only data, so nothing has to run before the first lookup
+ * and every engine process on a machine shares the same pages
  */
 
 #include "bitboards.h"
 #include "type.h"
 #include "magic.h"
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <utility>
 
 namespace {
-    // Precomputed Attack Tables for leaper pieces
-    std::array<Bitboard, BOARD_SIZE> knight_table;
-    std::array<Bitboard, BOARD_SIZE> king_table;
-    std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> pawn_table;
-
-    // Precomputed Attack Tables for slider pieces
-    std::array<std::array<Bitboard, BISHOP_BLOCKER_COMBINATIONS>, BOARD_SIZE> bishop_table;
-    std::array<std::array<Bitboard, ROOK_BLOCKER_COMBINATIONS>, BOARD_SIZE> rook_table;
-
-    // Slider Blocker Masks
-    std::array<Bitboard, BOARD_SIZE> rook_masks;
-    std::array<Bitboard, BOARD_SIZE> bishop_masks;
-
-    // The number of '1' bits in each square of the masks
-    std::array<int, BOARD_SIZE> rook_relevancy;
-    std::array<int, BOARD_SIZE> bishop_relevancy;
-
-    // Forward declatation
-    void precompute_knight (Square square);
-    void precompute_king (Square square);
-    void precompute_wpawn (Square square);
-    void precompute_bpawn (Square square);
-
-    void generate_bishop_mask (Square square);
-    void generate_rook_mask (Square square);
-
-    int hash_bishop (Square square, Bitboard blockers);
-    int hash_rook (Square square, Bitboard blockers);
-
-    Bitboard raycast_bishop (Square square, Bitboard blockers);
-    Bitboard raycast_rook (Square square, Bitboard blockers);
-
-    Bitboard index_to_blocker (int index, Bitboard mask);
-
-    void precompute_bishop (Square square);
-    void precompute_rook (Square square);
 
     constexpr std::array<std::array<int, 2>, 8> knight_vectors = {{
         {1, 2},
@@ -84,38 +50,14 @@ namespace {
         {-1, -1}
     }};
 
-    void precompute_knight (Square square) {
-        int r;
-        int f;
-
+    // Every on board square one step along the vectors away
+    template <size_t N>
+    constexpr Bitboard leaper_attacks (int square, const std::array<std::array<int, 2>, N>& vectors) {
         Bitboard mask = 0ULL;
 
-        
-        for (const auto& vector: knight_vectors) {
-            r = (square >> 3) + vector[0];
-            f = (square & 7) + vector[1];
-
-            // Bound Check
-            if (r < 0 || r > 7 || f < 0 || f > 7) {
-                   continue;
-            }
-
-            mask |= 1ULL << (r << 3 | f);
-
-        }
-
-        knight_table[square] = mask;
-    }
-
-    void precompute_king (Square square) {
-        int r;
-        int f;
-
-        Bitboard mask = 0ULL;
-            
-        for (const auto& vector: king_vectors) {
-            r = (square >> 3) + vector[0];
-            f = (square & 7) + vector[1];
+        for (const auto& vector: vectors) {
+            int r = (square >> 3) + vector[0];
+            int f = (square & 7) + vector[1];
 
             // Bound Check
             if (r < 0 || r > 7 || f < 0 || f > 7) {
@@ -123,65 +65,23 @@ namespace {
             }
 
             mask |= 1ULL << (r << 3 | f);
-
-        }
-
-            
-
-        king_table[square] = mask;
-    }
-
-    void precompute_wpawn (Square square) {
-        Bitboard mask = 0ULL;
-        
-        int r;
-        int f;
-            
-            
-        for (const auto& vector: white_pawn_vectors) {
-                
-            r = (square >> 3) + vector[0];
-            f = (square & 7) + vector[1];
-
-            // Bound Check
-            if (r < 0 || r > 7 || f < 0 || f > 7) {
-                continue;
-            }
-
-            mask |= 1ULL << (r << 3 | f);
-
         }
 
-            
-
-        pawn_table[WHITE][square] = mask;
-
-        
+        return mask;
     }
 
-    void precompute_bpawn (Square square) {
-        Bitboard mask = 0ULL;
-
-        int r;
-        int f;
-
-        for (const auto& vector: black_pawn_vectors) {
-            r = (square >> 3) + vector[0];
-            f = (square & 7) + vector[1];
-
-            // Bound Check
-            if (r < 0 || r > 7 || f < 0 || f > 7) {
-                continue;
-            }
-
-            mask |= 1ULL << (r << 3 | f);
+    template <size_t N>
+    constexpr std::array<Bitboard, BOARD_SIZE> leaper_table (const std::array<std::array<int, 2>, N>& vectors) {
+        std::array<Bitboard, BOARD_SIZE> table {};
 
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            table[square] = leaper_attacks(square, vectors);
         }
 
-        pawn_table[BLACK][square] = mask;
+        return table;
     }
 
-    void generate_bishop_mask (Square square) {
+    constexpr Bitboard generate_bishop_mask (int square) {
         int rank = square >> 3;
         int file = square & 7;
 
@@ -203,11 +103,10 @@ namespace {
             mask |= 1ULL << (newRank << 3 | newFile);
         }
 
-        bishop_masks[square] = mask;
-        bishop_relevancy[square] = __builtin_popcountll(mask);
+        return mask;
     }
 
-    void generate_rook_mask (Square square) {
+    constexpr Bitboard generate_rook_mask (int square) {
         int rank = square >> 3;
         int file = square & 7;
 
@@ -233,200 +132,210 @@ namespace {
             mask |= 1ULL << (rank << 3 | newFile);
         }
 
-        rook_masks[square] = mask;
-
-        rook_relevancy[square] = __builtin_popcountll(mask);
-    }
-
-    int hash_bishop (Square square, Bitboard blockers) {
-        return ((blockers & bishop_masks[square]) * bishop_magic[square]) >> (64 - bishop_relevancy[square]);
-    }
-
-    
-
-    int hash_rook (Square square, Bitboard blockers) {
-        return ((blockers & rook_masks[square]) * rook_magic[square]) >> (64 - rook_relevancy[square]);
-    }
-    
-
-    Bitboard raycast_bishop (Square square, Bitboard blockers) {
-
-        Bitboard mask = 0ULL;
-
-        int rank = square >> 3;
-        int file = square & 7;
-
-        
-
-        for (int newRank = rank + 1, newFile = file + 1; newRank <= 7 && newFile <= 7; ++newRank, ++newFile) {
-
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | newFile);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
-
-        for (int newRank = rank + 1, newFile = file - 1; newRank <= 7 && newFile >= 0; ++newRank, --newFile) {
-            
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | newFile);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
-
-        for (int newRank = rank - 1, newFile = file + 1; newRank >= 0 && newFile <= 7; --newRank, ++newFile) {
-            
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | newFile);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
-
-        for (int newRank = rank - 1, newFile = file - 1; newRank >= 0 && newFile >= 0; --newRank, --newFile) {
-            
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | newFile);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
-
         return mask;
-        
     }
 
-    Bitboard raycast_rook (Square square, Bitboard blockers) {
-        int rank = square >> 3;
-        int file = square & 7;
-
-        Bitboard mask = 0ULL;
-
-        // North
-        for (int newRank = rank + 1; newRank <= 7; ++newRank) {
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | file);
+    // Rook directions first, then bishop ones, the first two of each go towards higher squares
+    constexpr std::array<std::array<int, 2>, 8> ray_vectors = {{
+        {1, 0},
+        {0, 1},
+        {-1, 0},
+        {0, -1},
+        {1, 1},
+        {1, -1},
+        {-1, -1},
+        {-1, 1}
+    }};
 
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
+    // Every square a slider sees along one direction on an empty board
+    // Plain arrays, the slider tables read them hundreds of thousands of times at compile time
+    struct Rays {
+        Bitboard ray[8][BOARD_SIZE];
+    };
+
+    constexpr Rays rays = [] {
+        Rays table {};
+
+        for (int direction = 0; direction < 8; direction++) {
+            for (int square = 0; square < BOARD_SIZE; square++) {
+                int r = (square >> 3) + ray_vectors[direction][0];
+                int f = (square & 7) + ray_vectors[direction][1];
+
+                while (r >= 0 && r <= 7 && f >= 0 && f <= 7) {
+                    table.ray[direction][square] |= 1ULL << (r << 3 | f);
+                    r += ray_vectors[direction][0];
+                    f += ray_vectors[direction][1];
+                }
             }
-            mask |= newSquareMask;
         }
 
-        // South
-        for (int newRank = rank - 1; newRank >= 0; --newRank) {
-            Bitboard newSquareMask = 1ULL << (newRank << 3 | file);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
+        return table;
+    }();
 
-        // East 
-        for (int newFile = file + 1; newFile <= 7; ++newFile) {
-            Bitboard newSquareMask = 1ULL << (rank << 3 | newFile);
+    // The ray up to and including the first blocker, everything behind it is the blocker's own ray
+    constexpr Bitboard ray_attacks (int square, int direction, Bitboard blockers) {
+        Bitboard attacks = rays.ray[direction][square];
+        Bitboard blocked = attacks & blockers;
 
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
+        if (blocked) {
+            int first = (direction & 2) == 0 ? __builtin_ctzll(blocked) : 63 - __builtin_clzll(blocked);
+            attacks ^= rays.ray[direction][first];
         }
 
-        // West
-        for (int newFile = file - 1; newFile >= 0; --newFile) {
-            Bitboard newSquareMask = 1ULL << (rank << 3 | newFile);
-
-            if ((newSquareMask & blockers) != 0ULL) {
-                mask |= newSquareMask;
-                break;
-            }
-            mask |= newSquareMask;
-        }
+        return attacks;
+    }
 
-        return mask;
+    constexpr Bitboard raycast_rook (int square, Bitboard blockers) {
+        return ray_attacks(square, 0, blockers) | ray_attacks(square, 1, blockers) |
+               ray_attacks(square, 2, blockers) | ray_attacks(square, 3, blockers);
     }
 
-    Bitboard index_to_blocker(int index, Bitboard mask) {
-        Bitboard blockers = 0ULL;
+    constexpr Bitboard raycast_bishop (int square, Bitboard blockers) {
+        return ray_attacks(square, 4, blockers) | ray_attacks(square, 5, blockers) |
+               ray_attacks(square, 6, blockers) | ray_attacks(square, 7, blockers);
+    }
 
-        int bit_num = 0;
+    // One square's attacks for every blocker subset, in the order the magic or PEXT index numbers them
+    // Each is its own constant expression, the whole table at once is far more work than one evaluation may do
+    template <size_t N>
+    struct SliderAttacks {
+        Bitboard attacks[N];
+    };
+
+    template <int Square, bool Rook>
+    constexpr auto slider_attacks = [] {
+        constexpr Bitboard mask = Rook ? generate_rook_mask(Square) : generate_bishop_mask(Square);
+        constexpr unsigned shift = 64 - __builtin_popcountll(mask);
+        [[maybe_unused]] constexpr uint64_t magic = Rook ? rook_magic[Square] : bishop_magic[Square];
+
+        constexpr int first = Rook ? 0 : 4;
+        constexpr Bitboard ray0 = rays.ray[first][Square], ray1 = rays.ray[first + 1][Square];
+        constexpr Bitboard ray2 = rays.ray[first + 2][Square], ray3 = rays.ray[first + 3][Square];
+
+        SliderAttacks<size_t(1) << (64 - shift)> table {};
+        Bitboard subset = 0ULL;
+        uint32_t count = 0;
+
+        // The carry rippler walks the subsets in the order PEXT numbers them
+        do {
+#ifdef USE_PEXT
+            uint32_t index = count;
+#else
+            uint32_t index = uint32_t((subset * magic) >> shift);
+#endif
+            // ray_attacks written out, GCC memoizes every constexpr call and that alone costs seconds here
+            // The first two directions of each slider go towards higher squares, so their first blocker is the lowest bit
+            Bitboard up0 = ray0 & subset, up1 = ray1 & subset, down0 = ray2 & subset, down1 = ray3 & subset;
+
+            Bitboard attacks = (up0 ? ray0 ^ rays.ray[first][__builtin_ctzll(up0)] : ray0)
+                             | (up1 ? ray1 ^ rays.ray[first + 1][__builtin_ctzll(up1)] : ray1)
+                             | (down0 ? ray2 ^ rays.ray[first + 2][63 - __builtin_clzll(down0)] : ray2)
+                             | (down1 ? ray3 ^ rays.ray[first + 3][63 - __builtin_clzll(down1)] : ray3);
+
+            table.attacks[index] = attacks;
+
+            subset = (subset - mask) & mask;
+            count++;
+        } while (subset);
+
+        return table;
+    }();
+
+    template <bool Rook, size_t... Squares>
+    constexpr std::array<Bitboards::Magic, BOARD_SIZE> make_slider_magics (std::index_sequence<Squares...>) {
+        auto make = [] (int square, const Bitboard* attacks) {
+            Bitboards::Magic magic {};
+            magic.mask = Rook ? generate_rook_mask(square) : generate_bishop_mask(square);
+            magic.magic = Rook ? rook_magic[square] : bishop_magic[square];
+            magic.attacks = attacks;
+            magic.shift = 64 - __builtin_popcountll(magic.mask);
+            return magic;
+        };
+
+        return {{make(Squares, slider_attacks<Squares, Rook>.attacks)...}};
+    }
 
-        while (mask) {
-            int square = __builtin_ctzll (mask);
+    // Every square in front of the pawn on its own and the adjacent files, if no enemy pawn is there the pawn is passed
+    constexpr std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> make_passed_pawn_table () {
+        std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> table {};
 
-            if (index & (1 << bit_num)) {
-                blockers |= 1ULL << square;
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            int rank = square >> 3;
+            int file = square & 7;
+
+            for (int new_file = std::max(0, file - 1); new_file <= std::min(7, file + 1); new_file++) {
+                for (int new_rank = rank + 1; new_rank <= 7; new_rank++) {
+                    table[WHITE][square] |= 1ULL << (new_rank << 3 | new_file);
+                }
+                for (int new_rank = rank - 1; new_rank >= 0; new_rank--) {
+                    table[BLACK][square] |= 1ULL << (new_rank << 3 | new_file);
+                }
             }
-
-            mask &= mask - 1;
-            bit_num++;
         }
 
-        return blockers;
+        return table;
     }
 
-    
+    // Between and line tables for pins and check blocks
+    // Two rays that each stop at the other square overlap exactly on the squares between them
+    struct LineTables {
+        std::array<std::array<Bitboard, BOARD_SIZE>, BOARD_SIZE> between {};
+        std::array<std::array<Bitboard, BOARD_SIZE>, BOARD_SIZE> line {};
+    };
 
-    
+    constexpr LineTables make_line_tables () {
+        LineTables tables {};
 
-    
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            for (int other = 0; other < BOARD_SIZE; other++) {
+                Bitboard both = (1ULL << square) | (1ULL << other);
 
-    void precompute_bishop (Square square) {
-        for (int i = 0; i < (1 << bishop_relevancy[square]); i++) {
-            Bitboard blockers = index_to_blocker(i, bishop_masks[square]);
+                if (other == square) continue;
 
-            Bitboard attacks = raycast_bishop(square, blockers);
+                if (raycast_rook(square, 0ULL) & (1ULL << other)) {
+                    tables.between[square][other] = raycast_rook(square, 1ULL << other) & raycast_rook(other, 1ULL << square);
+                    tables.line[square][other] = (raycast_rook(square, 0ULL) & raycast_rook(other, 0ULL)) | both;
+                }
 
-            bishop_table[square][hash_bishop(square, blockers)] = attacks;
+                else if (raycast_bishop(square, 0ULL) & (1ULL << other)) {
+                    tables.between[square][other] = raycast_bishop(square, 1ULL << other) & raycast_bishop(other, 1ULL << square);
+                    tables.line[square][other] = (raycast_bishop(square, 0ULL) & raycast_bishop(other, 0ULL)) | both;
+                }
+            }
         }
-    }
-
-    
-
-    void precompute_rook (Square square) {
-        for (int i = 0; i < (1 << rook_relevancy[square]); i++) {
-            Bitboard blockers = index_to_blocker(i, rook_masks[square]);
-
-            Bitboard attacks = raycast_rook(square, blockers);
 
-            rook_table[square][hash_rook(square, blockers)] = attacks;
-        }
+        return tables;
     }
 
+    // Precomputed Attack Tables for leaper pieces
+    constexpr std::array<Bitboard, BOARD_SIZE> knight_table = leaper_table(knight_vectors);
+    constexpr std::array<Bitboard, BOARD_SIZE> king_table = leaper_table(king_vectors);
+    constexpr std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> pawn_table = {
+        leaper_table(white_pawn_vectors),
+        leaper_table(black_pawn_vectors)
+    };
+
+    constexpr LineTables line_tables = make_line_tables();
+}
 
+namespace Bitboards {
 
+    constexpr std::array<Bitboard, BOARD_SIZE> square_bb = [] {
+        std::array<Bitboard, BOARD_SIZE> table {};
 
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            table[square] = 1ULL << square;
+        }
 
-}
-
-namespace Bitboards {
+        return table;
+    }();
 
-    std::array<Bitboard, BOARD_SIZE> square_bb;
+    constexpr std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> passed_pawn_table = make_passed_pawn_table();
 
-    std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> passed_pawn_table;
+    constexpr std::array<Magic, BOARD_SIZE> rook_magics = make_slider_magics<true>(std::make_index_sequence<BOARD_SIZE>());
+    constexpr std::array<Magic, BOARD_SIZE> bishop_magics = make_slider_magics<false>(std::make_index_sequence<BOARD_SIZE>());
     
     // lookup functions
-    Bitboard get_bishop_attacks (Square square, Bitboard occupancy) {
-        return bishop_table[square][hash_bishop(square, occupancy)];
-    }
-
-    Bitboard get_rook_attacks (Square square, Bitboard occupancy) {
-        return rook_table[square][hash_rook(square, occupancy)];
-    }
-
     Bitboard get_knight_attacks (Square square) {
         return knight_table[square];
     }
@@ -439,6 +348,18 @@ namespace Bitboards {
         return pawn_table[color][square];
     }
 
+    Bitboard get_passed_pawn_mask (Square square, Color color) {
+        return passed_pawn_table[color][square];
+    }
+
+    Bitboard get_between (Square a, Square b) {
+        return line_tables.between[a][b];
+    }
+
+    Bitboard get_line (Square a, Square b) {
+        return line_tables.line[a][b];
+    }
+
     // represent a bitboard
     std::string to_string (Bitboard bitboard) {
         std::ostringstream string;
@@ -458,27 +379,4 @@ namespace Bitboards {
         return string.str();
     }
 
-    // initialize
-    void init () {
-        for (int square = 0; square < BOARD_SIZE; square++) {
-            Square square_enum = Square(square);
-
-            precompute_knight(square_enum);
-            precompute_king(square_enum);
-            precompute_wpawn(square_enum);
-            precompute_bpawn(square_enum);
-
-            generate_bishop_mask(square_enum);
-            generate_rook_mask(square_enum);
-
-            precompute_bishop(square_enum);
-            precompute_rook(square_enum);
-
-            square_bb[square] = 1ULL << square;
-            
-        }
-        
-    }
-
 }
-
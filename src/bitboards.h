@@ -3,7 +3,7 @@
  * 
  * Main Bitboard Interface 
  * Contains rank & file bitboards
- * Lookup functions for O(1) MoveGen
+ * Lookup functions for O(1) MoveGen, the tables need no initialization
  */
 
 #pragma once
@@ -13,6 +13,12 @@
 #include <array>
 #include <string>
 
+// BMI2 turns the magic multiply and shift into one PEXT, build with -DNO_PEXT where PEXT is microcoded (AMD before Zen 3)
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#include <immintrin.h>
+#define USE_PEXT
+#endif
+
 
 
 
@@ -32,19 +38,51 @@ namespace Bitboards {
     constexpr Bitboard file_h = 0x8080808080808080ULL;
     
 
-    extern std::array<Bitboard, BOARD_SIZE> square_bb;
-
-    // lookups
-    Bitboard get_rook_attacks (Square square, Bitboard occupancy);
-    Bitboard get_bishop_attacks (Square square, Bitboard occupancy);
+    // One per square for each slider, attacks is that square's own table indexed by the blocker subset
+    struct Magic {
+        Bitboard mask;
+        uint64_t magic;
+        const Bitboard* attacks;
+        unsigned shift;
+
+        inline unsigned index (Bitboard occupancy) const {
+#ifdef USE_PEXT
+            return unsigned(_pext_u64(occupancy, mask));
+#else
+            return unsigned(((occupancy & mask) * magic) >> shift);
+#endif
+        }
+    };
+
+    // Built at compile time in bitboards.cpp
+    extern const std::array<Bitboard, BOARD_SIZE> square_bb;
+    extern const std::array<std::array<Bitboard, BOARD_SIZE>, COLOR_NUM> passed_pawn_table;
+
+    extern const std::array<Magic, BOARD_SIZE> rook_magics;
+    extern const std::array<Magic, BOARD_SIZE> bishop_magics;
+
+    // lookups, the slider ones inline since they are the hottest
+    inline Bitboard get_rook_attacks (Square square, Bitboard occupancy) {
+        const Magic& m = rook_magics[square];
+        return m.attacks[m.index(occupancy)];
+    }
+
+    inline Bitboard get_bishop_attacks (Square square, Bitboard occupancy) {
+        const Magic& m = bishop_magics[square];
+        return m.attacks[m.index(occupancy)];
+    }
 
 
     Bitboard get_knight_attacks (Square square);
     Bitboard get_king_attacks (Square square);
     Bitboard get_pawn_attacks (Square square, Color color);
+    Bitboard get_passed_pawn_mask (Square square, Color color);
+
+    // Squares strictly between two squares on a shared rank, file or diagonal, empty if they share none
+    Bitboard get_between (Square a, Square b);
 
-    // initialize
-    void init();
+    // The whole rank, file or diagonal through both squares, empty if they share none
+    Bitboard get_line (Square a, Square b);
 
     // utility
     std::string to_string (Bitboard bitboard);
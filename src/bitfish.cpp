@@ -7,44 +7,132 @@
  */
 
 #include "bitfish.h"
+#include "material.h"
+#include "movepick.h"
+#include "nnue.h"
+#include "pawns.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 
 using namespace std::chrono;
 
 
 HashTable::HashTable(size_t mb) {
+    resize(mb);
+}
+
+HashTable::~HashTable() {
+    std::free(table);
+}
+
+void HashTable::resize(size_t mb, int threads) {
     // 1 << 20 is 1024^2
-    size_t entries = (mb * (1 << 20)) / sizeof(HTEntry);
+    size_t buckets = std::max<size_t>((mb * (1 << 20)) / sizeof(HTBucket), 1);
+
+    // aligned_alloc wants the size to be a multiple of the alignment
+    size_t bytes = (buckets * sizeof(HTBucket) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    HTBucket* memory = static_cast<HTBucket*>(std::aligned_alloc(HUGE_PAGE_SIZE, bytes));
+
+    // Keep the old table if the new one doesn't fit
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    std::free(table);
+
+    table = memory;
+    bucket_count = buckets;
 
-    table.resize(entries);
+#ifdef MADV_HUGEPAGE
+    // Big tables miss the TLB on almost every probe with 4KB pages
+    madvise(table, bytes, MADV_HUGEPAGE);
+#endif
+
+    // Also the first touch of the memory, which is what actually maps it in
+    clear(threads);
 }
 
-void HashTable::clear() {
-    std::fill (table.begin(), table.end(), HTEntry{0ULL, 0, 0, EXACT, NO_MOVE});
+void HashTable::clear(int threads) {
+    threads = std::max(1, threads);
+    size_t slice = (bucket_count + threads - 1) / threads;
+
+    auto clear_slice = [this, slice](int i) {
+        size_t start = std::min(bucket_count, i * slice);
+        size_t end = std::min(bucket_count, start + slice);
+
+        std::memset(static_cast<void*>(table + start), 0, (end - start) * sizeof(HTBucket));
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(clear_slice, i);
+    }
+
+    clear_slice(0);
+
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+
+    generation = 0;
 }
 
-size_t HashTable::index(Key hash) const {
-    return hash % table.size();
+void HashTable::new_search() {
+    // 6 bits of generation, it wraps around
+    generation = (generation + 1) & 63;
 }
 
 HTEntry* HashTable::probe (Key hash) {
-    size_t idx = index(hash);
-    if (table[idx].hash == hash) {
-        return &table[idx];
+    // The low bits are the key, the high bits already picked the bucket
+    uint16_t key = static_cast<uint16_t>(hash);
+
+    for (HTEntry& entry: bucket(hash).entries) {
+        if (entry.key == key && entry.depth != 0) {
+            return &entry;
+        }
     }
 
     return nullptr;
 }
 
-void HashTable::store (Key hash, int depth, int score, HTFlag flag, Move best_move) {
-    size_t idx = index(hash);
+void HashTable::store (Key hash, int depth, int score, HTFlag flag, uint16_t best_move) {
+    uint16_t key = static_cast<uint16_t>(hash);
 
-    
-    if (table[idx].hash == 0 || 
-        table[idx].hash == hash || 
-        depth >= table[idx].depth) {
-        table[idx] = HTEntry{hash, depth, score, flag, best_move};
+    HTEntry* replace = nullptr;
+    int worst = INT32_MAX;
+
+    for (HTEntry& entry: bucket(hash).entries) {
+        // Same position or an empty slot
+        if (entry.key == key || entry.depth == 0) {
+            replace = &entry;
+
+            // Don't forget the move just because this search didn't find one
+            if (entry.key == key && entry.depth != 0 && best_move == NO_MOVE16) {
+                best_move = entry.move;
+            }
+            break;
+        }
+
+        // Otherwise the shallowest entry, every search of age counts as 8 plies
+        int age = (generation - entry.generation()) & 63;
+        int value = entry.depth - 8 * age;
+
+        if (value < worst) {
+            worst = value;
+            replace = &entry;
+        }
     }
+
+    *replace = HTEntry{key, best_move, static_cast<int16_t>(score), static_cast<uint8_t>(depth), static_cast<uint8_t>(generation << 2 | flag)};
 }
 
 void SearchInfo::reset () {
@@ -57,26 +145,17 @@ void SearchInfo::reset () {
 // Main Search Impl
 namespace BitFish {
     
-    // Contains information for timing, depth, and when to stop
-    SearchInfo search_info;
-
-    // The current position, set by using the 'position' uci command
-    Position current_pos(STARTING_POS_FEN);
-
-    // Transposition Table for move ordering
+    // Transposition Table for the UCI engine
     HashTable tt;
 
-    // Killer Moves: If one move is good at this depth in this branch
-    // Try it another branch
-    // Reset every search
-    std::array<std::array<Move, 2>, MAX_DEPTH> killers;
+    SearchContext engine(tt);
 
     // Killer functions
-    void reset_killers () {
+    void SearchThread::reset_killers () {
         std::memset(killers.begin(), NO_MOVE, sizeof(killers));
     }
 
-    void store_killer (Move move, int ply) {
+    void SearchThread::store_killer (Move move, int ply) {
         if (killers[ply][0] == move) return;
         if (killers[ply][1] == move) return;
 
@@ -85,114 +164,109 @@ namespace BitFish {
         killers[ply][0] = move;
     }
 
+    SearchContext::SearchContext (HashTable& table, int thread_count) : current_pos(STARTING_POS_FEN), tt(table) {
+        set_threads(thread_count);
+    }
+
+    void SearchContext::reset_killers () {
+        for (auto& td: threads) {
+            td->reset_killers();
+        }
+    }
+
+    void SearchContext::set_threads (int count) {
+        threads.clear();
+
+        for (int i = 0; i < std::max(1, count); i++) {
+            threads.push_back(std::make_unique<SearchThread>());
+            threads.back()->id = i;
+        }
+    }
+
+    uint64_t SearchContext::nodes_searched () const {
+        uint64_t nodes = 0;
+
+        for (auto& td: threads) {
+            nodes += td->info.nodes.load(std::memory_order_relaxed);
+        }
+
+        return nodes;
+    }
+
     // UCI related function impl
-    void position (std::string_view fen) {
+    void SearchContext::position (std::string_view fen) {
         current_pos.parse_fen(fen);
     }
 
-    void stop () {
+    void SearchContext::stop () {
         search_info.stop.store(true, std::memory_order_relaxed);
     }
 
-    bool should_stop() {
+    bool SearchContext::should_stop (const SearchThread& td) {
         if (search_info.stop.load(std::memory_order_relaxed)) return true;
 
+        // Raising the flag means the unfinished iteration gets thrown away instead of reported
         if (search_info.max_time_ms > 0) {
             auto now = steady_clock::now();
             auto elapsed_ms = duration_cast<std::chrono::milliseconds>(now - search_info.start_time).count();
             if (elapsed_ms >= search_info.max_time_ms) {
+                stop();
                 return true;
             }
         }
-        return false;
-    }
 
-    // Endgame weight for evaluation
-    float eg_weight (Position& pos) {
+        // Summing the counters touches every thread's cache line, so only the main thread does it and only every 1024 of its nodes
+        if (search_info.max_nodes > 0 && td.id == 0 && td.info.nodes.load(std::memory_order_relaxed) % 1024 == 0
+            && nodes_searched() >= search_info.max_nodes) {
+            stop();
+            return true;
+        }
 
-        // Include every piece except for kings
-        int phase = 
-            __builtin_popcountll(pos.get_bitboard(W_KNIGHT) | pos.get_bitboard(B_KNIGHT)) * KNIGHT_GAME_PHASE +
-            __builtin_popcountll(pos.get_bitboard(W_BISHOP) | pos.get_bitboard(B_BISHOP)) * BISHOP_GAME_PHASE +
-            __builtin_popcountll(pos.get_bitboard(W_ROOK)   | pos.get_bitboard(B_ROOK)) * ROOK_GAME_PHASE +
-            __builtin_popcountll(pos.get_bitboard(W_QUEEN)  | pos.get_bitboard(B_QUEEN)) * QUEEN_GAME_PHASE;
-        
-        
+        return false;
+    }
 
-        return 1 - std::min (1.0f, static_cast<float> (phase) / MAX_GAME_PHASE);
+    // How far the game is from the endgame, MAX_GAME_PHASE with all pieces on and 0 with only kings and pawns
+    int game_phase (const Position& pos) {
+        return std::min(pos.phase, MAX_GAME_PHASE);
     }
 
     
-    // Returns a static evaluation of the current position
-    int evaluate (Position& pos) {
-        // Draw by 50 move rule
-        if (pos.game_info.rule_50_clock >= 100) {
-            return 0;
-        }
+    // Hand written evaluation from white's point of view
+    static int classical_evaluate (const Position& pos, const Material::MaterialEntry& material_entry, Pawns::PawnTable& pawn_table) {
+        int phase = material_entry.phase;
 
-        float endgame = eg_weight(pos);
+        // Material and piece squares are kept by the position, pawn structure and imbalance come from their tables
+        Score tapered = pos.psq + material_entry.imbalance + Pawns::probe(pos, pawn_table);
+        int score = (mg_value(tapered) * phase + eg_value(tapered) * (MAX_GAME_PHASE - phase)) / MAX_GAME_PHASE;
 
-        int score = 0;
+        // Mobility
+        Bitboard occupancy = pos.board.occupancy;
 
-        // Single pass through the board
-        // Considers mobility and material
-        for (int square = 0; square < BOARD_SIZE; ++square) {
-            Piece piece = pos.piece_at(Square(square));
-
-            if (piece == NO_PIECE) continue;
-
-            switch (piece)
-            {
-            case W_PAWN:
-                score += static_cast<int>(endgame * EvalTables::pawn_table_eg[square] + (1 - endgame) * EvalTables::pawn_table_mg[square]);
-                break;
-            case B_PAWN:
-                score -= static_cast<int>(endgame * EvalTables::pawn_table_eg[63 - square] + (1 - endgame) * EvalTables::pawn_table_mg[63 - square]);
-                
-                break;
-            case W_KNIGHT:
-                score += EvalTables::knight_table[square];
-                score += __builtin_popcountll(Bitboards::get_knight_attacks(Square(square))) * KNIGHT_MOB_BONUS;
-                break;
-            case B_KNIGHT:
-                score -= EvalTables::knight_table[63 - square];
-                score -= __builtin_popcountll(Bitboards::get_knight_attacks(Square(square))) * KNIGHT_MOB_BONUS;
-                break;
-            case W_BISHOP:
-                score += EvalTables::bishop_table[square];
-                score += __builtin_popcountll(Bitboards::get_bishop_attacks(Square(square), pos.board.occupancy)) * BISHOP_MOB_BONUS;
-                break;
-            case B_BISHOP:
-                score -= EvalTables::bishop_table[63 - square];
-                score -= __builtin_popcountll(Bitboards::get_bishop_attacks(Square(square), pos.board.occupancy)) * BISHOP_MOB_BONUS;
-                break;
-            case W_ROOK:
-                score += EvalTables::rook_table[square];
-                score += __builtin_popcountll(Bitboards::get_rook_attacks(Square(square), pos.board.occupancy)) * ROOK_MOB_BONUS;
-                break;
-            case B_ROOK:
-                score -= EvalTables::rook_table[63 - square];
-                score -= __builtin_popcountll(Bitboards::get_rook_attacks(Square(square), pos.board.occupancy)) * ROOK_MOB_BONUS;
-                break;
-            case W_QUEEN:
-                score += EvalTables::queen_table[square];
-                score += __builtin_popcountll(Bitboards::get_rook_attacks(Square(square), pos.board.occupancy) | Bitboards::get_bishop_attacks(Square(square), pos.board.occupancy)) * QUEEN_MOB_BONUS;
-                break;
-            case B_QUEEN:
-                score -= EvalTables::queen_table[63 - square];
-                score -= __builtin_popcountll(Bitboards::get_rook_attacks(Square(square), pos.board.occupancy) | Bitboards::get_bishop_attacks(Square(square), pos.board.occupancy)) * QUEEN_MOB_BONUS;
-                break;
-            case W_KING:
-                score += static_cast<int>(endgame * EvalTables::king_table_eg[square] + (1 - endgame) * EvalTables::king_table_mg[square]);
-                break;
-            case B_KING:
-                score -= static_cast<int>(endgame * EvalTables::king_table_eg[63 - square] + (1 - endgame) * EvalTables::king_table_mg[63 - square]);
-                break;
-            default:
-                break;
-            }
-
-            score += material[piece];
+        for (Bitboard knights = pos.get_bitboard(W_KNIGHT); knights; knights &= knights - 1) {
+            score += __builtin_popcountll(Bitboards::get_knight_attacks(Square(__builtin_ctzll(knights)))) * KNIGHT_MOB_BONUS;
+        }
+        for (Bitboard knights = pos.get_bitboard(B_KNIGHT); knights; knights &= knights - 1) {
+            score -= __builtin_popcountll(Bitboards::get_knight_attacks(Square(__builtin_ctzll(knights)))) * KNIGHT_MOB_BONUS;
+        }
+        for (Bitboard bishops = pos.get_bitboard(W_BISHOP); bishops; bishops &= bishops - 1) {
+            score += __builtin_popcountll(Bitboards::get_bishop_attacks(Square(__builtin_ctzll(bishops)), occupancy)) * BISHOP_MOB_BONUS;
+        }
+        for (Bitboard bishops = pos.get_bitboard(B_BISHOP); bishops; bishops &= bishops - 1) {
+            score -= __builtin_popcountll(Bitboards::get_bishop_attacks(Square(__builtin_ctzll(bishops)), occupancy)) * BISHOP_MOB_BONUS;
+        }
+        for (Bitboard rooks = pos.get_bitboard(W_ROOK); rooks; rooks &= rooks - 1) {
+            score += __builtin_popcountll(Bitboards::get_rook_attacks(Square(__builtin_ctzll(rooks)), occupancy)) * ROOK_MOB_BONUS;
+        }
+        for (Bitboard rooks = pos.get_bitboard(B_ROOK); rooks; rooks &= rooks - 1) {
+            score -= __builtin_popcountll(Bitboards::get_rook_attacks(Square(__builtin_ctzll(rooks)), occupancy)) * ROOK_MOB_BONUS;
+        }
+        for (Bitboard queens = pos.get_bitboard(W_QUEEN); queens; queens &= queens - 1) {
+            Square square = Square(__builtin_ctzll(queens));
+            score += __builtin_popcountll(Bitboards::get_rook_attacks(square, occupancy) | Bitboards::get_bishop_attacks(square, occupancy)) * QUEEN_MOB_BONUS;
+        }
+        for (Bitboard queens = pos.get_bitboard(B_QUEEN); queens; queens &= queens - 1) {
+            Square square = Square(__builtin_ctzll(queens));
+            score -= __builtin_popcountll(Bitboards::get_rook_attacks(square, occupancy) | Bitboards::get_bishop_attacks(square, occupancy)) * QUEEN_MOB_BONUS;
         }
 
         // Castling Right Bonus
@@ -201,79 +275,61 @@ namespace BitFish {
         score -= ((BKS_RIGHT & pos.game_info.castling) >> 2) * KINGSIDE_CASTLING_BONUS;
         score -= ((BQS_RIGHT & pos.game_info.castling) >> 3) * QUEENSIDE_CASTLING_BONUS;
 
-        if (__builtin_popcount(pos.get_bitboard(W_BISHOP)) >= 2) {
-            score += BISHOP_PAIR_BONUS;
-        }
-
-        if (__builtin_popcount(pos.get_bitboard(B_BISHOP)) >= 2) {
-            score -= BISHOP_PAIR_BONUS;
-        }
-
-        // Isolated Pawn
-        Bitboard white_pawns = pos.get_bitboard(W_PAWN);
-        Bitboard white_pawns_copy = white_pawns;
-        Bitboard black_pawns = pos.get_bitboard(B_PAWN);
-        Bitboard black_pawns_copy = black_pawns;
-
-        while (white_pawns) {
-            Square square = Square(__builtin_ctzll(white_pawns));
-            int file = square & 7;
-
-            Bitboard adjacent = 0ULL;
-
-            if (file > 0) {
-                adjacent |= Bitboards::file_a >> (file - 1);
-            } 
-            if (file < 7) {
-                adjacent |= Bitboards::file_a >> (file + 1);
+        // Bishop blocking pawn, trapping other bishop, only while less than half way to the endgame
+        if (2 * phase > MAX_GAME_PHASE) {
+            if (pos.piece_at(E3) == W_BISHOP && pos.piece_at(E2) == W_PAWN) {
+                score -= BISHOP_BLOCKED_PENALTY;
             }
-
-            if (!(adjacent & white_pawns_copy)) {
-                score -= ISOLATED_PAWN_PENALTY;
+            if (pos.piece_at(D3) == W_BISHOP && pos.piece_at(D2) == W_PAWN) {
+                score -= BISHOP_BLOCKED_PENALTY;
+            }
+            if (pos.piece_at(E6) == B_BISHOP && pos.piece_at(E7) == B_PAWN) {
+                score += BISHOP_BLOCKED_PENALTY;
+            }
+            if (pos.piece_at(D6) == B_BISHOP && pos.piece_at(D7) == B_PAWN) {
+                score += BISHOP_BLOCKED_PENALTY;
             }
-
-            white_pawns &= white_pawns - 1;
         }
 
-        while (black_pawns) {
-            Square square = Square(__builtin_ctzll (black_pawns));
-            int file = square & 7;
+        return score;
+    }
 
-            Bitboard adjacent = 0ULL;
+    int time_for_move (int time_left, int increment) {
+        int our_time = time_left + increment;
 
-            if (file > 0) {
-                adjacent |= Bitboards::file_a >> (file - 1);
-            } 
-            if (file < 7) {
-                adjacent |= Bitboards::file_a >> (file + 1);
-            }
+        // use 1/40 of remaining time
+        if (our_time > 100) {
+            return std::max(100, std::min(our_time - 100, our_time / 40));
+        }
 
-            if (!(adjacent & black_pawns_copy)) {
-                score += ISOLATED_PAWN_PENALTY;
-            }
+        // Almost flagging, 0 would mean no limit at all
+        return std::max(1, our_time / 2);
+    }
 
-            black_pawns &= black_pawns - 1;
+    // Returns a static evaluation of the current position
+    int evaluate (Position& pos, Pawns::PawnTable& pawn_table, Material::MaterialTable& material_table) {
+        // Draw by 50 move rule
+        if (pos.game_info.rule_50_clock >= 100) {
+            return 0;
         }
 
+        Material::MaterialEntry* material_entry = Material::probe(pos, material_table);
 
+        // Known endgames get their own evaluation
+        if (material_entry->eval_fn) {
+            int score = material_entry->eval_fn(pos, material_entry->eval_side);
+            score = std::max(-MAX_CP, std::min(score, MAX_CP));
 
-        // Bishop blocking pawn, trapping other bishop
-        if (endgame < 0.5) {
-            if (pos.piece_at(E3) == W_BISHOP && pos.piece_at(E2) == W_PAWN) {
-                score -= 30;
-            }
-            if (pos.piece_at(D3) == W_BISHOP && pos.piece_at(D2) == W_PAWN) {
-                score -= 30;
-            }
-            if (pos.piece_at(E6) == B_BISHOP && pos.piece_at(E7) == B_PAWN) {
-                score += 30;
-            }
-            if (pos.piece_at(D6) == B_BISHOP && pos.piece_at(D7) == B_PAWN) {
-                score += 30;
-            }
+            return pos.game_info.side_to_move == material_entry->eval_side ? score : -score;
         }
 
-        
+        // The network sees the position from the side to move, everything below is from white's side
+        int score = NNUE::active ? NNUE::evaluate(pos) * (pos.game_info.side_to_move == WHITE ? 1 : -1)
+                                 : classical_evaluate(pos, *material_entry, pawn_table);
+
+        // Drawish material takes away most of the winning side's advantage
+        int factor = material_entry->scale_factor(pos, score > 0 ? WHITE : BLACK);
+        score = score * factor / SCALE_NORMAL;
 
         // Clamp the score so it doesn't get interpreted as a mate
         score = std::max(-MAX_CP, std::min(score, MAX_CP));
@@ -287,17 +343,21 @@ namespace BitFish {
     
 
     // technically negamax
-    int minimax (Position& pos, int depth, int alpha, int beta, bool null_ok) {
-        search_info.nodes ++;
+    int SearchContext::minimax (SearchThread& td, int depth, int alpha, int beta, bool null_ok) {
+        Position& pos = td.pos;
+        td.info.add_node();
 
-        if (should_stop ()) return 0;
+        if (should_stop (td)) return 0;
+
+        // Nothing left that could ever mate
+        if (Material::probe(pos, td.material_table)->dead_draw) return 0;
 
         // copy value for later use
         int original_alpha = alpha;
 
         if (depth <= 0) {
             
-            return qsearch(pos, MAX_QDEPTH, alpha, beta);
+            return qsearch(td, MAX_QDEPTH, alpha, beta);
         }
 
         // Probe from transposition table 
@@ -305,38 +365,35 @@ namespace BitFish {
         Move tt_move = NO_MOVE;
 
         if (entry != nullptr && entry->depth >= depth) {
-            tt_move = entry->best_move;
+            tt_move = pos.move_from16(entry->move);
+
+            int tt_score = entry->score;
 
-            if (entry->flag == AT_LEAST) {
-                alpha = std::max(alpha, entry->score);
+            if (entry->flag() == AT_LEAST) {
+                alpha = std::max(alpha, tt_score);
             }
 
-            else if (entry->flag == AT_MOST) {
-                beta = std::min(beta, entry->score);
+            else if (entry->flag() == AT_MOST) {
+                beta = std::min(beta, tt_score);
             }
 
             if (alpha >= beta) {
                 
-                return entry->score;
+                return tt_score;
             }
         }
 
-        int ply_from_root = search_info.depth - depth;
+        int ply_from_root = td.info.depth - depth;
 
         // Search moves
         Color color_moving = pos.game_info.side_to_move;
-        MoveList moves = MoveGen::generate_moves(pos);
-        moves.sort(tt_move, killers[ply_from_root][0], killers[ply_from_root][1]);
 
-        // Keep track how many legal moves there are, in case it is a checkmate or stalemate
-        int legal_moves = 0;
-
-        bool in_check = pos.is_in_check(pos.game_info.side_to_move);
+        bool in_check = pos.is_in_check(color_moving);
 
         // Null Move Pruning
-        if (null_ok && !in_check && depth >= 3 && eg_weight(pos) < 0.7) {
+        if (null_ok && !in_check && depth >= params.null_move_min_depth && 10 * game_phase(pos) > 3 * MAX_GAME_PHASE) {
             pos.null_move();
-            int null_score = -minimax(pos, depth - 3, -beta, -beta + 1, false);
+            int null_score = -minimax(td, depth - params.null_move_reduction, -beta, -beta + 1, false);
             pos.undo_move();
             
             if (null_score >= beta && std::abs(null_score) < MAX_CP) {
@@ -353,21 +410,21 @@ namespace BitFish {
         int i = 0; 
         int cutoff_num = 0;
 
-        for (Move move: moves) {
-            
+        // Moves are only generated once the stages before them failed to cut
+        MovePicker picker (pos, td.move_buffers[pos.ply()].data(), tt_move, td.killers[ply_from_root][0], td.killers[ply_from_root][1]);
+        Move move;
+
+        while ((move = picker.next_move()) != NO_MOVE) {
             
-            pos.make_move(move);
+            // The child probes the table first thing, start loading its bucket now
+            if (depth > 1) tt.prefetch(pos.key_after(move));
 
-            // skip illegal moves that leave king in check
-            if (pos.is_in_check(color_moving)) {
-                pos.undo_move();
-                continue;
-            }
+            pos.make_move(move);
 
             if (i > 3 && depth <= 3 && !in_check) {
-                int eval = evaluate(pos);
+                int eval = evaluate(pos, td.pawn_table, td.material_table);
 
-                if (eval + FUTILITY_MARGIN * depth < alpha && CAPTURED(move) == NO_PIECE && pos.is_in_check(opposite(color_moving))) {
+                if (eval + params.futility_margin * depth < alpha && CAPTURED(move) == NO_PIECE && pos.is_in_check(opposite(color_moving))) {
                     pos.undo_move();
                     continue;
                 }
@@ -376,17 +433,17 @@ namespace BitFish {
             int score;
 
             // Late move reduction
-            if (i > 3 && depth >= 3 && !in_check && CAPTURED(move) == NO_PIECE && FLAG(move) < MOVE_NPROMO_FLAG) {
-                score = -minimax(pos, depth - 2, -alpha - 1, -alpha);
+            if (i > params.lmr_min_moves && depth >= params.lmr_min_depth && !in_check && CAPTURED(move) == NO_PIECE && FLAG(move) < MOVE_NPROMO_FLAG) {
+                score = -minimax(td, depth - 1 - params.lmr_reduction, -alpha - 1, -alpha);
 
                 if (score > alpha) {
-                    score = -minimax(pos, depth - 1, -beta, -alpha);
+                    score = -minimax(td, depth - 1, -beta, -alpha);
                 }
             } 
             
             // No late move reduction
             else {
-                score = -minimax(pos, depth - 1, -beta, -alpha);
+                score = -minimax(td, depth - 1, -beta, -alpha);
             }
 
             pos.undo_move();
@@ -396,8 +453,6 @@ namespace BitFish {
                 best_move = move;
             }
 
-            legal_moves ++;
-
             // Update alpha
             alpha = std::max(alpha, score);
 
@@ -405,13 +460,13 @@ namespace BitFish {
             if (alpha >= beta) {
 
                 if (CAPTURED(move) == NO_PIECE)
-                store_killer(move, ply_from_root);
+                td.store_killer(move, ply_from_root);
                 
                 i++;
                 break;
             };
 
-            if (search_info.nodes % 1024 == 0 && should_stop ()) {
+            if (td.info.nodes.load(std::memory_order_relaxed) % 1024 == 0 && should_stop (td)) {
                 return 0;
             }
 
@@ -419,10 +474,11 @@ namespace BitFish {
 
         }
 
-        if (legal_moves == 0) {
+        // The first move is never pruned, so no best move means no legal moves
+        if (best_move == NO_MOVE) {
             // Checkmate
-            if (pos.is_in_check(color_moving)) return - (MATE_EVAL - ply_from_root);
-        
+            if (in_check) return - (MATE_EVAL - ply_from_root);
+
             // Stalemate
             return 0;
         }
@@ -437,25 +493,26 @@ namespace BitFish {
         }
 
         // store in tt 
-        tt.store(pos.hash, depth, best_score, flag, best_move);
+        tt.store(pos.hash, depth, best_score, flag, MOVE16(best_move));
 
         return best_score;
     }
 
     // Quiescence search to fix horizon effect
-    int qsearch (Position& pos, int depth, int alpha, int beta) {
-        search_info.nodes ++;
+    int SearchContext::qsearch (SearchThread& td, int depth, int alpha, int beta) {
+        Position& pos = td.pos;
+        td.info.add_node();
 
-        if (should_stop ()) {
+        if (should_stop (td)) {
             stop();
             return 0;
         }
       
         if (depth == 0) {
-            return evaluate(pos);
+            return evaluate(pos, td.pawn_table, td.material_table);
         }
 
-        int stand_pat = evaluate (pos);
+        int stand_pat = evaluate(pos, td.pawn_table, td.material_table);
 
         // Beta cutoff
         if (stand_pat >= beta) return beta;
@@ -463,28 +520,21 @@ namespace BitFish {
         // Update alpha with standpat score
         alpha = std::max (alpha, stand_pat);
 
-        // Generate and search noisy moves
-        Color side_moving = pos.game_info.side_to_move;
-        MoveList moves = MoveGen::generate_moves (pos);
-        moves.sort(NO_MOVE);
+        // Only the noisy moves are generated, plus quiet checks on the first few plies
+        MovePicker picker (pos, td.move_buffers[pos.ply()].data(), depth > MAX_QDEPTH - QSEARCH_CHECK_PLIES);
+        Move move;
 
-        for (Move move: moves) {
+        while ((move = picker.next_move()) != NO_MOVE) {
             bool is_noisy = (CAPTURED(move) != NO_PIECE) || (FLAG(move) >= MOVE_NPROMO_FLAG);
-            
-            if (!is_noisy) continue;
 
             int gain = std::abs(material[CAPTURED(move)])  - std::abs(material[MOVED(move)] + 100);
 
-            if (stand_pat + gain + 200 < alpha) continue;
+            // A check isn't after material, so it doesn't get delta pruned
+            if (is_noisy && stand_pat + gain + 200 < alpha) continue;
 
             pos.make_move(move);
 
-            if (pos.is_in_check(side_moving)) {
-                pos.undo_move();
-                continue;
-            }
-
-            int score = -qsearch(pos, depth - 1, -beta, -alpha);
+            int score = -qsearch(td, depth - 1, -beta, -alpha);
 
             pos.undo_move();
 
@@ -492,7 +542,7 @@ namespace BitFish {
                 return beta;
             }
 
-            if (search_info.nodes % 1024 == 0 && should_stop ()) {
+            if (td.info.nodes.load(std::memory_order_relaxed) % 1024 == 0 && should_stop (td)) {
                 return 0;
             }
 
@@ -504,41 +554,36 @@ namespace BitFish {
 
     
     // Call at root, gets both eval and best move
-    std::pair<Move, int> get_best_move(Position& pos, int depth, Move pv, int alpha, int beta) {
-    
+    std::pair<Move, int> SearchContext::get_best_move(SearchThread& td, int depth, Move pv, int alpha, int beta) {
+        Position& pos = td.pos;
+
         Move best_move = NO_MOVE;
         int best_score = -INF;
 
-        Color side_moving = pos.game_info.side_to_move;
-
-        search_info.depth = depth;
+        td.info.depth = depth;
 
         HTEntry* ttentry = tt.probe(pos.hash);
         Move tt_move = NO_MOVE;
 
         if (ttentry != nullptr) {
-            tt_move = ttentry->best_move;
+            tt_move = pos.move_from16(ttentry->move);
         }
         MoveList moves = MoveGen::generate_moves(pos);
         moves.sort(pv, NO_MOVE, NO_MOVE, tt_move);
 
         for (Move move: moves) {
             
+            if (depth > 1) tt.prefetch(pos.key_after(move));
 
             pos.make_move(move);
 
-            if (pos.is_in_check(side_moving)) {
-                pos.undo_move();
-                continue;
-            }
-
-            int score = -minimax(pos, depth - 1, -beta, -alpha);
+            int score = -minimax(td, depth - 1, -beta, -alpha);
 
             
 
             pos.undo_move();
 
-            if (search_info.nodes % 1024 == 0 && should_stop ()) {
+            if (td.info.nodes.load(std::memory_order_relaxed) % 1024 == 0 && should_stop (td)) {
                 stop();
                 
             }
@@ -562,7 +607,7 @@ namespace BitFish {
 
         
         if (best_move != NO_MOVE) {
-            tt.store(pos.hash, depth, best_score, EXACT, best_move);
+            tt.store(pos.hash, depth, best_score, EXACT, MOVE16(best_move));
         }
 
 
@@ -570,46 +615,49 @@ namespace BitFish {
 
     }
 
-    void go (int depth_lim, int move_time) {
-
-        reset_killers();
-
-        search_info.reset();
-
-        
-        search_info.start_time = steady_clock::now();
-        search_info.max_time_ms = move_time;
+    // Only the main thread reports, helpers just fill the transposition table for it
+    void SearchContext::iterative_deepening (SearchThread& td, int depth_lim) {
+        Position& pos = td.pos;
+        bool is_main = td.id == 0;
 
         bool mate_found = false;
 
         Move best_move = NO_MOVE;
         int eval = 0;
-        int aspiration_window = 67;
 
-        for (int depth = 1; depth <= depth_lim; ++depth) {
+        for (int iteration = 1; iteration <= depth_lim; ++iteration) {
+            // Odd helpers search one ply deeper so the threads don't all walk the same tree in lockstep
+            int depth = is_main ? iteration : std::min(iteration + (td.id & 1), depth_lim);
+
             std::pair<Move, int> result;
             if (depth == 1) {
-                result = get_best_move(current_pos, depth, best_move, -INF, INF);
+                result = get_best_move(td, depth, best_move, -INF, INF);
             }
             else {
-                int alpha = eval - 67;
-                int beta  = eval + 67;
+                int alpha = eval - params.aspiration_window;
+                int beta  = eval + params.aspiration_window;
 
-                result = get_best_move(current_pos, depth, best_move, alpha, beta);
+                result = get_best_move(td, depth, best_move, alpha, beta);
 
                 int score = result.second;
 
                 if (score <= alpha || score >= beta) {
                     // fallback to full window
-                    result = get_best_move(current_pos, depth, best_move, -INF, INF);
+                    result = get_best_move(td, depth, best_move, -INF, INF);
                 }
             }
 
             if (search_info.stop) break;
 
+            // Mated or stalemated at the root, there is no move to search or walk a PV from
+            if (result.first == NO_MOVE && best_move == NO_MOVE) break;
+
             if (result.first != NO_MOVE) {
                 eval = result.second;
                 best_move = result.first;
+
+                td.best_move = best_move;
+                td.eval = eval;
             }
 
             
@@ -617,6 +665,8 @@ namespace BitFish {
             if (std::abs(eval) > MAX_CP)
                 mate_found = true;
 
+            if (!is_main || !uci_output) continue;
+
             auto elapsed = duration_cast<milliseconds>(
                 steady_clock::now() - search_info.start_time).count();
 
@@ -624,7 +674,7 @@ namespace BitFish {
 
             int moves = 0;
 
-            BitFish::current_pos.make_move(best_move);
+            pos.make_move(best_move);
 
             // Track PV through transposition table
 
@@ -632,40 +682,94 @@ namespace BitFish {
             int i; 
             for (i = 0; i < depth; i++) {
                 // Probe TT
-                HTEntry* probe = BitFish::tt.probe(BitFish::current_pos.hash);
+                HTEntry* probe = tt.probe(pos.hash);
 
                 // Entry does not exist
-                if (probe == nullptr || probe->best_move == NO_MOVE) {
+                if (probe == nullptr || probe->move == NO_MOVE16) {
                     break;
                 }
 
-                
-                pv.push_back(probe->best_move);
-                BitFish::current_pos.make_move(probe->best_move);
+                // Key collisions and helpers writing the table mean the move may not even be from this position
+                Move pv_move = pos.move_from16(probe->move);
+                MoveList legal = MoveGen::generate_moves(pos);
+
+                if (std::find(legal.begin(), legal.end(), pv_move) == legal.end()) {
+                    break;
+                }
+
+                pv.push_back(pv_move);
+                pos.make_move(pv_move);
 
             }
 
             for (int j = 0; j <= i; j++) {
-                BitFish::current_pos.undo_move();
+                pos.undo_move();
             }
 
             
 
             UCI::info_depth(depth,
                             eval,
-                            search_info.nodes,
+                            nodes_searched(),
                             elapsed,
                             pv);
 
-            if (should_stop())
+            if (should_stop(td))
                 break;
         }
+    }
 
+    SearchResult SearchContext::go (int depth_lim, int move_time, uint64_t node_limit) {
+
+        // A stop sent before this thread got here still counts, the flag is cleared when a search ends instead
+        bool stopped = search_info.stop.load(std::memory_order_relaxed);
+        search_info.reset();
+        search_info.stop.store(stopped, std::memory_order_relaxed);
+
+        tt.new_search();
 
         
-        std::cout << "bestmove " << move_to_string (best_move) << std::endl;
-        
-        
+        search_info.start_time = steady_clock::now();
+        search_info.max_time_ms = move_time;
+        search_info.max_nodes = node_limit;
+
+        for (auto& td: threads) {
+            td->pos = current_pos;
+            td->info.reset();
+            td->reset_killers();
+            td->best_move = NO_MOVE;
+            td->eval = 0;
+        }
+
+        std::vector<std::thread> helpers;
+
+        for (size_t i = 1; i < threads.size(); i++) {
+            helpers.emplace_back(&SearchContext::iterative_deepening, this, std::ref(*threads[i]), depth_lim);
+        }
+
+        iterative_deepening(*threads[0], depth_lim);
+
+        // The main thread is done, so the helpers are too
+        stop();
+
+        for (std::thread& helper: helpers) {
+            helper.join();
+        }
+
+        search_info.stop.store(false, std::memory_order_relaxed);
+
+        // Stopped before the first iteration finished, any legal move beats none
+        if (threads[0]->best_move == NO_MOVE) {
+            MoveList legal = MoveGen::generate_moves(current_pos);
+            if (legal.size) threads[0]->best_move = legal[0];
+        }
+
+        if (uci_output) {
+            Move best = threads[0]->best_move;
+            std::cout << "bestmove " << (best == NO_MOVE ? "0000" : move_to_string (best)) << std::endl;
+        }
+
+        return {threads[0]->best_move, threads[0]->eval, nodes_searched()};
 
     }
 
@@ -9,41 +9,138 @@
 
 #include "uci.h"
 #include "movegen.h"
+#include "pawns.h"
+#include "material.h"
 
 #include <string>
 #include <string_view>
 #include <chrono>
 #include <cstring>
 #include <vector>
+#include <memory>
 
 
 using namespace std::chrono;
 
 namespace BitFish {
 
-    // Global State
-    extern SearchInfo search_info;
-    extern Position current_pos;
-    extern HashTable tt;
-    extern std::array<std::array<Move, 2>, MAX_DEPTH> killers;
+    // Search constants that can change at runtime, each context has its own so engines with different values can play each other
+    struct SearchParams {
+        int futility_margin = FUTILITY_MARGIN;
+        int lmr_min_moves = LMR_MIN_MOVES;
+        int lmr_min_depth = LMR_MIN_DEPTH;
+        int lmr_reduction = LMR_REDUCTION;
+        int null_move_min_depth = NULL_MOVE_MIN_DEPTH;
+        int null_move_reduction = NULL_MOVE_REDUCTION;
+        int aspiration_window = ASPIRATION_WINDOW;
+    };
 
-    // Killer functions
-    void reset_killers ();
-    void store_killer (Move move, int ply);
+    // A search parameter as a UCI spin option, with what SPSA needs to tune it
+    struct Tunable {
+        const char* name;
+        int SearchParams::* value;
+        int min;
+        int max;
 
-    // UCI Interface
-    void position (std::string_view fen);
-    void go (int depth_lim, int move_time);
-    void stop ();
-    bool should_stop ();
+        // How far SPSA still moves the value either side at the end of a run
+        double c_end;
+    };
 
-    // Evaluation Functions
-    int evaluate (Position& pos);
-    float eg_weight (Position& pos);
+    inline const std::array<Tunable, 7> TUNABLES = {{
+        {"FutilityMargin", &SearchParams::futility_margin, 0, 500, 15.0},
+        {"LmrMinMoves", &SearchParams::lmr_min_moves, 0, 20, 1.0},
+        {"LmrMinDepth", &SearchParams::lmr_min_depth, 1, 10, 0.6},
+        {"LmrReduction", &SearchParams::lmr_reduction, 0, 4, 0.6},
+        {"NullMoveMinDepth", &SearchParams::null_move_min_depth, 1, 10, 0.6},
+        {"NullMoveReduction", &SearchParams::null_move_reduction, 1, 6, 0.6},
+        {"AspirationWindow", &SearchParams::aspiration_window, 5, 500, 8.0},
+    }};
+
+    // Everything one search thread owns, the threads only share the transposition table
+    struct SearchThread {
+        int id = 0;
+
+        // Every thread searches its own copy of the root position
+        Position pos;
+        SearchInfo info;
+
+        // Killer Moves: If one move is good at this depth in this branch
+        // Try it another branch
+        std::array<std::array<Move, 2>, MAX_DEPTH> killers;
+
+        // Where each ply's move picker generates and scores its moves, indexed by Position::ply
+        // Threads live on the heap, so no node puts a move list on the stack or copies one around
+        std::array<MoveBuffer, MAX_PLY> move_buffers;
+
+        // Evaluation caches, owned by the thread so they stay warm from one search to the next
+        Pawns::PawnTable pawn_table;
+        Material::MaterialTable material_table;
+
+        // Result of the last completed iteration
+        Move best_move = NO_MOVE;
+        int eval = 0;
+
+        // Killer functions
+        void reset_killers ();
+        void store_killer (Move move, int ply);
+    };
+
+    // Returned by go, so callers that don't read the UCI output still get the answer
+    struct SearchResult {
+        Move best_move = NO_MOVE;
+        int eval = 0;
+        uint64_t nodes = 0;
+    };
+
+    // One independent engine: its own position, threads, heuristics and stop flag
+    // Many contexts can search at once in one process, the attack tables and zobrist keys are shared read only
+    class SearchContext {
+        public:
+            SearchContext (HashTable& table, int thread_count = 1);
+
+            // Contains information for timing, depth, and when to stop
+            SearchInfo search_info;
 
-    // Search Functions
-    int minimax (Position& pos, int depth, int alpha, int beta, bool null_ok=true);
-    int qsearch (Position& pos, int depth, int alpha, int beta);
-    std::pair<Move, int> get_best_move (Position& pos, int depth, Move pv, int alpha=-INF, int beta=INF);
+            // The current position, set by using the 'position' uci command
+            Position current_pos;
+
+            // Transposition Table, shared by every thread of this context
+            HashTable& tt;
+
+            // Lazy SMP, thread 0 is the main thread and the rest are helpers
+            std::vector<std::unique_ptr<SearchThread>> threads;
+
+            // Prints info and bestmove lines, turned off when the context isn't talking to a GUI
+            bool uci_output = true;
+
+            SearchParams params;
+
+            void set_threads (int count);
+            uint64_t nodes_searched () const;
+            void reset_killers ();
+
+            // UCI Interface
+            void position (std::string_view fen);
+            SearchResult go (int depth_lim, int move_time, uint64_t node_limit = 0);
+            void stop ();
+            bool should_stop (const SearchThread& td);
+
+            // Search Functions
+            int minimax (SearchThread& td, int depth, int alpha, int beta, bool null_ok=true);
+            int qsearch (SearchThread& td, int depth, int alpha, int beta);
+            std::pair<Move, int> get_best_move (SearchThread& td, int depth, Move pv, int alpha=-INF, int beta=INF);
+            void iterative_deepening (SearchThread& td, int depth_lim);
+    };
+
+    // Global State, the engine driven by the UCI loop
+    extern HashTable tt;
+    extern SearchContext engine;
+
+    // Milliseconds to spend on a move with this much time left on the clock
+    int time_for_move (int time_left, int increment);
+
+    // Evaluation Functions
+    int evaluate (Position& pos, Pawns::PawnTable& pawn_table, Material::MaterialTable& material_table);
+    int game_phase (const Position& pos);
 
 } 
@@ -16,12 +16,9 @@ constexpr int BOARD_SIZE = 64;
 constexpr int PIECE_NUM  = 12;
 constexpr int COLOR_NUM = 2;
 
-constexpr int BISHOP_BLOCKER_COMBINATIONS = 1 << 9;
-constexpr int ROOK_BLOCKER_COMBINATIONS = 1 << 12;
-
 constexpr uint32_t NO_MOVE = -1;
 
-const std::string STARTING_POS_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+constexpr std::string_view STARTING_POS_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 constexpr std::array<int, PIECE_NUM + 1> material = {
     100, 300, 320, 500, 900, 0, -100, -300, -320, -500, -900, 0, 0
@@ -75,14 +72,30 @@ const std::string VERSION = "v0.5.3";
 constexpr int KINGSIDE_CASTLING_BONUS = 8;
 constexpr int QUEENSIDE_CASTLING_BONUS = 6;
 
+// A bishop in front of its own centre pawn before the endgame
+constexpr int BISHOP_BLOCKED_PENALTY = 30;
+
 constexpr int KNIGHT_MOB_BONUS = 4;
 constexpr int BISHOP_MOB_BONUS = 3;
 constexpr int ROOK_MOB_BONUS = 2;
 constexpr int QUEEN_MOB_BONUS = 2;
 
 constexpr int MAX_DEPTH = 16;
+constexpr int MAX_THREADS = 256;
+
+constexpr int DEFAULT_HASH_MB = 64;
+constexpr int MAX_HASH_MB = 1 << 20;
 constexpr int MAX_QDEPTH = 20;
 
+// Most moves a legal position can have is 218
+constexpr int MAX_MOVES = 256;
+
+// Longest line the search, a PV walk or perft plays out from one position, the move history and the per ply move buffers are this deep
+constexpr int MAX_PLY = 64;
+
+// Quiescence plies that also try quiet checks, 0 for captures and promotions only
+constexpr int QSEARCH_CHECK_PLIES = 0;
+
 constexpr int BISHOP_PAIR_BONUS = 30;
 
 constexpr int KING_SQUARE_CONTROLLED_BONUS = 5;
@@ -94,13 +107,49 @@ constexpr int QUEEN_GAME_PHASE = 38;
 
 constexpr int MAX_GAME_PHASE = 218;
 
+// Search defaults, each one can be changed at runtime through its SearchParams tunable
 constexpr int FUTILITY_MARGIN = 150;
 
+// Late move reductions start after this many moves, from this depth on
+constexpr int LMR_MIN_MOVES = 3;
+constexpr int LMR_MIN_DEPTH = 3;
+constexpr int LMR_REDUCTION = 1;
+
+constexpr int NULL_MOVE_MIN_DEPTH = 3;
+constexpr int NULL_MOVE_REDUCTION = 3;
+
+constexpr int ASPIRATION_WINDOW = 67;
+
 constexpr std::array<int, 8> passed_pawn_bonuses = {
     0, 10, 15, 30, 50, 100, 150, 0
 };
 
 constexpr int ISOLATED_PAWN_PENALTY = 7;
+constexpr int DOUBLED_PAWN_PENALTY = 12;
+constexpr int BACKWARD_PAWN_PENALTY = 8;
+
+// Entries per thread, a power of two
+constexpr size_t PAWN_HASH_SIZE = 1 << 14;
+constexpr size_t MATERIAL_HASH_SIZE = 1 << 13;
+
+// Imbalance, a knight gets better and a rook worse with more pawns on the board
+constexpr int KNIGHT_PAWN_ADJUSTMENT = 6;
+constexpr int ROOK_PAWN_ADJUSTMENT = 12;
+
+// Endgame evaluations add this when the win is certain, still well below MAX_CP
+constexpr int KNOWN_WIN = 2000;
+
+// NNUE, 768 piece-square inputs per perspective into one hidden layer, then a single output
+// Accumulators are int16 scaled by QA, clipped to [0, QA] and multiplied by int8 output weights scaled by QB
+constexpr int NNUE_INPUTS = 768;
+constexpr int NNUE_HIDDEN = 256;
+constexpr int NNUE_QA = 127;
+constexpr int NNUE_QB = 64;
+constexpr int NNUE_SCALE = 400;
+
+// Endgame scale factors are out of 64
+constexpr int SCALE_NORMAL = 64;
+constexpr int SCALE_DRAW = 0;
 
 namespace EvalTables {
     constexpr std::array<int, BOARD_SIZE> pawn_table_mg = {
@@ -190,5 +239,33 @@ namespace EvalTables {
           0,   0,   10,  10,  10,  10,   0,   0,
         -10,  -5,    0,   0,   0,   0,  -5, -10
     };
+
+    // Material plus piece square score of every piece on every square, built once at compile time
+    // Black looks up the square rotated by 180 degrees and counts negative, like evaluate always did
+    constexpr std::array<std::array<Score, BOARD_SIZE>, PIECE_NUM> psq_table = [] {
+        std::array<std::array<Score, BOARD_SIZE>, PIECE_NUM> table {};
+
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            table[W_PAWN][square] = make_score(material[W_PAWN] + pawn_table_mg[square], material[W_PAWN] + pawn_table_eg[square]);
+            table[W_KNIGHT][square] = make_score(material[W_KNIGHT] + knight_table[square], material[W_KNIGHT] + knight_table[square]);
+            table[W_BISHOP][square] = make_score(material[W_BISHOP] + bishop_table[square], material[W_BISHOP] + bishop_table[square]);
+            table[W_ROOK][square] = make_score(material[W_ROOK] + rook_table[square], material[W_ROOK] + rook_table[square]);
+            table[W_QUEEN][square] = make_score(material[W_QUEEN] + queen_table[square], material[W_QUEEN] + queen_table[square]);
+            table[W_KING][square] = make_score(king_table_mg[square], king_table_eg[square]);
+        }
+
+        for (int piece = W_PAWN; piece <= W_KING; piece++) {
+            for (int square = 0; square < BOARD_SIZE; square++) {
+                table[piece + 6][square] = -table[piece][63 - square];
+            }
+        }
+
+        return table;
+    }();
 }
-    
\ No newline at end of file
+
+// How much each piece counts towards the game phase, pawns and kings don't
+constexpr std::array<int, PIECE_NUM> piece_phase = {
+    0, KNIGHT_GAME_PHASE, BISHOP_GAME_PHASE, ROOK_GAME_PHASE, QUEEN_GAME_PHASE, 0,
+    0, KNIGHT_GAME_PHASE, BISHOP_GAME_PHASE, ROOK_GAME_PHASE, QUEEN_GAME_PHASE, 0
+};
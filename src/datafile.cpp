@@ -0,0 +1,520 @@
+/**
+ * datafile.cpp
+ *
+ * Training data container implementation
+ */
+
+#include "datafile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+
+#include <sys/resource.h>
+
+namespace DataFile {
+
+    namespace {
+
+        uint32_t fnv1a (const uint8_t* data, size_t size) {
+            uint32_t hash = 2166136261u;
+
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ data[i]) * 16777619u;
+            }
+
+            return hash;
+        }
+
+        template <typename T>
+        void append (std::vector<uint8_t>& buffer, const T& value) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+        }
+
+        template <typename T>
+        T read_at (const std::vector<uint8_t>& buffer, size_t& offset) {
+            T value;
+            std::memcpy(&value, buffer.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return value;
+        }
+
+        struct ChunkHeader {
+            uint32_t magic;
+            uint32_t payload_bytes;
+            uint32_t game_count;
+            uint32_t checksum;
+        };
+
+        static_assert(sizeof(ChunkHeader) == CHUNK_HEADER_BYTES, "Chunk header layout");
+
+        // What the shuffle keeps on disk between its two passes
+        struct BucketRecord {
+            Key hash;
+            PackedPosition packed;
+        };
+
+        struct ShuffleState {
+            std::ofstream out;
+            std::mt19937_64 rng {std::random_device{}()};
+
+            // Records one bucket may hold and still be shuffled in memory
+            uint64_t capacity;
+
+            // A bucket splits into at most 2^max_bits files at once, well clear of the open file limit
+            int max_bits;
+
+            // Bucket files still on disk, removed if the shuffle gives up
+            std::set<std::string> temporary;
+
+            std::vector<BucketRecord> records;
+            uint64_t written = 0;
+            uint64_t buckets = 0;
+        };
+
+        // Bucket files open for writing, a record goes to the one picked by its hash bits just above shift
+        struct BucketFiles {
+            std::vector<std::string> names;
+            std::vector<std::unique_ptr<std::ofstream>> files;
+            int shift, bits;
+
+            bool open (ShuffleState& state, const std::string& prefix, int remaining, int bucket_bits) {
+                shift = remaining - bucket_bits;
+                bits = bucket_bits;
+
+                for (int i = 0; i < 1 << bits; i++) {
+                    names.push_back(prefix + ".bucket" + std::to_string(i));
+                    files.push_back(std::make_unique<std::ofstream>(names.back(), std::ios::binary | std::ios::trunc));
+                    state.temporary.insert(names.back());
+                    state.buckets++;
+
+                    if (!files.back()->is_open()) {
+                        std::cout << "info string shuffle cannot create " << names.back() << std::endl;
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            void write (const BucketRecord& record) {
+                size_t index = bits ? (record.hash >> shift) & ((1ull << bits) - 1) : 0;
+                files[index]->write((const char*) &record, sizeof(record));
+            }
+
+            // Closing flushes, so a full disk shows up here at the latest
+            bool close () {
+                bool good = true;
+
+                for (size_t i = 0; i < files.size(); i++) {
+                    files[i]->close();
+
+                    if (files[i]->fail()) {
+                        std::cout << "info string shuffle cannot write " << names[i] << std::endl;
+                        good = false;
+                    }
+                }
+
+                return good;
+            }
+        };
+
+        // Fewest hash bits that split count records into buckets of at most capacity
+        int bucket_bits (const ShuffleState& state, uint64_t count, int remaining) {
+            int bits = 0;
+
+            while (bits < std::min(state.max_bits, remaining) && (count >> bits) > state.capacity) {
+                bits++;
+            }
+
+            return bits;
+        }
+
+        // Dedups and shuffles one bucket into the output, splitting it on the next hash bits first when it doesn't fit in memory
+        bool drain (ShuffleState& state, const std::string& name, int remaining) {
+            std::ifstream in (name, std::ios::binary | std::ios::ate);
+            std::streamoff size = in.is_open() ? std::streamoff(in.tellg()) : -1;
+
+            if (size < 0 || !in.seekg(0)) {
+                std::cout << "info string shuffle cannot read " << name << std::endl;
+                return false;
+            }
+
+            uint64_t count = uint64_t(size) / sizeof(BucketRecord);
+
+            if (count > state.capacity && remaining > 0) {
+                BucketFiles buckets;
+
+                if (!buckets.open(state, name, remaining, std::max(bucket_bits(state, count, remaining), 1))) return false;
+
+                BucketRecord record;
+
+                while (in.read((char*) &record, sizeof(record))) {
+                    buckets.write(record);
+                }
+
+                if (in.bad() || !buckets.close()) {
+                    std::cout << "info string shuffle cannot split " << name << std::endl;
+                    return false;
+                }
+
+                in.close();
+                std::filesystem::remove(name);
+                state.temporary.erase(name);
+
+                for (const std::string& child: buckets.names) {
+                    if (!drain(state, child, buckets.shift)) return false;
+                }
+
+                return true;
+            }
+
+            // With every hash bit used up the whole bucket is one position
+            if (remaining == 0) count = std::min<uint64_t>(count, 1);
+
+            state.records.resize(count);
+
+            if (!in.read((char*) state.records.data(), count * sizeof(BucketRecord))) {
+                std::cout << "info string shuffle cannot read " << name << std::endl;
+                return false;
+            }
+
+            in.close();
+            std::filesystem::remove(name);
+            state.temporary.erase(name);
+
+            std::vector<BucketRecord>& records = state.records;
+
+            std::stable_sort(records.begin(), records.end(), [](const BucketRecord& a, const BucketRecord& b) {
+                return a.hash < b.hash;
+            });
+
+            records.erase(std::unique(records.begin(), records.end(), [](const BucketRecord& a, const BucketRecord& b) {
+                return a.hash == b.hash;
+            }), records.end());
+
+            std::shuffle(records.begin(), records.end(), state.rng);
+
+            for (const BucketRecord& record: records) {
+                state.out.write((const char*) &record.packed, sizeof(PackedPosition));
+            }
+
+            if (!state.out) {
+                std::cout << "info string shuffle cannot write the output" << std::endl;
+                return false;
+            }
+
+            state.written += records.size();
+            return true;
+        }
+    }
+
+    void unpack (const PackedPosition& packed, Position& pos) {
+        std::array<Piece, BOARD_SIZE> mailbox;
+        mailbox.fill(NO_PIECE);
+
+        int index = 0;
+        for (uint64_t occupancy = packed.occupancy; occupancy; occupancy &= occupancy - 1) {
+            mailbox[__builtin_ctzll(occupancy)] = packed.piece(index++);
+        }
+
+        // Going through a FEN keeps every incremental key and score on the one tested path
+        std::string fen;
+
+        for (int rank = 7; rank >= 0; rank--) {
+            int empty = 0;
+
+            for (int file = 0; file < 8; file++) {
+                Piece piece = mailbox[rank * 8 + file];
+
+                if (piece == NO_PIECE) {
+                    empty++;
+                    continue;
+                }
+
+                if (empty) fen += char('0' + empty);
+                empty = 0;
+                fen += PIECE_TO_CHAR[piece];
+            }
+
+            if (empty) fen += char('0' + empty);
+            if (rank) fen += '/';
+        }
+
+        fen += packed.side_to_move == WHITE ? " w " : " b ";
+
+        std::string castling;
+        if (packed.castling & WKS_RIGHT) castling += 'K';
+        if (packed.castling & WQS_RIGHT) castling += 'Q';
+        if (packed.castling & BKS_RIGHT) castling += 'k';
+        if (packed.castling & BQS_RIGHT) castling += 'q';
+        fen += castling.empty() ? "-" : castling;
+
+        if (packed.ep_square < NO_SQUARE) {
+            fen += ' ';
+            fen += char('a' + (packed.ep_square & 7));
+            fen += char('1' + (packed.ep_square >> 3));
+        } else {
+            fen += " -";
+        }
+
+        fen += " " + std::to_string(packed.rule_50_clock) + " 1";
+
+        pos.parse_fen(fen);
+    }
+
+    Writer::Writer (const std::string& file) {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(file, error);
+
+        if (error || size < FILE_HEADER_BYTES) {
+            out.open(file, std::ios::binary | std::ios::trunc);
+
+            uint32_t header[4] = {FILE_MAGIC, FILE_VERSION, 0, 0};
+            out.write((const char*) header, sizeof(header));
+            out.flush();
+            return;
+        }
+
+        // Walk the chunk headers to find where the last whole chunk ends
+        {
+            std::ifstream in (file, std::ios::binary);
+
+            uint32_t header[4];
+            in.read((char*) header, sizeof(header));
+
+            if (!in || header[0] != FILE_MAGIC || header[1] != FILE_VERSION) {
+                std::cout << "info string " << file << " is not a training data file" << std::endl;
+                return;
+            }
+
+            uintmax_t valid = FILE_HEADER_BYTES;
+            ChunkHeader chunk;
+
+            while (in.read((char*) &chunk, sizeof(chunk)) && chunk.magic == CHUNK_MAGIC
+                   && valid + CHUNK_HEADER_BYTES + chunk.payload_bytes <= size) {
+                valid += CHUNK_HEADER_BYTES + chunk.payload_bytes;
+                existing_games += chunk.game_count;
+                in.seekg(valid);
+            }
+
+            if (valid != size) {
+                std::filesystem::resize_file(file, valid);
+            }
+        }
+
+        out.open(file, std::ios::binary | std::ios::app);
+    }
+
+    Writer::~Writer () {
+        flush();
+    }
+
+    bool Writer::is_open () const {
+        return out.is_open() && out.good();
+    }
+
+    void Writer::write (const Game& game) {
+        uint16_t count = uint16_t(std::min<size_t>(game.steps.size(), UINT16_MAX));
+
+        append(buffer, game.start);
+        append(buffer, count);
+
+        for (size_t i = 0; i < count; i++) {
+            append(buffer, game.steps[i]);
+        }
+
+        buffered_games++;
+
+        if (buffer.size() >= CHUNK_BYTES) flush();
+    }
+
+    void Writer::flush () {
+        if (!buffered_games || !out.is_open()) return;
+
+        ChunkHeader chunk {CHUNK_MAGIC, uint32_t(buffer.size()), buffered_games, fnv1a(buffer.data(), buffer.size())};
+
+        out.write((const char*) &chunk, sizeof(chunk));
+        out.write((const char*) buffer.data(), buffer.size());
+        out.flush();
+
+        buffer.clear();
+        buffered_games = 0;
+    }
+
+    Reader::Reader (const std::string& file) : in(file, std::ios::binary) {
+        uint32_t header[4];
+        in.read((char*) header, sizeof(header));
+
+        if (!in || header[0] != FILE_MAGIC || header[1] != FILE_VERSION) {
+            in.close();
+        }
+    }
+
+    bool Reader::is_open () const {
+        return in.is_open();
+    }
+
+    bool Reader::next_chunk () {
+        ChunkHeader chunk;
+
+        if (!in.read((char*) &chunk, sizeof(chunk)) || chunk.magic != CHUNK_MAGIC) return false;
+
+        payload.resize(chunk.payload_bytes);
+        if (!in.read((char*) payload.data(), payload.size())) return false;
+
+        if (fnv1a(payload.data(), payload.size()) != chunk.checksum) {
+            std::cout << "info string corrupt chunk, stopping this file" << std::endl;
+            return false;
+        }
+
+        offset = 0;
+        games_left = chunk.game_count;
+
+        return true;
+    }
+
+    bool Reader::next (PackedPosition& packed, Key& hash) {
+        while (true) {
+            while (steps_left == 0) {
+                if (games_left == 0 && !next_chunk()) return false;
+
+                PackedPosition start = read_at<PackedPosition>(payload, offset);
+                steps_left = read_at<uint16_t>(payload, offset);
+                games_left--;
+
+                unpack(start, pos);
+                result = start.result;
+            }
+
+            Step step = read_at<Step>(payload, offset);
+            steps_left--;
+
+            bool training = step.score != NO_SCORE;
+
+            if (training) {
+                packed = pack_position(pos.board.mailbox, pos.game_info.side_to_move, step.score, result,
+                                       pos.game_info.castling, pos.game_info.ep_square, pos.game_info.rule_50_clock);
+                hash = pos.hash;
+            }
+
+            Move move = pos.move_from16(step.move);
+
+            // Nothing after a bad move can be trusted, skip the rest of the game
+            if (move == NO_MOVE) {
+                offset += steps_left * sizeof(Step);
+                steps_left = 0;
+            } else {
+                pos.make_move(move);
+                pos.history.clear();
+            }
+
+            if (training) return true;
+        }
+    }
+
+    void shuffle (const std::vector<std::string>& inputs, const std::string& output, size_t memory_mb) {
+        // Truncating the output must never eat an input
+        for (const std::string& file: inputs) {
+            std::error_code error;
+
+            if (file == output || std::filesystem::equivalent(file, output, error)) {
+                std::cout << "info string shuffle output " << output << " is also an input" << std::endl;
+                return;
+            }
+        }
+
+        ShuffleState state;
+        state.capacity = std::max<uint64_t>(uint64_t(memory_mb) * (1 << 20) / sizeof(BucketRecord), 1);
+
+        // Half the open file limit goes to buckets, the rest stays free for the inputs, the output and everything else
+        rlimit limit;
+        uint64_t open_files = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY ? limit.rlim_cur : 1024;
+        state.max_bits = std::clamp(63 - __builtin_clzll(std::max<uint64_t>(open_files / 2, 2)), 1, 8);
+
+        // Worst case every step is a training position, buckets that still don't fit are split again
+        uintmax_t input_bytes = 0;
+
+        for (const std::string& file: inputs) {
+            std::error_code error;
+            uintmax_t size = std::filesystem::file_size(file, error);
+            if (!error) input_bytes += size;
+        }
+
+        // A half written output would pass for real data, so it goes along with the buckets
+        auto give_up = [&state, &output] () {
+            std::error_code error;
+
+            for (const std::string& name: state.temporary) {
+                std::filesystem::remove(name, error);
+            }
+
+            if (state.out.is_open()) {
+                state.out.close();
+                std::filesystem::remove(output, error);
+            }
+        };
+
+        // Pass 1, spread the positions over buckets by hash, so duplicates always meet in the same bucket
+        BucketFiles buckets;
+        uint64_t read = 0;
+
+        if (!buckets.open(state, output, 64, bucket_bits(state, input_bytes / sizeof(Step) + 1, 64))) {
+            give_up();
+            return;
+        }
+
+        for (const std::string& file: inputs) {
+            Reader reader (file);
+
+            if (!reader.is_open()) {
+                std::cout << "info string cannot read " << file << std::endl;
+                continue;
+            }
+
+            BucketRecord record;
+
+            while (reader.next(record.packed, record.hash)) {
+                buckets.write(record);
+                read++;
+            }
+        }
+
+        if (!buckets.close()) {
+            give_up();
+            return;
+        }
+
+        // Pass 2, dedup and shuffle each bucket in memory, the hash already scattered positions across buckets
+        state.out.open(output, std::ios::binary | std::ios::trunc);
+
+        if (!state.out.is_open()) {
+            std::cout << "info string shuffle cannot create " << output << std::endl;
+            give_up();
+            return;
+        }
+
+        for (const std::string& name: buckets.names) {
+            if (!drain(state, name, buckets.shift)) {
+                give_up();
+                return;
+            }
+        }
+
+        state.out.flush();
+
+        if (!state.out) {
+            std::cout << "info string shuffle cannot write " << output << std::endl;
+            give_up();
+            return;
+        }
+
+        std::cout << "info string shuffle read " << read << " positions, wrote " << state.written
+                  << ", removed " << read - state.written << " duplicates using " << state.buckets << " buckets" << std::endl;
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * datafile.h
+ *
+ * Training data container interface
+ * Games are stored as a start position plus 4 bytes per move, instead of 32 bytes per position
+ *
+ * File layout, little endian:
+ *   file header:  char magic[4] "BFDC", uint32 version, uint64 reserved
+ *   then chunks:  uint32 magic "CHNK", uint32 payload bytes, uint32 game count, uint32 FNV-1a of the payload
+ *                 followed by the payload, the games back to back
+ *   game:         PackedPosition start, its result field is the game result for every position
+ *                 uint16 step count, then per step int16 score, uint16 move (MOVE16)
+ *
+ * A step is the position before its move: the score is the training score from white's point of view,
+ * or NO_SCORE if the position is not a training position. The position after the last move is never one.
+ * Chunks are only written whole, so a file cut short by a crash just loses its last chunk.
+ */
+
+#pragma once
+
+#include "position.h"
+#include "packed.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace DataFile {
+
+    constexpr uint32_t FILE_MAGIC = 0x43444642;
+    constexpr uint32_t CHUNK_MAGIC = 0x4B4E4843;
+    constexpr uint32_t FILE_VERSION = 1;
+
+    constexpr size_t FILE_HEADER_BYTES = 16;
+    constexpr size_t CHUNK_HEADER_BYTES = 16;
+
+    // Payload size a writer collects before writing a chunk
+    constexpr size_t CHUNK_BYTES = 1 << 20;
+
+    constexpr int16_t NO_SCORE = INT16_MIN;
+
+    // Memory the shuffle holds at once when none is given
+    constexpr size_t DEFAULT_SHUFFLE_MB = 1024;
+
+    struct Step {
+        int16_t score;
+        uint16_t move;
+    };
+
+    // start.result is the result of the whole game
+    struct Game {
+        PackedPosition start;
+        std::vector<Step> steps;
+    };
+
+    // Builds the position a packed record describes
+    void unpack (const PackedPosition& packed, Position& pos);
+
+    class Writer {
+        std::ofstream out;
+        std::vector<uint8_t> buffer;
+        uint32_t buffered_games = 0;
+
+        public:
+            // Appends to an existing file, cutting off a torn last chunk first
+            Writer (const std::string& file);
+            ~Writer ();
+
+            bool is_open () const;
+
+            // Games already in the file when it was opened
+            uint64_t existing_games = 0;
+
+            void write (const Game& game);
+            void flush ();
+    };
+
+    class Reader {
+        std::ifstream in;
+        std::vector<uint8_t> payload;
+        size_t offset = 0;
+        uint32_t games_left = 0;
+
+        // The game being replayed
+        Position pos;
+        uint8_t result = RESULT_DRAW;
+        size_t steps_left = 0;
+
+        bool next_chunk ();
+
+        public:
+            Reader (const std::string& file);
+
+            bool is_open () const;
+
+            // Training positions one by one, with the hash of the full position for dedup
+            bool next (PackedPosition& packed, Key& hash);
+    };
+
+    // External memory shuffle and dedup of container files into a flat PackedPosition file for the trainer
+    // Duplicates are found by Position::hash, memory_mb bounds how much is held in memory at once
+    void shuffle (const std::vector<std::string>& inputs, const std::string& output, size_t memory_mb);
+}
@@ -0,0 +1,152 @@
+/**
+ * datagen.cpp
+ *
+ * Self-play training data generator implementation
+ * A game is handed to the writer in one go once its result is known, and the writer only writes whole chunks,
+ * so stopping the process loses at most the last chunk, and the file can be appended to by the next run
+ */
+
+#include "datagen.h"
+#include "bitfish.h"
+#include "datafile.h"
+#include "selfplay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+using namespace std::chrono;
+
+namespace Datagen {
+
+    namespace {
+
+        struct Shared {
+            const Options& options;
+
+            DataFile::Writer writer;
+            std::mutex writer_mutex;
+
+            std::atomic<uint64_t> games_started {0};
+            std::atomic<uint64_t> games_done {0};
+            std::atomic<uint64_t> positions {0};
+
+            Shared (const Options& opts) : options(opts), writer(opts.file) {}
+        };
+
+        void worker (Shared& shared, int id) {
+            const Options& options = shared.options;
+
+            HashTable table (options.hash_mb);
+            BitFish::SearchContext context (table, 1);
+            context.uci_output = false;
+
+            int depth_limit = options.depth > 0 ? options.depth : MAX_DEPTH;
+            uint64_t node_limit = options.nodes > 0 ? options.nodes : options.depth > 0 ? 0 : DEFAULT_NODES;
+
+            std::mt19937_64 rng = SelfPlay::worker_rng(id);
+
+            DataFile::Game game;
+            std::vector<Key> history;
+
+            Position& pos = context.current_pos;
+
+            while (true) {
+                table.clear();
+                context.reset_killers();
+
+                // Random opening, thrown away if it ends the game or leaves one side clearly better
+                if (!SelfPlay::random_opening(pos, history, options.random_plies, rng)) continue;
+                if (std::abs(context.go(depth_limit, 0, node_limit).eval) > MAX_OPENING_EVAL) continue;
+
+                if (options.games > 0 && shared.games_started.fetch_add(1) >= options.games) break;
+
+                game.start = pack_position(pos.board.mailbox, pos.game_info.side_to_move, DataFile::NO_SCORE, RESULT_DRAW,
+                                           pos.game_info.castling, pos.game_info.ep_square, pos.game_info.rule_50_clock);
+                game.steps.clear();
+
+                uint8_t result = RESULT_DRAW;
+                uint64_t training_positions = 0;
+
+                for (int ply = 0; ; ply++) {
+                    if (SelfPlay::is_over(pos, history, result)) break;
+
+                    if (ply >= SelfPlay::MAX_GAME_PLIES) {
+                        result = RESULT_DRAW;
+                        break;
+                    }
+
+                    Color us = pos.game_info.side_to_move;
+                    bool in_check = pos.is_in_check(us);
+
+                    MoveList legal = MoveGen::generate_moves(pos);
+
+                    BitFish::SearchResult search = context.go(depth_limit, 0, node_limit);
+
+                    Move move = search.best_move;
+                    if (std::find(legal.begin(), legal.end(), move) == legal.end()) move = legal[0];
+
+                    int white_score = us == WHITE ? search.eval : -search.eval;
+
+                    // Mates and known won endings end the game, nothing left to learn from them
+                    if (std::abs(search.eval) >= KNOWN_WIN) {
+                        result = white_score > 0 ? RESULT_WHITE_WIN : RESULT_BLACK_WIN;
+                        break;
+                    }
+
+                    // Only quiet positions are scored, the static evaluation can't see through a pending capture
+                    bool quiet = !in_check && CAPTURED(move) == NO_PIECE && FLAG(move) < MOVE_NPROMO_FLAG;
+
+                    game.steps.push_back({quiet ? int16_t(white_score) : DataFile::NO_SCORE, uint16_t(MOVE16(move))});
+                    training_positions += quiet;
+
+                    SelfPlay::play(pos, move, history);
+                }
+
+                game.start.result = result;
+
+                // Counted under the lock, so a game is only reported once the next flush will write it
+                std::lock_guard<std::mutex> lock (shared.writer_mutex);
+                shared.writer.write(game);
+
+                shared.positions += training_positions;
+                shared.games_done++;
+            }
+        }
+    }
+
+    void run (const Options& options) {
+        Shared shared (options);
+
+        if (!shared.writer.is_open()) {
+            std::cout << "info string cannot open " << options.file << std::endl;
+            return;
+        }
+
+        if (shared.writer.existing_games) {
+            std::cout << "info string appending to " << options.file << " with " << shared.writer.existing_games << " games" << std::endl;
+        }
+
+        auto start = steady_clock::now();
+
+        // Every report flushes first, so a run that gets killed loses at most the games of the last ten seconds
+        auto report = [&shared, start] () {
+            {
+                std::lock_guard<std::mutex> lock (shared.writer_mutex);
+                shared.writer.flush();
+            }
+
+            uint64_t elapsed = std::max<uint64_t>(duration_cast<milliseconds>(steady_clock::now() - start).count(), 1);
+
+            std::cout << "info string datagen games " << shared.games_done
+                      << " positions " << shared.positions
+                      << " positions/hour " << shared.positions * 3600000 / elapsed << std::endl;
+        };
+
+        SelfPlay::run_workers(options.threads, [&shared] (int id) { worker(shared, id); }, report);
+        report();
+    }
+}
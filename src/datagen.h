@@ -0,0 +1,40 @@
+/**
+ * datagen.h
+ *
+ * Self-play training data generator interface
+ * Games are played by independent single threaded engines and appended to a training data container (datafile.h),
+ * every quiet position is marked with its search score
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Datagen {
+
+    constexpr uint64_t DEFAULT_NODES = 5000;
+    constexpr int DEFAULT_RANDOM_PLIES = 8;
+    constexpr int DEFAULT_HASH = 16;
+
+    // Openings further from equal than this are played again
+    constexpr int MAX_OPENING_EVAL = 400;
+
+    struct Options {
+        std::string file = "data.bfd";
+        int threads = 1;
+
+        // Per move, with neither set the node limit is used
+        uint64_t nodes = 0;
+        int depth = 0;
+
+        // 0 plays until the process is stopped
+        uint64_t games = 0;
+
+        int random_plies = DEFAULT_RANDOM_PLIES;
+        int hash_mb = DEFAULT_HASH;
+    };
+
+    // Usage: datagen [file F] [threads N] [nodes N] [depth N] [games N] [random N] [hash MB]
+    void run (const Options& options);
+}
@@ -0,0 +1,285 @@
+/**
+ * endgame.cpp
+ *
+ * Specialised endgame evaluation implementation
+ * KPK is looked up in a bitbase built at startup, the rest are hand written rules
+ */
+
+#include "endgame.h"
+#include "bitboards.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+#include <vector>
+
+namespace Endgames {
+
+    namespace {
+
+        inline int file_of (Square square) {
+            return square & 7;
+        }
+
+        inline int rank_of (Square square) {
+            return square >> 3;
+        }
+
+        inline int distance (Square a, Square b) {
+            return std::max(std::abs(file_of(a) - file_of(b)), std::abs(rank_of(a) - rank_of(b)));
+        }
+
+        inline int edge_distance (int x) {
+            return std::min(x, 7 - x);
+        }
+
+        // Bigger the closer the square is to an edge
+        inline int push_to_edge (Square square) {
+            int fd = edge_distance(file_of(square));
+            int rd = edge_distance(rank_of(square));
+
+            return 90 - (7 * fd * fd / 2 + 7 * rd * rd / 2);
+        }
+
+        // Bigger the closer the square is to a1 or h8
+        inline int push_to_dark_corner (Square square) {
+            return std::abs(7 - rank_of(square) - file_of(square));
+        }
+
+        inline int push_close (Square a, Square b) {
+            return 140 - 20 * distance(a, b);
+        }
+
+        inline bool is_dark (Square square) {
+            return ((file_of(square) + rank_of(square)) & 1) == 0;
+        }
+
+        inline Square king_square (const Position& pos, Color color) {
+            return Square(__builtin_ctzll(pos.get_bitboard(make_piece(KING, color))));
+        }
+
+        int non_pawn_material (const Position& pos, Color color) {
+            int npm = 0;
+
+            for (PieceType pt: {KNIGHT, BISHOP, ROOK, QUEEN}) {
+                Piece piece = make_piece(pt, color);
+                npm += __builtin_popcountll(pos.get_bitboard(piece)) * material[make_piece(pt, WHITE)];
+            }
+
+            return npm;
+        }
+
+        // KPK bitbase, white has the pawn, the pawn is on files a to d and ranks 2 to 7
+        constexpr int KPK_SIZE = 2 * 24 * 64 * 64;
+
+        std::bitset<KPK_SIZE> kpk_bitbase;
+
+        inline int kpk_index (Color side_to_move, Square black_king, Square white_king, Square pawn) {
+            return white_king | (black_king << 6) | (side_to_move << 12) | (file_of(pawn) << 13) | ((6 - rank_of(pawn)) << 15);
+        }
+
+        enum KPKResult : uint8_t {
+            KPK_INVALID = 0,
+            KPK_UNKNOWN = 1,
+            KPK_DRAW = 2,
+            KPK_WIN = 4
+        };
+
+        struct KPKPosition {
+            Color side_to_move;
+            Square white_king;
+            Square black_king;
+            Square pawn;
+            KPKResult result;
+
+            KPKPosition (int index) {
+                white_king = Square(index & 63);
+                black_king = Square((index >> 6) & 63);
+                side_to_move = Color((index >> 12) & 1);
+                pawn = Square(((index >> 13) & 3) + 8 * (6 - ((index >> 15) & 7)));
+
+                Square push = Square(pawn + 8);
+                Bitboard white_king_attacks = Bitboards::get_king_attacks(white_king);
+                Bitboard black_king_attacks = Bitboards::get_king_attacks(black_king);
+                Bitboard pawn_attacks = Bitboards::get_pawn_attacks(pawn, WHITE);
+
+                // Kings touching, pieces on the same square, or white to move with the black king in check
+                if (distance(white_king, black_king) <= 1 || white_king == pawn || black_king == pawn
+                    || (side_to_move == WHITE && (pawn_attacks & (1ULL << black_king)))) {
+                    result = KPK_INVALID;
+                }
+
+                // The pawn promotes and the new queen can't be taken
+                else if (side_to_move == WHITE && rank_of(pawn) == 6 && white_king != push && black_king != push
+                    && (distance(black_king, push) > 1 || distance(white_king, push) == 1)) {
+                    result = KPK_WIN;
+                }
+
+                // Black is stalemated or takes the undefended pawn
+                else if (side_to_move == BLACK && (!(black_king_attacks & ~(white_king_attacks | pawn_attacks))
+                    || (black_king_attacks & (1ULL << pawn) & ~white_king_attacks))) {
+                    result = KPK_DRAW;
+                }
+
+                else {
+                    result = KPK_UNKNOWN;
+                }
+            }
+
+            // White wins if any move wins, black draws if any move draws
+            KPKResult classify (const std::vector<KPKPosition>& db) const {
+                KPKResult good = side_to_move == WHITE ? KPK_WIN : KPK_DRAW;
+                KPKResult bad = side_to_move == WHITE ? KPK_DRAW : KPK_WIN;
+
+                int r = KPK_INVALID;
+
+                Square king = side_to_move == WHITE ? white_king : black_king;
+
+                for (Bitboard moves = Bitboards::get_king_attacks(king); moves; moves &= moves - 1) {
+                    Square to = Square(__builtin_ctzll(moves));
+
+                    r |= side_to_move == WHITE ? db[kpk_index(BLACK, black_king, to, pawn)].result
+                                               : db[kpk_index(WHITE, to, white_king, pawn)].result;
+                }
+
+                if (side_to_move == WHITE) {
+                    Square push = Square(pawn + 8);
+
+                    // A blocked push lands on an invalid index and adds nothing
+                    if (rank_of(pawn) < 6) {
+                        r |= db[kpk_index(BLACK, black_king, white_king, push)].result;
+                    }
+
+                    if (rank_of(pawn) == 1 && push != white_king && push != black_king) {
+                        r |= db[kpk_index(BLACK, black_king, white_king, Square(push + 8))].result;
+                    }
+                }
+
+                return (r & good) ? good : (r & KPK_UNKNOWN) ? KPK_UNKNOWN : bad;
+            }
+        };
+    }
+
+    void init () {
+        std::vector<KPKPosition> db;
+        db.reserve(KPK_SIZE);
+
+        for (int i = 0; i < KPK_SIZE; i++) {
+            db.emplace_back(i);
+        }
+
+        // Keep propagating known results back until nothing changes
+        bool changed = true;
+
+        while (changed) {
+            changed = false;
+
+            for (KPKPosition& kpk: db) {
+                if (kpk.result != KPK_UNKNOWN) continue;
+
+                kpk.result = kpk.classify(db);
+                changed |= kpk.result != KPK_UNKNOWN;
+            }
+        }
+
+        // Anything still unknown could never be forced, so it is a draw
+        for (int i = 0; i < KPK_SIZE; i++) {
+            kpk_bitbase[i] = db[i].result == KPK_WIN;
+        }
+    }
+
+    bool probe_kpk (Color side_to_move, Square white_king, Square pawn, Square black_king) {
+        return kpk_bitbase[kpk_index(side_to_move, black_king, white_king, pawn)];
+    }
+
+    // Neither side can win
+    int draw (const Position&, Color) {
+        return 0;
+    }
+
+    // Lone king against enough material to mate, drive the king to the edge and follow it
+    int kxk (const Position& pos, Color strong) {
+        Color weak = opposite(strong);
+
+        Square strong_king = king_square(pos, strong);
+        Square weak_king = king_square(pos, weak);
+
+        int score = non_pawn_material(pos, strong)
+                  + __builtin_popcountll(pos.get_bitboard(make_piece(PAWN, strong))) * material[W_PAWN]
+                  + push_to_edge(weak_king)
+                  + push_close(strong_king, weak_king);
+
+        Bitboard bishops = pos.get_bitboard(make_piece(BISHOP, strong));
+        bool both_bishops = (bishops & 0xAA55AA55AA55AA55ULL) && (bishops & 0x55AA55AA55AA55AAULL);
+
+        if (pos.get_bitboard(make_piece(QUEEN, strong)) || pos.get_bitboard(make_piece(ROOK, strong)) || both_bishops
+            || (bishops && pos.get_bitboard(make_piece(KNIGHT, strong)))) {
+            score += KNOWN_WIN;
+        }
+
+        return score;
+    }
+
+    // Bishop and knight mate only happens in a corner of the bishop's colour
+    int kbnk (const Position& pos, Color strong) {
+        Color weak = opposite(strong);
+
+        Square strong_king = king_square(pos, strong);
+        Square weak_king = king_square(pos, weak);
+        Square bishop = Square(__builtin_ctzll(pos.get_bitboard(make_piece(BISHOP, strong))));
+
+        // Mirror so the right corners are always a1 and h8
+        Square corner_king = is_dark(bishop) ? weak_king : Square(weak_king ^ 7);
+
+        return KNOWN_WIN + material[W_KNIGHT] + material[W_BISHOP]
+             + 3 * push_close(strong_king, weak_king)
+             + 60 * push_to_dark_corner(corner_king);
+    }
+
+    // Exact from the bitbase
+    int kpk (const Position& pos, Color strong) {
+        Square strong_king = king_square(pos, strong);
+        Square weak_king = king_square(pos, opposite(strong));
+        Square pawn = Square(__builtin_ctzll(pos.get_bitboard(make_piece(PAWN, strong))));
+
+        // Normalise so white has the pawn on files a to d
+        if (strong == BLACK) {
+            strong_king = Square(strong_king ^ 56);
+            weak_king = Square(weak_king ^ 56);
+            pawn = Square(pawn ^ 56);
+        }
+
+        if (file_of(pawn) > 3) {
+            strong_king = Square(strong_king ^ 7);
+            weak_king = Square(weak_king ^ 7);
+            pawn = Square(pawn ^ 7);
+        }
+
+        Color side_to_move = pos.game_info.side_to_move == strong ? WHITE : BLACK;
+
+        if (!probe_kpk(side_to_move, strong_king, pawn, weak_king)) return 0;
+
+        return KNOWN_WIN + material[W_PAWN] + rank_of(pawn);
+    }
+
+    // Pawns only on one rook file, with no bishop or the wrong bishop, can't win once the king reaches the corner
+    int rook_pawns (const Position& pos, Color strong) {
+        Bitboard pawns = pos.get_bitboard(make_piece(PAWN, strong));
+
+        bool a_file = !(pawns & ~Bitboards::file_a);
+        bool h_file = !(pawns & ~Bitboards::file_h);
+
+        if (!a_file && !h_file) return SCALE_NORMAL;
+
+        Square queening = Square((strong == WHITE ? A8 : A1) + (h_file ? 7 : 0));
+
+        Bitboard bishops = pos.get_bitboard(make_piece(BISHOP, strong));
+        Bitboard queening_colour = is_dark(queening) ? 0xAA55AA55AA55AA55ULL : 0x55AA55AA55AA55AAULL;
+
+        if (bishops & queening_colour) return SCALE_NORMAL;
+
+        if (distance(king_square(pos, opposite(strong)), queening) <= 1) return SCALE_DRAW;
+
+        return SCALE_NORMAL;
+    }
+}
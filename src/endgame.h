@@ -0,0 +1,34 @@
+/**
+ * endgame.h
+ *
+ * Specialised endgame evaluation interface
+ * Known material balances get their own evaluation or a scale factor for the general one
+ */
+
+#pragma once
+
+#include "position.h"
+
+namespace Endgames {
+
+    // Score from the strong side's point of view, replaces the general evaluation
+    using EvalFn = int (*) (const Position& pos, Color strong);
+
+    // How much of the general evaluation the strong side keeps, out of SCALE_NORMAL
+    using ScaleFn = int (*) (const Position& pos, Color strong);
+
+    // Builds the KPK bitbase, call once before searching
+    void init ();
+
+    // Whether white wins king and pawn against king, white's pawn on files a to d
+    bool probe_kpk (Color side_to_move, Square white_king, Square pawn, Square black_king);
+
+    // Evaluation functions
+    int draw (const Position& pos, Color strong);
+    int kxk (const Position& pos, Color strong);
+    int kbnk (const Position& pos, Color strong);
+    int kpk (const Position& pos, Color strong);
+
+    // Scaling functions
+    int rook_pawns (const Position& pos, Color strong);
+}
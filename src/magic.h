@@ -2,6 +2,8 @@
  * magic.h
  * 
  * Contains Magic Numbers used for magic bitboards
+ * Generated by tools/magics.cpp with seed 6767, for the shift 64 - relevant bits
+ * Not used when the engine is built with BMI2, PEXT needs no magics
  */
 
 #pragma once
@@ -11,136 +13,136 @@
 
 
 constexpr std::array<uint64_t, BOARD_SIZE> rook_magic = {
-    0xa8002c000108020ULL,
-    0x6c00049b0002001ULL,
-    0x100200010090040ULL,
-    0x2480041000800801ULL,
-    0x280028004000800ULL,
-    0x900410008040022ULL,
-    0x280020001001080ULL,
-    0x2880002041000080ULL,
-    0xa000800080400034ULL,
-    0x4808020004000ULL,
-    0x2290802004801000ULL,
-    0x411000d00100020ULL,
-    0x402800800040080ULL,
-    0xb000401004208ULL,
-    0x2409000100040200ULL,
-    0x1002100004082ULL,
-    0x22878001e24000ULL,
-    0x1090810021004010ULL,
-    0x801030040200012ULL,
-    0x500808008001000ULL,
-    0xa08018014000880ULL,
-    0x8000808004000200ULL,
-    0x201008080010200ULL,
-    0x801020000441091ULL,
-    0x800080204005ULL,
-    0x1040200040100048ULL,
-    0x120200402082ULL,
-    0xd14880480100080ULL,
-    0x12040280080080ULL,
-    0x100040080020080ULL,
-    0x9020010080800200ULL,
-    0x813241200148449ULL,
-    0x491604001800080ULL,
-    0x100401000402001ULL,
-    0x4820010021001040ULL,
-    0x400402202000812ULL,
-    0x209009005000802ULL,
-    0x810800601800400ULL,
-    0x4301083214000150ULL,
-    0x204026458e001401ULL,
-    0x40204000808000ULL,
-    0x8001008040010020ULL,
-    0x8410820820420010ULL,
-    0x1003001000090020ULL,
-    0x804040008008080ULL,
-    0x12000810020004ULL,
-    0x1000100200040208ULL,
-    0x430000a044020001ULL,
-    0x280009023410300ULL,
-    0xe0100040002240ULL,
-    0x200100401700ULL,
-    0x2244100408008080ULL,
-    0x8000400801980ULL,
-    0x2000810040200ULL,
-    0x8010100228810400ULL,
-    0x2000009044210200ULL,
-    0x4080008040102101ULL,
-    0x40002080411d01ULL,
-    0x2005524060000901ULL,
-    0x502001008400422ULL,
-    0x489a000810200402ULL,
-    0x1004400080a13ULL,
-    0x4000011008020084ULL,
-    0x26002114058042ULL,
+    0x80002040008010ULL,
+    0x4140200040021001ULL,
+    0x200200880104200ULL,
+    0x880080010000480ULL,
+    0x8300021008010014ULL,
+    0x3100026400081100ULL,
+    0x180020001000580ULL,
+    0x200004100820024ULL,
+    0x400800080400020ULL,
+    0x4001002081004008ULL,
+    0x60801000200085ULL,
+    0x1808048001000ULL,
+    0x4200808004000800ULL,
+    0xc0a000402001008ULL,
+    0x84800500800600ULL,
+    0x231000200408100ULL,
+    0x80004000200048ULL,
+    0x860008040002080ULL,
+    0x8010008020001080ULL,
+    0x12020040200810ULL,
+    0x4808008000400ULL,
+    0xa0808004000200ULL,
+    0x80040050080182ULL,
+    0x20000a0000508104ULL,
+    0x2080008080204006ULL,
+    0x80015000c0002001ULL,
+    0x2800100080802000ULL,
+    0x401008900209000ULL,
+    0x2804008080040800ULL,
+    0x8000020080800400ULL,
+    0x140014400024850ULL,
+    0x10102c4200108401ULL,
+    0x400804000800028ULL,
+    0x40004901002082ULL,
+    0x801000802002ULL,
+    0x8080080082801000ULL,
+    0x222000812000420ULL,
+    0x204810200800400ULL,
+    0x8a01011004000208ULL,
+    0x8008112002044ULL,
+    0x400080008020ULL,
+    0x5000201040c000ULL,
+    0x2860001000208080ULL,
+    0x204201001050008ULL,
+    0x4001008010100ULL,
+    0x42000409020010ULL,
+    0x4401821008440001ULL,
+    0x910006089020004ULL,
+    0x4422a0112804200ULL,
+    0x10002000400840ULL,
+    0x402a00128200ULL,
+    0x1a0085001022300ULL,
+    0x5810800040080ULL,
+    0x102008002040080ULL,
+    0x800108802010400ULL,
+    0x8020c4430810200ULL,
+    0x80004012288101ULL,
+    0x10210040001085ULL,
+    0x9010100820004101ULL,
+    0xe002004008041022ULL,
+    0x80250008001115ULL,
+    0x26020018500b140aULL,
+    0xd09000400820015ULL,
+    0x2100004400822702ULL,
 };
 
 
 constexpr std::array<uint64_t, BOARD_SIZE> bishop_magic = {
-    0x89a1121896040240ULL,
-    0x2004844802002010ULL,
-    0x2068080051921000ULL,
-    0x62880a0220200808ULL,
-    0x4042004000000ULL,
-    0x100822020200011ULL,
-    0xc00444222012000aULL,
-    0x28808801216001ULL,
-    0x400492088408100ULL,
-    0x201c401040c0084ULL,
-    0x840800910a0010ULL,
-    0x82080240060ULL,
-    0x2000840504006000ULL,
-    0x30010c4108405004ULL,
-    0x1008005410080802ULL,
-    0x8144042209100900ULL,
-    0x208081020014400ULL,
-    0x4800201208ca00ULL,
-    0xf18140408012008ULL,
-    0x1004002802102001ULL,
-    0x841000820080811ULL,
-    0x40200200a42008ULL,
-    0x800054042000ULL,
-    0x88010400410c9000ULL,
-    0x520040470104290ULL,
-    0x1004040051500081ULL,
-    0x2002081833080021ULL,
-    0x400c00c010142ULL,
-    0x941408200c002000ULL,
-    0x658810000806011ULL,
-    0x188071040440a00ULL,
-    0x4800404002011c00ULL,
-    0x104442040404200ULL,
-    0x511080202091021ULL,
-    0x4022401120400ULL,
-    0x80c0040400080120ULL,
-    0x8040010040820802ULL,
-    0x480810700020090ULL,
-    0x102008e00040242ULL,
-    0x809005202050100ULL,
-    0x8002024220104080ULL,
-    0x431008804142000ULL,
-    0x19001802081400ULL,
-    0x200014208040080ULL,
-    0x3308082008200100ULL,
-    0x41010500040c020ULL,
-    0x4012020c04210308ULL,
-    0x208220a202004080ULL,
-    0x111040120082000ULL,
-    0x6803040141280a00ULL,
-    0x2101004202410000ULL,
-    0x8200000041108022ULL,
-    0x21082088000ULL,
-    0x2410204010040ULL,
-    0x40100400809000ULL,
-    0x822088220820214ULL,
-    0x40808090012004ULL,
-    0x910224040218c9ULL,
-    0x402814422015008ULL,
-    0x90014004842410ULL,
-    0x1000042304105ULL,
-    0x10008830412a00ULL,
-    0x2520081090008908ULL,
-    0x40102000a0a60140ULL,
-};
\ No newline at end of file
+    0x4014080a104912ULL,
+    0x2624202020088ULL,
+    0x48408410854812ULL,
+    0x9020a0204600806ULL,
+    0x4102021024060000ULL,
+    0x520825040028601ULL,
+    0x440c6440a041ULL,
+    0x402090482100220ULL,
+    0x1903050214041ULL,
+    0x4880080104088204ULL,
+    0x80000800a4089200ULL,
+    0x404844400802240ULL,
+    0x108001104110088aULL,
+    0x20408884400000ULL,
+    0x405208044000ULL,
+    0x160020080c80848ULL,
+    0x42404c1010010140ULL,
+    0x8822102008200ULL,
+    0x4051208029103ULL,
+    0x9408094222004001ULL,
+    0x2094004210220040ULL,
+    0x22021348040400ULL,
+    0x84000044022882ULL,
+    0x2288820046109008ULL,
+    0x2222090020081020ULL,
+    0xe010080005080088ULL,
+    0x221012030044200ULL,
+    0x2054080004010410ULL,
+    0x1021004004004051ULL,
+    0x2028020800900411ULL,
+    0xa288146089010ULL,
+    0x1248810100840090ULL,
+    0x12211000600200ULL,
+    0x40c10046a220400ULL,
+    0x8002022208500090ULL,
+    0x8280020080880080ULL,
+    0x1020410040040040ULL,
+    0x8184028200118808ULL,
+    0x1014101040c0400ULL,
+    0x1220c2644402200ULL,
+    0x1011040001000ULL,
+    0x82012108022004ULL,
+    0x4005202030000801ULL,
+    0x802140c200810810ULL,
+    0x9004040082005020ULL,
+    0xa420081008440020ULL,
+    0x628302900400220ULL,
+    0x442b401000bc2ULL,
+    0x104814100a0000ULL,
+    0x8404a50100a00ULL,
+    0x801062108088000ULL,
+    0x4142022020ULL,
+    0x1204002120411000ULL,
+    0x202002008481ULL,
+    0x1040040124090300ULL,
+    0x4404080089320012ULL,
+    0x22030401240292ULL,
+    0x420a0084018824ULL,
+    0x80044022140ULL,
+    0x100800000e050410ULL,
+    0x110211020200ULL,
+    0x40000444428060cULL,
+    0x1086159030431100ULL,
+    0x10040808045011ULL,
+};
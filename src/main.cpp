@@ -5,13 +5,29 @@
  */
 
 #include "bitboards.h"
+#include "endgame.h"
 #include "uci.h"
 
 using namespace std::chrono;
 
 
-int main() {
-    Bitboards::init();
+int main(int argc, char* argv[]) {
+    Endgames::init();
+
+    // Command line arguments are run as a single command, e.g. ./bitfish bench 8
+    if (argc > 1) {
+        std::string command;
+
+        for (int i = 1; i < argc; i++) {
+            command += std::string(argv[i]) + " ";
+        }
+
+        UCI::execute(command);
+        UCI::execute("quit");
+
+        return 0;
+    }
+
     std::cout << "BitFish " << VERSION << " by GoobusTheNoobus\n" << std::flush;
 
     UCI::loop();
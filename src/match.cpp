@@ -0,0 +1,639 @@
+/**
+ * match.cpp
+ *
+ * Engine against engine match runner implementation
+ */
+
+#include "match.h"
+#include "selfplay.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+namespace Match {
+
+    namespace {
+
+        // How long a binary gets to answer uci and isready
+        constexpr int STARTUP_TIMEOUT = 10000;
+
+        // On top of the clock before a silent binary is given up on
+        constexpr int REPLY_SLACK = 1000;
+
+        // Without a clock or move time
+        constexpr int NO_LIMIT_TIMEOUT = 60000;
+
+        // What a player has to think with this move
+        struct Clock {
+            bool timed;
+            int time[COLOR_NUM];
+            int increment;
+            int move_time;
+            uint64_t nodes;
+        };
+
+        // The move and its score from the mover's point of view, ok is false if the player died or went silent
+        struct Reply {
+            Move move = NO_MOVE;
+            int score = 0;
+            bool ok = false;
+        };
+
+        class Player {
+            public:
+                virtual ~Player () = default;
+
+                virtual bool start () { return true; }
+                virtual void new_game () = 0;
+
+                // pos is where the game is now, fen and moves how it got there
+                virtual Reply think (const Position& pos, const std::string& fen, const std::vector<Move>& moves, const Clock& clock) = 0;
+        };
+
+        // A search context in this process
+        class SelfPlayer : public Player {
+            HashTable table;
+            BitFish::SearchContext context;
+
+            public:
+                SelfPlayer (int hash_mb, const BitFish::SearchParams& params) : table(hash_mb), context(table, 1) {
+                    context.uci_output = false;
+                    context.params = params;
+                }
+
+                void new_game () override {
+                    table.clear();
+                    context.reset_killers();
+                }
+
+                Reply think (const Position& pos, const std::string&, const std::vector<Move>&, const Clock& clock) override {
+                    Color us = pos.game_info.side_to_move;
+                    int move_time = clock.timed ? BitFish::time_for_move(clock.time[us], clock.increment) : clock.move_time;
+
+                    context.current_pos = pos;
+                    BitFish::SearchResult result = context.go(MAX_DEPTH, move_time, clock.nodes);
+
+                    return {result.best_move, result.eval, true};
+                }
+        };
+
+        // Another UCI binary behind a pair of pipes
+        class ProcessPlayer : public Player {
+            std::string command;
+            int hash_mb;
+
+            pid_t pid = -1;
+            int to_engine = -1;
+            int from_engine = -1;
+            std::string buffer;
+
+            bool send (const std::string& line) {
+                std::string data = line + "\n";
+                return to_engine >= 0 && ::write(to_engine, data.data(), data.size()) == ssize_t(data.size());
+            }
+
+            // The next line from the engine, false if it went quiet for too long or died
+            bool read_line (std::string& line, int timeout_ms) {
+                auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+
+                while (true) {
+                    size_t newline = buffer.find('\n');
+
+                    if (newline != std::string::npos) {
+                        line = buffer.substr(0, newline);
+                        buffer.erase(0, newline + 1);
+
+                        if (!line.empty() && line.back() == '\r') line.pop_back();
+                        return true;
+                    }
+
+                    int left = int(duration_cast<milliseconds>(deadline - steady_clock::now()).count());
+                    if (left <= 0 || from_engine < 0) return false;
+
+                    pollfd fd {from_engine, POLLIN, 0};
+                    int ready = ::poll(&fd, 1, left);
+
+                    if (ready < 0 && errno == EINTR) continue;
+                    if (ready <= 0) return false;
+
+                    char chunk[4096];
+                    ssize_t size = ::read(from_engine, chunk, sizeof(chunk));
+
+                    if (size <= 0) return false;
+                    buffer.append(chunk, size_t(size));
+                }
+            }
+
+            bool wait_for (const std::string& token, int timeout_ms) {
+                std::string line;
+
+                while (read_line(line, timeout_ms)) {
+                    if (line.compare(0, token.size(), token) == 0) return true;
+                }
+
+                return false;
+            }
+
+            void shutdown () {
+                if (pid <= 0) return;
+
+                send("quit");
+
+                ::close(to_engine);
+                ::close(from_engine);
+                to_engine = from_engine = -1;
+                buffer.clear();
+
+                // A moment to exit by itself, then it is killed
+                for (int i = 0; i < 50; i++) {
+                    if (::waitpid(pid, nullptr, WNOHANG) == pid) {
+                        pid = -1;
+                        return;
+                    }
+
+                    std::this_thread::sleep_for(milliseconds(10));
+                }
+
+                ::kill(pid, SIGKILL);
+                ::waitpid(pid, nullptr, 0);
+                pid = -1;
+            }
+
+            public:
+                ProcessPlayer (const std::string& cmd, int hash) : command(cmd), hash_mb(hash) {}
+
+                ~ProcessPlayer () override {
+                    shutdown();
+                }
+
+                bool start () override {
+                    shutdown();
+
+                    // Close on exec, so the other engines started by other workers don't inherit these pipes
+                    int input[2], output[2];
+
+                    if (::pipe2(input, O_CLOEXEC)) return false;
+
+                    if (::pipe2(output, O_CLOEXEC)) {
+                        ::close(input[0]);
+                        ::close(input[1]);
+                        return false;
+                    }
+
+                    // Built before forking, the child may only make async signal safe calls
+                    std::string shell_command = "exec " + command;
+
+                    pid = ::fork();
+
+                    if (pid == 0) {
+                        ::dup2(input[0], STDIN_FILENO);
+                        ::dup2(output[1], STDOUT_FILENO);
+                        ::execl("/bin/sh", "sh", "-c", shell_command.c_str(), (char*) nullptr);
+                        ::_exit(127);
+                    }
+
+                    ::close(input[0]);
+                    ::close(output[1]);
+                    to_engine = input[1];
+                    from_engine = output[0];
+
+                    if (pid < 0) {
+                        ::close(to_engine);
+                        ::close(from_engine);
+                        to_engine = from_engine = -1;
+                        return false;
+                    }
+
+                    send("uci");
+                    if (!wait_for("uciok", STARTUP_TIMEOUT)) return false;
+
+                    send("setoption name Hash value " + std::to_string(hash_mb));
+                    send("setoption name Threads value 1");
+                    send("isready");
+
+                    return wait_for("readyok", STARTUP_TIMEOUT);
+                }
+
+                void new_game () override {
+                    if (pid <= 0 && !start()) return;
+
+                    send("ucinewgame");
+                    send("isready");
+
+                    if (!wait_for("readyok", STARTUP_TIMEOUT)) start();
+                }
+
+                Reply think (const Position& pos, const std::string& fen, const std::vector<Move>& moves, const Clock& clock) override {
+                    Reply reply;
+
+                    std::string position = "position fen " + fen;
+
+                    if (!moves.empty()) {
+                        position += " moves";
+                        for (Move move: moves) position += " " + move_to_string(move);
+                    }
+
+                    std::string go = "go";
+                    int timeout = NO_LIMIT_TIMEOUT;
+
+                    if (clock.timed) {
+                        go += " wtime " + std::to_string(std::max(1, clock.time[WHITE])) + " btime " + std::to_string(std::max(1, clock.time[BLACK]))
+                            + " winc " + std::to_string(clock.increment) + " binc " + std::to_string(clock.increment);
+                        timeout = clock.time[pos.game_info.side_to_move] + TIME_MARGIN + REPLY_SLACK;
+                    } else if (clock.move_time > 0) {
+                        go += " movetime " + std::to_string(clock.move_time);
+                        timeout = clock.move_time + TIME_MARGIN + REPLY_SLACK;
+                    } else if (clock.nodes > 0) {
+                        go += " nodes " + std::to_string(clock.nodes);
+                    }
+
+                    if (!send(position) || !send(go)) {
+                        start();
+                        return reply;
+                    }
+
+                    std::string line;
+
+                    while (read_line(line, timeout)) {
+                        std::istringstream iss (line);
+                        std::string token;
+                        iss >> token;
+
+                        if (token == "info") {
+                            while (iss >> token) {
+                                if (token != "score") continue;
+
+                                std::string kind;
+                                int value;
+
+                                if (!(iss >> kind >> value)) break;
+
+                                if (kind == "cp") reply.score = value;
+                                else if (kind == "mate") reply.score = value > 0 ? MATE_EVAL - value : -MATE_EVAL - value;
+                            }
+                        } else if (token == "bestmove") {
+                            std::string move;
+                            iss >> move;
+
+                            for (Move legal: MoveGen::generate_moves(pos)) {
+                                if (move_to_string(legal) == move) reply.move = legal;
+                            }
+
+                            reply.ok = true;
+                            return reply;
+                        }
+                    }
+
+                    // Silent or dead, a fresh process plays the next game
+                    start();
+                    return reply;
+                }
+        };
+
+        // self:Name=value,Name=value on top of the engine's current values, false with an info string on anything else
+        bool read_params (const std::string& spec, BitFish::SearchParams& params) {
+            params = BitFish::engine.params;
+
+            if (spec == "self") return true;
+
+            if (spec.compare(0, 5, "self:") != 0) {
+                std::cout << "info string match engine must be self, self:Name=value,... or cmd:<binary>, not " << spec << std::endl;
+                return false;
+            }
+
+            std::istringstream iss (spec.substr(5));
+            std::string assignment;
+
+            while (std::getline(iss, assignment, ',')) {
+                size_t equals = assignment.find('=');
+                std::string name = assignment.substr(0, equals);
+
+                auto tunable = std::find_if(BitFish::TUNABLES.begin(), BitFish::TUNABLES.end(), [&](const BitFish::Tunable& t) {
+                    return name == t.name;
+                });
+
+                size_t used = 0;
+                int value = 0;
+
+                try {
+                    if (equals != std::string::npos) value = std::stoi(assignment.substr(equals + 1), &used);
+                } catch (const std::exception& e) {
+                    used = 0;
+                }
+
+                if (tunable == BitFish::TUNABLES.end() || equals == std::string::npos || !used || used != assignment.size() - equals - 1) {
+                    std::cout << "info string match cannot use " << assignment << std::endl;
+                    return false;
+                }
+
+                params.*tunable->value = std::clamp(value, tunable->min, tunable->max);
+            }
+
+            return true;
+        }
+
+        std::unique_ptr<Player> make_player (const std::string& spec, int hash_mb) {
+            if (spec.compare(0, 4, "cmd:") == 0) {
+                return std::make_unique<ProcessPlayer>(spec.substr(4), hash_mb);
+            }
+
+            // Already checked before the workers started
+            BitFish::SearchParams params;
+            read_params(spec, params);
+
+            return std::make_unique<SelfPlayer>(hash_mb, params);
+        }
+
+        // Scores from white's point of view of the last plies, for adjudication
+        bool all_recent (const std::vector<int>& scores, int plies, bool (*test)(int)) {
+            if (int(scores.size()) < plies) return false;
+
+            return std::all_of(scores.end() - plies, scores.end(), test);
+        }
+
+        // The result from white's point of view
+        uint8_t play_game (Player& white, Player& black, const std::string& fen, const Options& options) {
+            Position pos (fen);
+            std::vector<Key> history {pos.hash};
+            std::vector<Move> moves;
+            std::vector<int> scores;
+
+            Player* players[COLOR_NUM] = {&white, &black};
+
+            bool timed = options.move_time == 0 && options.nodes == 0;
+            Clock clock {timed, {options.base_time, options.base_time}, options.increment, options.move_time, options.nodes};
+
+            white.new_game();
+            black.new_game();
+
+            while (true) {
+                uint8_t result;
+                if (SelfPlay::is_over(pos, history, result)) return result;
+
+                Color us = pos.game_info.side_to_move;
+                uint8_t loss = us == WHITE ? RESULT_BLACK_WIN : RESULT_WHITE_WIN;
+
+                auto start = steady_clock::now();
+                Reply reply = players[us]->think(pos, fen, moves, clock);
+                int elapsed = int(duration_cast<milliseconds>(steady_clock::now() - start).count());
+
+                // Crashes, time losses and illegal moves all lose
+                if (!reply.ok || reply.move == NO_MOVE) return loss;
+
+                if (timed) {
+                    clock.time[us] -= elapsed;
+                    if (clock.time[us] < -TIME_MARGIN) return loss;
+
+                    clock.time[us] += clock.increment;
+                }
+
+                scores.push_back(us == WHITE ? reply.score : -reply.score);
+                moves.push_back(reply.move);
+                SelfPlay::play(pos, reply.move, history);
+
+                if (int(moves.size()) >= 2 * DRAW_MOVE_NUMBER
+                    && all_recent(scores, 2 * DRAW_MOVE_COUNT, [](int score) { return std::abs(score) <= DRAW_SCORE; })) {
+                    return RESULT_DRAW;
+                }
+
+                if (all_recent(scores, 2 * RESIGN_MOVE_COUNT, [](int score) { return score >= RESIGN_SCORE; })) return RESULT_WHITE_WIN;
+                if (all_recent(scores, 2 * RESIGN_MOVE_COUNT, [](int score) { return score <= -RESIGN_SCORE; })) return RESULT_BLACK_WIN;
+            }
+        }
+
+        std::vector<std::string> load_openings (const std::string& file) {
+            std::vector<std::string> openings;
+            std::ifstream in (file);
+            std::string line;
+
+            while (std::getline(in, line)) {
+                std::istringstream iss (line);
+                std::string fields[6];
+                int count = 0;
+
+                while (count < 6 && iss >> fields[count]) count++;
+                if (count < 4) continue;
+
+                std::string fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+
+                // EPD leaves out the move counters, or has operations in their place
+                bool counters = count == 6 && std::isdigit((unsigned char) fields[4][0]) && std::isdigit((unsigned char) fields[5][0]);
+                fen += counters ? " " + fields[4] + " " + fields[5] : " 0 1";
+
+                try {
+                    Position pos (fen);
+                    if (!MoveGen::generate_moves(pos).size) continue;
+                } catch (const std::exception& e) {
+                    continue;
+                }
+
+                openings.push_back(fen);
+            }
+
+            return openings;
+        }
+
+        struct Stats {
+            // The first engine's points over a game pair, in half points: 0 to 4
+            uint64_t pentanomial[5] = {};
+            uint64_t wins = 0, draws = 0, losses = 0;
+
+            uint64_t pairs () const {
+                uint64_t total = 0;
+                for (uint64_t count: pentanomial) total += count;
+                return total;
+            }
+
+            // Mean score per game and the variance of a pair's mean score
+            void moments (double& mean, double& variance) const {
+                double n = double(pairs());
+                mean = variance = 0.0;
+
+                for (int i = 0; i < 5; i++) mean += pentanomial[i] * (i / 4.0) / n;
+                for (int i = 0; i < 5; i++) variance += pentanomial[i] * (i / 4.0 - mean) * (i / 4.0 - mean) / n;
+            }
+
+            // Log likelihood ratio of elo1 against elo0, normal approximation on the pair scores
+            double llr (double elo0, double elo1) const {
+                if (pairs() < 2) return 0.0;
+
+                double mean, variance;
+                moments(mean, variance);
+
+                if (variance <= 0.0) return 0.0;
+
+                auto expected = [](double elo) { return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0)); };
+                double s0 = expected(elo0), s1 = expected(elo1);
+
+                return pairs() * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+            }
+
+            std::string summary (const Options& options) const {
+                std::ostringstream out;
+                out << std::fixed << std::setprecision(2);
+
+                out << "games " << wins + draws + losses << " +" << wins << " =" << draws << " -" << losses;
+
+                if (pairs() >= 2) {
+                    double mean, variance;
+                    moments(mean, variance);
+
+                    double clamped = std::clamp(mean, 1e-3, 1 - 1e-3);
+                    double elo = -400.0 * std::log10(1.0 / clamped - 1.0);
+
+                    // 95% interval, through the slope of the logistic at the mean
+                    double error = 1.96 * std::sqrt(variance / pairs()) * 400.0 / (std::log(10.0) * clamped * (1 - clamped));
+
+                    out << " elo " << elo << " +- " << error;
+                }
+
+                out << " penta [" << pentanomial[0] << " " << pentanomial[1] << " " << pentanomial[2]
+                    << " " << pentanomial[3] << " " << pentanomial[4] << "]";
+
+                if (options.sprt) {
+                    out << " llr " << llr(options.elo0, options.elo1)
+                        << " (" << std::log(options.beta / (1 - options.alpha)) << ", " << std::log((1 - options.beta) / options.alpha) << ")";
+                }
+
+                return out.str();
+            }
+        };
+
+        struct Shared {
+            const Options& options;
+            std::vector<std::string> openings;
+
+            Stats stats;
+            std::mutex stats_mutex;
+
+            std::atomic<uint64_t> next_pair {0};
+            std::atomic<bool> stop {false};
+
+            // Set once the SPRT decides
+            std::string verdict;
+
+            Shared (const Options& opts) : options(opts) {}
+        };
+
+        void worker (Shared& shared, int id) {
+            const Options& options = shared.options;
+            uint64_t pairs = (options.games + 1) / 2;
+
+            std::unique_ptr<Player> first = make_player(options.engines[0], options.hash_mb);
+            std::unique_ptr<Player> second = make_player(options.engines[1], options.hash_mb);
+
+            if (!first->start() || !second->start()) {
+                std::cout << "info string match cannot start an engine" << std::endl;
+                shared.stop = true;
+                return;
+            }
+
+            std::mt19937_64 rng = SelfPlay::worker_rng(id);
+
+            Position pos;
+            std::vector<Key> history;
+
+            while (!shared.stop) {
+                uint64_t pair = shared.next_pair.fetch_add(1);
+                if (pair >= pairs) break;
+
+                std::string fen;
+
+                if (!shared.openings.empty()) {
+                    fen = shared.openings[pair % shared.openings.size()];
+                } else {
+                    while (!SelfPlay::random_opening(pos, history, options.random_plies, rng));
+                    fen = pos.to_fen();
+                }
+
+                // The first engine plays white, then black
+                uint8_t as_white = play_game(*first, *second, fen, options);
+                uint8_t as_black = play_game(*second, *first, fen, options);
+
+                int points[2] = {as_white, RESULT_WHITE_WIN - as_black};
+
+                std::lock_guard<std::mutex> lock (shared.stats_mutex);
+
+                Stats& stats = shared.stats;
+                stats.pentanomial[points[0] + points[1]]++;
+
+                for (int point: points) {
+                    (point == 2 ? stats.wins : point == 1 ? stats.draws : stats.losses)++;
+                }
+
+                if (options.sprt && shared.verdict.empty()) {
+                    double llr = stats.llr(options.elo0, options.elo1);
+
+                    if (llr >= std::log((1 - options.beta) / options.alpha)) shared.verdict = "H1 accepted";
+                    else if (llr <= std::log(options.beta / (1 - options.alpha))) shared.verdict = "H0 accepted";
+
+                    if (!shared.verdict.empty()) shared.stop = true;
+                }
+            }
+        }
+    }
+
+    bool check_engine (const std::string& spec) {
+        if (spec.compare(0, 4, "cmd:") == 0) {
+            if (spec.size() > 4) return true;
+
+            std::cout << "info string match engine cmd: needs a binary" << std::endl;
+            return false;
+        }
+
+        BitFish::SearchParams params;
+        return read_params(spec, params);
+    }
+
+    void run (const Options& options) {
+        Shared shared (options);
+
+        if (!options.openings.empty()) {
+            shared.openings = load_openings(options.openings);
+
+            if (shared.openings.empty()) {
+                std::cout << "info string no usable openings in " << options.openings << std::endl;
+                return;
+            }
+        }
+
+        // A binary that dies mid write must not take the whole process down with it
+        ::signal(SIGPIPE, SIG_IGN);
+
+        std::cout << "info string match " << options.engines[0] << " vs " << options.engines[1] << ", "
+                  << (options.nodes ? std::to_string(options.nodes) + " nodes"
+                      : options.move_time ? std::to_string(options.move_time) + " ms per move"
+                      : std::to_string(options.base_time) + "+" + std::to_string(options.increment) + " ms")
+                  << ", " << options.concurrency << " at once" << std::endl;
+
+        auto report = [&shared] () {
+            std::lock_guard<std::mutex> lock (shared.stats_mutex);
+            std::cout << "info string match " << shared.stats.summary(shared.options) << std::endl;
+        };
+
+        SelfPlay::run_workers(options.concurrency, [&shared] (int id) { worker(shared, id); }, report);
+
+        std::cout << "info string match done " << shared.stats.summary(options) << std::endl;
+
+        if (!shared.verdict.empty()) {
+            std::cout << "info string match sprt " << shared.verdict << std::endl;
+        }
+    }
+}
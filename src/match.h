@@ -0,0 +1,73 @@
+/**
+ * match.h
+ *
+ * Engine against engine match runner interface
+ * Plays game pairs from the same opening with colours swapped, many at once, and can stop
+ * as soon as an SPRT decides. Engines are either search contexts inside this process or
+ * other UCI binaries talked to over pipes, so a patch can be tested against the old build.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace Match {
+
+    constexpr uint64_t DEFAULT_GAMES = 1000;
+    constexpr int DEFAULT_RANDOM_PLIES = 8;
+    constexpr int DEFAULT_HASH = 16;
+
+    // 10+0.1 when no time control is given
+    constexpr int DEFAULT_BASE_TIME = 10000;
+    constexpr int DEFAULT_INCREMENT = 100;
+
+    // Draw adjudication: from this move on, both sides' scores within DRAW_SCORE for DRAW_MOVE_COUNT moves each
+    constexpr int DRAW_MOVE_NUMBER = 40;
+    constexpr int DRAW_MOVE_COUNT = 8;
+    constexpr int DRAW_SCORE = 10;
+
+    // Resign adjudication: both sides agree one of them is RESIGN_SCORE ahead for RESIGN_MOVE_COUNT moves each
+    constexpr int RESIGN_MOVE_COUNT = 3;
+    constexpr int RESIGN_SCORE = 1000;
+
+    // Allowed overshoot of the clock before a move loses on time
+    constexpr int TIME_MARGIN = 50;
+
+    struct Options {
+        // "self", or "self:Name=value,..." with UCI tunables on top of the engine's current ones, or "cmd:<binary>"
+        std::string engines[2] = {"self", "self"};
+
+        // Played in pairs from the same opening, so an odd count gets one more game
+        uint64_t games = DEFAULT_GAMES;
+        int concurrency = std::max(1u, std::thread::hardware_concurrency());
+
+        // Clock in ms, unless a fixed move time or node count is set
+        int base_time = DEFAULT_BASE_TIME;
+        int increment = DEFAULT_INCREMENT;
+        int move_time = 0;
+        uint64_t nodes = 0;
+
+        // FEN or EPD lines, random openings without one
+        std::string openings;
+        int random_plies = DEFAULT_RANDOM_PLIES;
+
+        int hash_mb = DEFAULT_HASH;
+
+        // Stops when the log likelihood ratio of elo1 over elo0 for the first engine leaves its bounds
+        bool sprt = false;
+        double elo0 = 0.0;
+        double elo1 = 5.0;
+        double alpha = 0.05;
+        double beta = 0.05;
+    };
+
+    // False with an info string when an engine spec can't be used, checked before any game starts
+    bool check_engine (const std::string& spec);
+
+    // Usage: match [engine1 E] [engine2 E] [games N, odd rounds up to whole pairs] [concurrency N]
+    //              [tc S+S | movetime MS | nodes N] [openings F] [random N] [hash MB] [sprt ELO0 ELO1] [alpha A] [beta B]
+    void run (const Options& options);
+}
@@ -0,0 +1,121 @@
+/**
+ * material.cpp
+ *
+ * Material table implementation
+ */
+
+#include "material.h"
+
+#include <algorithm>
+
+namespace Material {
+
+    MaterialTable::MaterialTable () {
+        // A real position always has kings, so a zero key never matches
+        table.resize(MATERIAL_HASH_SIZE, MaterialEntry{});
+    }
+
+    MaterialEntry& MaterialTable::operator[] (Key key) {
+        return table[key & (MATERIAL_HASH_SIZE - 1)];
+    }
+
+    void compute (const Position& pos, MaterialEntry& entry) {
+        entry = MaterialEntry{};
+        entry.key = pos.material_hash;
+        entry.factor[WHITE] = entry.factor[BLACK] = SCALE_NORMAL;
+
+        int count[PIECE_NUM];
+        for (int piece = 0; piece < PIECE_NUM; piece++) {
+            count[piece] = __builtin_popcountll(pos.get_bitboard(Piece(piece)));
+            entry.phase += count[piece] * piece_phase[piece];
+        }
+
+        entry.phase = std::min(entry.phase, MAX_GAME_PHASE);
+
+        int npm[COLOR_NUM];
+        int pawns[COLOR_NUM];
+        int minors[COLOR_NUM];
+
+        for (Color color: {WHITE, BLACK}) {
+            auto n = [&](PieceType pt) { return count[make_piece(pt, color)]; };
+
+            npm[color] = n(KNIGHT) * material[W_KNIGHT] + n(BISHOP) * material[W_BISHOP]
+                       + n(ROOK) * material[W_ROOK] + n(QUEEN) * material[W_QUEEN];
+            pawns[color] = n(PAWN);
+            minors[color] = n(KNIGHT) + n(BISHOP);
+
+            // Imbalance, the bishop pair and pieces that like or dislike pawns
+            Score imbalance = 0;
+
+            if (n(BISHOP) >= 2) imbalance += make_score(BISHOP_PAIR_BONUS, BISHOP_PAIR_BONUS);
+
+            int knight_adjust = n(KNIGHT) * (n(PAWN) - 5) * KNIGHT_PAWN_ADJUSTMENT;
+            int rook_adjust = n(ROOK) * (n(PAWN) - 5) * ROOK_PAWN_ADJUSTMENT;
+            imbalance += make_score(knight_adjust - rook_adjust, knight_adjust - rook_adjust);
+
+            entry.imbalance += color == WHITE ? imbalance : -imbalance;
+        }
+
+        // K v K, K+minor v K
+        if (!pawns[WHITE] && !pawns[BLACK] && npm[WHITE] + npm[BLACK] <= material[W_BISHOP] && minors[WHITE] + minors[BLACK] <= 1) {
+            entry.dead_draw = true;
+            entry.eval_fn = Endgames::draw;
+            return;
+        }
+
+        for (Color strong: {WHITE, BLACK}) {
+            Color weak = opposite(strong);
+
+            auto n = [&](PieceType pt) { return count[make_piece(pt, strong)]; };
+
+            bool weak_bare = !npm[weak] && !pawns[weak];
+
+            if (weak_bare) {
+                if (!pawns[strong] && npm[strong] == material[W_KNIGHT] + material[W_BISHOP] && n(KNIGHT) == 1 && n(BISHOP) == 1) {
+                    entry.eval_fn = Endgames::kbnk;
+                    entry.eval_side = strong;
+                    return;
+                }
+
+                // Two knights can't force mate
+                if (!pawns[strong] && npm[strong] == 2 * material[W_KNIGHT] && n(KNIGHT) == 2) {
+                    entry.eval_fn = Endgames::draw;
+                    return;
+                }
+
+                if (npm[strong] >= material[W_ROOK]) {
+                    entry.eval_fn = Endgames::kxk;
+                    entry.eval_side = strong;
+                    return;
+                }
+
+                if (!npm[strong] && pawns[strong] == 1) {
+                    entry.eval_fn = Endgames::kpk;
+                    entry.eval_side = strong;
+                    return;
+                }
+
+                // Rook pawns, alone or with a bishop that may not control the queening square
+                if (pawns[strong] && (!npm[strong] || (npm[strong] == material[W_BISHOP] && n(BISHOP) == 1))) {
+                    entry.scale_fn[strong] = Endgames::rook_pawns;
+                }
+            }
+
+            // Without pawns a minor piece or less up is not enough to win
+            if (!pawns[strong] && npm[strong] - npm[weak] <= material[W_BISHOP]) {
+                entry.factor[strong] = npm[strong] < material[W_ROOK] ? SCALE_DRAW
+                                     : npm[weak] <= material[W_BISHOP] ? 4 : 14;
+            }
+        }
+    }
+
+    MaterialEntry* probe (const Position& pos, MaterialTable& table) {
+        MaterialEntry& entry = table[pos.material_hash];
+
+        if (entry.key != pos.material_hash) {
+            compute(pos, entry);
+        }
+
+        return &entry;
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * material.h
+ *
+ * Material table interface
+ * Everything that only depends on the piece counts is worked out once per material balance:
+ * the imbalance, the game phase, and which specialised endgame code applies
+ */
+
+#pragma once
+
+#include "position.h"
+#include "endgame.h"
+
+#include <vector>
+
+namespace Material {
+
+    struct MaterialEntry {
+        Key key;
+
+        // White minus black
+        Score imbalance;
+        int phase;
+
+        // Neither side has enough material to ever mate
+        bool dead_draw;
+
+        // Replaces the whole evaluation when set
+        Endgames::EvalFn eval_fn;
+        Color eval_side;
+
+        // Scaling when the given colour is the one ahead, the function wins over the factor
+        Endgames::ScaleFn scale_fn[COLOR_NUM];
+        uint8_t factor[COLOR_NUM];
+
+        inline int scale_factor (const Position& pos, Color strong) const {
+            if (scale_fn[strong]) {
+                int scale = scale_fn[strong](pos, strong);
+                if (scale != SCALE_NORMAL) return scale;
+            }
+
+            return factor[strong];
+        }
+    };
+
+    class MaterialTable {
+        std::vector<MaterialEntry> table;
+
+        public:
+            MaterialTable ();
+            MaterialEntry& operator[] (Key key);
+    };
+
+    // Fills in an entry from the piece counts
+    void compute (const Position& pos, MaterialEntry& entry);
+
+    // Looks the material up in the table, computing it on a miss
+    MaterialEntry* probe (const Position& pos, MaterialTable& table);
+}
@@ -51,6 +51,12 @@
 #define FLAG(move) \
     ((move >> 20) & 0xF)
 
+// 16 bit moves for the transposition table, moved and captured are looked up again from the position
+#define MOVE16(move) \
+    (((move) & 0xFFF) | (FLAG(move) << 12))
+
+#define NO_MOVE16 0xFFFF
+
 // We also pack all essential gamestate information into a 32 bit integer for speed
 // We don't need side to move since we just need to switch it to the opposite color when 
 // doing and undoing a move
@@ -81,10 +87,19 @@ inline std::string move_to_string (Move move) {
     return square_to_str(Square(FROM(move))) + square_to_str(Square(TO(move)));
 }
 
+// A move with its ordering score right next to it, so scoring and picking walk one array
+struct ScoredMove {
+    Move move;
+    int score;
+};
+
+// One ply's worth of generated moves, preallocated by whoever searches
+using MoveBuffer = std::array<ScoredMove, MAX_MOVES>;
+
 // A MoveList container for the list with a size variable
 struct MoveList {
 
-    std::array<Move, 256> list;
+    std::array<Move, MAX_MOVES> list;
     int size = 0;
 
     // Functions to support foreach loops
@@ -161,10 +176,21 @@ struct MoveList {
         };
 
 
-        std::sort (list.begin(), list.begin() + size, [pv, killer1, killer2, score](Move a, Move b){
-            return score (a) > score(b);
+        // Score every move once instead of twice per comparison
+        std::array<std::pair<int, Move>, MAX_MOVES> scored;
+
+        for (int i = 0; i < size; i++) {
+            scored[i] = {score(list[i]), list[i]};
+        }
+
+        std::sort (scored.begin(), scored.begin() + size, [](const std::pair<int, Move>& a, const std::pair<int, Move>& b){
+            return a.first > b.first;
         });
 
+        for (int i = 0; i < size; i++) {
+            list[i] = scored[i].second;
+        }
+
         
     }
 
@@ -2,166 +2,335 @@
  * movegen.cpp
  * 
  * MoveGen Implementation
- * Generates moves into a MoveList
+ * Generates legal moves into a buffer the caller owns
  */
 
 #include "movegen.h"
 
-MoveList MoveGen::generate_moves (const Position& pos) {
-    MoveList moves;
+namespace {
 
-    generate_pawn_moves(pos, moves);
-    generate_knight_moves(pos, moves);
-    generate_bishop_moves(pos, moves);
-    generate_rook_moves(pos, moves);
-    generate_queen_moves(pos, moves);
-    generate_king_moves(pos, moves);
+    using MoveGen::GenType;
+    using MoveGen::Masks;
 
-    return moves;
-}
+    // Squares a piece of this type would give check from, for quiet checks
+    template <Color Us>
+    inline Bitboard check_squares (const Position& pos, PieceType type) {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
 
-void MoveGen::generate_pawn_moves (const Position& pos, MoveList& list) {   
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
+        Square king = Square(__builtin_ctzll(pos.get_bitboard(make_piece(KING, Them))));
 
-    bool is_white = us == WHITE;
+        switch (type) {
+            case PAWN:
+                return Bitboards::get_pawn_attacks(king, Them);
 
-    Piece moved = is_white? W_PAWN: B_PAWN;
-    Bitboard pieces = pos.get_bitboard(moved);
-    
-    // Early exit
-    if (!pieces) return;
+            case KNIGHT:
+                return Bitboards::get_knight_attacks(king);
 
-    Bitboard r3_from_bottom = is_white ? Bitboards::rank3 : Bitboards::rank6;
-    Bitboard promo = is_white ? Bitboards::rank8: Bitboards::rank1;
+            case BISHOP:
+                return Bitboards::get_bishop_attacks(king, pos.board.occupancy);
 
-    Square ep = pos.game_info.ep_square;
-    
+            case ROOK:
+                return Bitboards::get_rook_attacks(king, pos.board.occupancy);
 
-    int push_offset = is_white ? 8: -8;
-    int lc_offset = is_white ? 7: -9;
-    int rc_offset = is_white ? 9: -7;
+            case QUEEN:
+                return Bitboards::get_bishop_attacks(king, pos.board.occupancy) | Bitboards::get_rook_attacks(king, pos.board.occupancy);
 
-    Bitboard enemy_pieces = pos.board.color_bitboards[them];
-    Bitboard occupancy = pos.board.occupancy;
+            default:
+                return 0ULL;
+        }
+    }
 
-    Bitboard single_push = (is_white ? pieces << 8: pieces >> 8) & ~occupancy;
+    // Squares a piece can land on for the given type of move, before check and pins
+    template <Color Us, GenType Type>
+    inline Bitboard destinations (const Position& pos, PieceType piece) {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
 
-    Bitboard sp_promo = single_push & promo;
-    Bitboard sp_reg = single_push & ~promo;
+        if constexpr (Type == MoveGen::CAPTURES || Type == MoveGen::NOISY) return pos.board.color_bitboards[Them];
+        else if constexpr (Type == MoveGen::PROMOTIONS) return 0ULL;
+        else if constexpr (Type == MoveGen::QUIETS) return ~pos.board.occupancy;
+        else if constexpr (Type == MoveGen::QUIET_CHECKS) return ~pos.board.occupancy & check_squares<Us>(pos, piece);
+        else return ~0ULL;
+    }
 
-    Bitboard double_push = (is_white ? ((single_push & r3_from_bottom) << 8): ((single_push & r3_from_bottom) >> 8)) & ~occupancy;
+    // Shifts a bitboard towards the enemy side by a number of squares
+    template <Color Us>
+    constexpr Bitboard shift_up (Bitboard bb, int squares) {
+        return Us == WHITE ? bb << squares : bb >> squares;
+    }
 
-    Bitboard left_captures = (is_white ? 
-        (pieces & ~Bitboards::file_a) << 7: 
-        (pieces & ~Bitboards::file_a) >> 9) 
-    & enemy_pieces;
+    template <Color Us>
+    inline void add_promotions (Bitboard promos, int offset, const Position& pos, ScoredMove*& list) {
+        constexpr Piece Moved = Us == WHITE ? W_PAWN : B_PAWN;
+
+        while (promos) {
+            int square = __builtin_ctzll(promos);
+            promos &= promos - 1;
+            Move move = NORMAL_MOVE(square - offset, square, Moved, pos.piece_at(Square(square)));
+            (list++)->move = PROMO_MOVE(move, MOVE_QPROMO_FLAG);
+            (list++)->move = PROMO_MOVE(move, MOVE_RPROMO_FLAG);
+            (list++)->move = PROMO_MOVE(move, MOVE_BPROMO_FLAG);
+            (list++)->move = PROMO_MOVE(move, MOVE_NPROMO_FLAG);
+        }
+    }
 
+    // Pushes and captures for a set of pawns that all share the same allowed squares
+    // Promotions count as noisy even without a capture, and are left out of the quiet checks
+    template <Color Us, GenType Type>
+    void add_pawn_moves (const Position& pos, Bitboard pieces, Bitboard target, ScoredMove*& list) {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+        constexpr Piece Moved = Us == WHITE ? W_PAWN : B_PAWN;
 
-    Bitboard right_captures = (is_white ? 
-        (pieces & ~Bitboards::file_h) << 9: 
-        (pieces & ~Bitboards::file_h) >> 7) 
-    & enemy_pieces;
+        constexpr Bitboard R3_FROM_BOTTOM = Us == WHITE ? Bitboards::rank3 : Bitboards::rank6;
+        constexpr Bitboard PROMO = Us == WHITE ? Bitboards::rank8 : Bitboards::rank1;
 
-    Bitboard lc_promo = left_captures & promo;
-    Bitboard lc_reg = left_captures & ~promo;
-    Bitboard rc_promo = right_captures & promo;
-    Bitboard rc_reg = right_captures & ~promo;
+        constexpr int PUSH_OFFSET = Us == WHITE ? 8 : -8;
+        constexpr int LC_OFFSET = Us == WHITE ? 7 : -9;
+        constexpr int RC_OFFSET = Us == WHITE ? 9 : -7;
 
-    
+        constexpr bool QUIETS = Type == MoveGen::QUIETS || Type == MoveGen::QUIET_CHECKS || Type == MoveGen::ALL;
+        constexpr bool CAPTURES = Type == MoveGen::CAPTURES || Type == MoveGen::NOISY || Type == MoveGen::ALL;
+        constexpr bool PROMOTIONS = Type == MoveGen::PROMOTIONS || Type == MoveGen::NOISY || Type == MoveGen::ALL;
+
+        Bitboard occupancy = pos.board.occupancy;
+
+        if constexpr (QUIETS || PROMOTIONS) {
+            // The double push only needs the square in between to be empty, not allowed
+            Bitboard single_push = shift_up<Us>(pieces, 8) & ~occupancy;
+            Bitboard double_push = shift_up<Us>(single_push & R3_FROM_BOTTOM, 8) & ~occupancy & target;
+
+            single_push &= target;
+
+            if constexpr (QUIETS) {
+                Bitboard sp_reg = single_push & ~PROMO;
+
+                while (sp_reg) {
+                    int square = __builtin_ctzll(sp_reg);
+                    sp_reg &= sp_reg - 1;
+                    (list++)->move = NORMAL_MOVE(square - PUSH_OFFSET, square, Moved, NO_PIECE);
+                }
+
+            }
+
+            if constexpr (PROMOTIONS) add_promotions<Us>(single_push & PROMO, PUSH_OFFSET, pos, list);
+
+            if constexpr (QUIETS) {
+                while (double_push) {
+                    int square = __builtin_ctzll(double_push);
+                    double_push &= double_push - 1;
+                    (list++)->move = DOUBLE_PUSH_MOVE(square - PUSH_OFFSET * 2, square, Moved);
+                }
+            }
+        }
+
+        if constexpr (CAPTURES) {
+            Bitboard enemy_pieces = pos.board.color_bitboards[Them] & target;
+
+            Bitboard left_captures = shift_up<Us>(pieces & ~Bitboards::file_a, Us == WHITE ? 7 : 9) & enemy_pieces;
+            Bitboard right_captures = shift_up<Us>(pieces & ~Bitboards::file_h, Us == WHITE ? 9 : 7) & enemy_pieces;
+
+            Bitboard lc_reg = left_captures & ~PROMO;
+            Bitboard rc_reg = right_captures & ~PROMO;
+
+            while (lc_reg) {
+                int square = __builtin_ctzll(lc_reg);
+                lc_reg &= lc_reg - 1;
+                (list++)->move = NORMAL_MOVE(square - LC_OFFSET, square, Moved, pos.piece_at(Square(square)));
+            }
+
+            add_promotions<Us>(left_captures & PROMO, LC_OFFSET, pos, list);
 
-    while (sp_reg) {
-        int square = __builtin_ctzll(sp_reg);
-        sp_reg &= sp_reg - 1;
-        list.push_back(NORMAL_MOVE(square - push_offset, square, moved, NO_PIECE));
+            while (rc_reg) {
+                int square = __builtin_ctzll(rc_reg);
+                rc_reg &= rc_reg - 1;
+                (list++)->move = NORMAL_MOVE(square - RC_OFFSET, square, Moved, pos.piece_at(Square(square)));
+            }
+
+            add_promotions<Us>(right_captures & PROMO, RC_OFFSET, pos, list);
+        }
     }
 
-    while (sp_promo) {
-        int square = __builtin_ctzll(sp_promo);
-        sp_promo &= sp_promo - 1;
-        Move move = NORMAL_MOVE(square - push_offset, square, moved, NO_PIECE);
-        list.push_back(PROMO_MOVE(move, MOVE_QPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_RPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_BPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_NPROMO_FLAG));
+    template <Color Us>
+    Masks get_masks (const Position& pos) {
+        constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+
+        Bitboard friendlies = pos.board.color_bitboards[Us];
+        Bitboard enemies = pos.board.color_bitboards[Them];
+        Bitboard occupancy = pos.board.occupancy;
+
+        Masks masks;
+        masks.king = Square(__builtin_ctzll(pos.get_bitboard(make_piece(KING, Us))));
+        masks.checkers = pos.attackers_to(masks.king, occupancy) & enemies;
+
+        // Enemy sliders that would see the king on an empty board
+        Bitboard queens = pos.get_bitboard(make_piece(QUEEN, Them));
+        Bitboard snipers = (Bitboards::get_rook_attacks(masks.king, 0ULL) & (pos.get_bitboard(make_piece(ROOK, Them)) | queens)) |
+                           (Bitboards::get_bishop_attacks(masks.king, 0ULL) & (pos.get_bitboard(make_piece(BISHOP, Them)) | queens));
+
+        masks.pinned = 0ULL;
+
+        while (snipers) {
+            Square sniper = Square(__builtin_ctzll(snipers));
+            Bitboard blockers = Bitboards::get_between(masks.king, sniper) & occupancy;
+
+            if (blockers && !(blockers & (blockers - 1))) masks.pinned |= blockers & friendlies;
+
+            snipers &= snipers - 1;
+        }
+
+        if (!masks.checkers) {
+            masks.target = ~friendlies;
+        }
+
+        // Single check, capture the checker or block it
+        else if (!(masks.checkers & (masks.checkers - 1))) {
+            masks.target = masks.checkers | Bitboards::get_between(masks.king, Square(__builtin_ctzll(masks.checkers)));
+        }
+
+        // Double check, only the king can move
+        else {
+            masks.target = 0ULL;
+        }
+
+        return masks;
     }
 
-    while (double_push) {
-        int square = __builtin_ctzll(double_push);
-        double_push &= double_push - 1;
-        list.push_back(DOUBLE_PUSH_MOVE(square - push_offset * 2, square, moved));
+    template <Color Us, GenType Type>
+    ScoredMove* generate (const Position& pos, ScoredMove* list) {
+        Masks masks = get_masks<Us>(pos);
+
+        // Only pawns promote
+        if constexpr (Type == MoveGen::PROMOTIONS) {
+            if (masks.target) MoveGen::generate_pawn_moves<Us, Type>(pos, masks, list);
+            return list;
+        }
+
+        // Nothing but a king move answers a double check
+        if (masks.target) {
+            MoveGen::generate_pawn_moves<Us, Type>(pos, masks, list);
+            MoveGen::generate_knight_moves<Us, Type>(pos, masks, list);
+            MoveGen::generate_bishop_moves<Us, Type>(pos, masks, list);
+            MoveGen::generate_rook_moves<Us, Type>(pos, masks, list);
+            MoveGen::generate_queen_moves<Us, Type>(pos, masks, list);
+        }
+
+        MoveGen::generate_king_moves<Us, Type>(pos, masks, list);
+
+        return list;
     }
 
-    while (lc_reg) {
-        int square = __builtin_ctzll(lc_reg);
-        lc_reg &= lc_reg - 1;
-        list.push_back(NORMAL_MOVE(square - lc_offset, square, moved, pos.piece_at(Square(square))));
+    template <GenType Type>
+    inline ScoredMove* generate (const Position& pos, ScoredMove* list) {
+        return pos.game_info.side_to_move == WHITE ? generate<WHITE, Type>(pos, list) : generate<BLACK, Type>(pos, list);
     }
+}
+
+MoveGen::Masks MoveGen::get_masks (const Position& pos) {
+    return pos.game_info.side_to_move == WHITE ? ::get_masks<WHITE>(pos) : ::get_masks<BLACK>(pos);
+}
+
+// The only place the side to move and the move type are looked at, everything below is specialised on both
+ScoredMove* MoveGen::generate (const Position& pos, GenType type, ScoredMove* list) {
+    switch (type) {
+        case CAPTURES:
+            return ::generate<CAPTURES>(pos, list);
 
-    while (lc_promo) {
-        int square = __builtin_ctzll(lc_promo);
-        lc_promo &= lc_promo - 1;
-        Move move = NORMAL_MOVE(square - lc_offset, square, moved, pos.piece_at(Square(square)));
-        list.push_back(PROMO_MOVE(move, MOVE_QPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_RPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_BPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_NPROMO_FLAG));
+        case PROMOTIONS:
+            return ::generate<PROMOTIONS>(pos, list);
+
+        case NOISY:
+            return ::generate<NOISY>(pos, list);
+
+        case QUIETS:
+            return ::generate<QUIETS>(pos, list);
+
+        case QUIET_CHECKS:
+            return ::generate<QUIET_CHECKS>(pos, list);
+
+        default:
+            return ::generate<ALL>(pos, list);
     }
+}
+
+MoveList MoveGen::generate_moves (const Position& pos, GenType type) {
+    MoveBuffer buffer;
+    ScoredMove* end = generate(pos, type, buffer.data());
+
+    MoveList moves;
 
-    while (rc_reg) {
-        int square = __builtin_ctzll(rc_reg);
-        rc_reg &= rc_reg - 1;
-        list.push_back(NORMAL_MOVE(square - rc_offset, square, moved, pos.piece_at(Square(square))));
+    for (ScoredMove* it = buffer.data(); it != end; it++) {
+        moves.push_back(it->move);
     }
 
-    while (rc_promo) {
-        int square = __builtin_ctzll(rc_promo);
-        rc_promo &= rc_promo - 1;
-        Move move = NORMAL_MOVE(square - rc_offset, square, moved, pos.piece_at(Square(square)));
-        list.push_back(PROMO_MOVE(move, MOVE_QPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_RPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_BPROMO_FLAG));
-        list.push_back(PROMO_MOVE(move, MOVE_NPROMO_FLAG));
+    return moves;
+}
+
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_pawn_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {   
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+    constexpr Piece Moved = Us == WHITE ? W_PAWN : B_PAWN;
+
+    Bitboard pieces = pos.get_bitboard(Moved);
+    
+    // Early exit
+    if (!pieces) return;
+
+    // Pushes have to land where they give check, captures are already left out
+    Bitboard target = masks.target;
+    if constexpr (Type == QUIET_CHECKS) target &= check_squares<Us>(pos, PAWN);
+
+    add_pawn_moves<Us, Type>(pos, pieces & ~masks.pinned, target, list);
+
+    // Pinned pawns one by one, each can only stay on its own line
+    Bitboard pinned = pieces & masks.pinned;
+
+    while (pinned) {
+        Square square = Square(__builtin_ctzll(pinned));
+        add_pawn_moves<Us, Type>(pos, 1ULL << square, target & Bitboards::get_line(masks.king, square), list);
+        pinned &= pinned - 1;
     }
 
-    if (ep != NO_SQUARE) {
+    // En passant can take a checker off a square that isn't its target, or uncover a check along the rank
+    // It is rare enough to just test each one
+    if constexpr (Type == CAPTURES || Type == NOISY || Type == ALL) {
+        Square ep = pos.game_info.ep_square;
+        if (ep == NO_SQUARE) return;
+
         // The opposite color bitboard contains the squares that our pawns have to be to en passant
-        Bitboard en_passant_bb = Bitboards::get_pawn_attacks(ep, them) & pieces; 
+        Bitboard en_passant_bb = Bitboards::get_pawn_attacks(ep, Them) & pieces; 
         while (en_passant_bb) {
             int square = __builtin_ctzll (en_passant_bb);
             en_passant_bb &= en_passant_bb - 1;
-            list.push_back(EN_PASSANT(square, ep, moved, is_white ? B_PAWN : W_PAWN));
+
+            Move move = EN_PASSANT(square, ep, Moved, Us == WHITE ? B_PAWN : W_PAWN);
+            if (pos.is_legal(move)) (list++)->move = move;
         }
     }
-     
-    
 }
 
 
 
-void MoveGen::generate_knight_moves (const Position& pos, MoveList& list) {
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
-
-    Bitboard friendlies = pos.board.color_bitboards[us];
-    Bitboard enemies = pos.board.color_bitboards[them];
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_knight_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {
+    constexpr Piece Moved = Us == WHITE ? W_KNIGHT : B_KNIGHT;
 
-    Piece moved = us == WHITE ? W_KNIGHT : B_KNIGHT;
-    Bitboard pieces = pos.get_bitboard(moved);
+    // A pinned knight can never stay on the line
+    Bitboard pieces = pos.get_bitboard(Moved) & ~masks.pinned;
 
     // Early Exit
     if (!pieces) return;
 
+    Bitboard target = masks.target & destinations<Us, Type>(pos, KNIGHT);
+
     while (pieces) {
         int from = __builtin_ctzll (pieces);
         Square square_enum = Square(from);
 
-        Bitboard move_bb = Bitboards::get_knight_attacks(square_enum) & ~friendlies;
+        Bitboard move_bb = Bitboards::get_knight_attacks(square_enum) & target;
 
         while (move_bb) {
             Square to = Square(__builtin_ctzll(move_bb));
 
-            list.push_back(NORMAL_MOVE(from, to, moved, pos.piece_at(to)));
+            (list++)->move = NORMAL_MOVE(from, to, Moved, pos.piece_at(to));
             move_bb &= move_bb - 1;
         }
 
@@ -171,71 +340,70 @@ void MoveGen::generate_knight_moves (const Position& pos, MoveList& list) {
 }
 
 
-void MoveGen::generate_king_moves (const Position& pos, MoveList& list) {
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_king_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+    constexpr Piece Moved = Us == WHITE ? W_KING : B_KING;
 
-    Bitboard friendlies = pos.board.color_bitboards[us];
-    Bitboard enemies = pos.board.color_bitboards[them];
+    Bitboard friendlies = pos.board.color_bitboards[Us];
+    Bitboard enemies = pos.board.color_bitboards[Them];
 
-    Piece moved = us == WHITE ? W_KING : B_KING;
-    Bitboard pieces = pos.get_bitboard(moved);
+    Square from = masks.king;
 
-    // early exit
-    if (!pieces) return;
+    // Without the king on the board, so it can't hide behind itself from a slider
+    Bitboard occupancy = pos.board.occupancy ^ (1ULL << from);
+    Bitboard move_bb = Bitboards::get_king_attacks(from) & ~friendlies & destinations<Us, Type>(pos, KING);
 
-    while (pieces) {
-        int from = __builtin_ctzll (pieces);
-        Square square_enum = Square(from);
+    while (move_bb) {
+        Square to = Square(__builtin_ctzll(move_bb));
 
-        Bitboard move_bb = Bitboards::get_king_attacks(square_enum) & ~friendlies;
-
-        while (move_bb) {
-            Square to = Square(__builtin_ctzll(move_bb));
-
-            list.push_back(NORMAL_MOVE(from, to, moved, pos.piece_at(to)));
-            move_bb &= move_bb - 1;
+        if (!(pos.attackers_to(to, occupancy) & enemies)) {
+            (list++)->move = NORMAL_MOVE(from, to, Moved, pos.piece_at(to));
         }
 
-        // Clear LSB
-        pieces &= pieces - 1;
+        move_bb &= move_bb - 1;
     }
 
     // Check castling
-    if (pos.can_castle_ks()) {
-        list.push_back(CASTLING_MOVE(us == WHITE ? E1: E8, us == WHITE ? G1: G8, moved));
-    }
+    if constexpr (Type == QUIETS || Type == ALL) {
+        if (masks.checkers) return;
+
+        if (pos.can_castle_ks<Us>()) {
+            (list++)->move = CASTLING_MOVE(Us == WHITE ? E1: E8, Us == WHITE ? G1: G8, Moved);
+        }
 
-    if (pos.can_castle_qs()) {
-        list.push_back(CASTLING_MOVE(us == WHITE ? E1: E8, us == WHITE ? C1: C8, moved));
+        if (pos.can_castle_qs<Us>()) {
+            (list++)->move = CASTLING_MOVE(Us == WHITE ? E1: E8, Us == WHITE ? C1: C8, Moved);
+        }
     }
 }
 
 
-void MoveGen::generate_bishop_moves (const Position& pos, MoveList& list) {
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_bishop_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {
+    constexpr Piece Moved = Us == WHITE ? W_BISHOP : B_BISHOP;
 
-    Bitboard friendlies = pos.board.color_bitboards[us];
-    Bitboard enemies = pos.board.color_bitboards[them];
-
-    Piece moved = us == WHITE ? W_BISHOP : B_BISHOP;
-    Bitboard pieces = pos.get_bitboard(moved);
+    Bitboard pieces = pos.get_bitboard(Moved);
 
     // Early exit
     if (!pieces) return;
 
+    Bitboard target = masks.target & destinations<Us, Type>(pos, BISHOP);
+
     while (pieces) {
 
         int from = __builtin_ctzll (pieces);
         Square square_enum = Square(from);
 
-        Bitboard move_bb = Bitboards::get_bishop_attacks(square_enum, pos.board.occupancy) & ~friendlies;
+        Bitboard move_bb = Bitboards::get_bishop_attacks(square_enum, pos.board.occupancy) & target;
+
+        // Pinned, stay on the line to the king
+        if (masks.pinned & (1ULL << from)) move_bb &= Bitboards::get_line(masks.king, square_enum);
 
         while (move_bb) {
             Square to = Square(__builtin_ctzll(move_bb));
 
-            list.push_back(NORMAL_MOVE(from, to, moved, pos.piece_at(to)));
+            (list++)->move = NORMAL_MOVE(from, to, Moved, pos.piece_at(to));
             move_bb &= move_bb - 1;
         }
 
@@ -245,30 +413,31 @@ void MoveGen::generate_bishop_moves (const Position& pos, MoveList& list) {
 }
 
 
-void MoveGen::generate_rook_moves (const Position& pos, MoveList& list) {
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_rook_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {
+    constexpr Piece Moved = Us == WHITE ? W_ROOK : B_ROOK;
 
-    Bitboard friendlies = pos.board.color_bitboards[us];
-    Bitboard enemies = pos.board.color_bitboards[them];
-
-    Piece moved = us == WHITE ? W_ROOK : B_ROOK;
-    Bitboard pieces = pos.get_bitboard(moved);
+    Bitboard pieces = pos.get_bitboard(Moved);
 
     // Early exit
     if (!pieces) return;
 
+    Bitboard target = masks.target & destinations<Us, Type>(pos, ROOK);
+
     while (pieces) {
 
         int from = __builtin_ctzll (pieces);
         Square square_enum = Square(from);
 
-        Bitboard move_bb = Bitboards::get_rook_attacks(square_enum, pos.board.occupancy) & ~friendlies;
+        Bitboard move_bb = Bitboards::get_rook_attacks(square_enum, pos.board.occupancy) & target;
+
+        // Pinned, stay on the line to the king
+        if (masks.pinned & (1ULL << from)) move_bb &= Bitboards::get_line(masks.king, square_enum);
 
         while (move_bb) {
             Square to = Square(__builtin_ctzll(move_bb));
 
-            list.push_back(NORMAL_MOVE(from, to, moved, pos.piece_at(to)));
+            (list++)->move = NORMAL_MOVE(from, to, Moved, pos.piece_at(to));
             move_bb &= move_bb - 1;
         }
 
@@ -278,39 +447,36 @@ void MoveGen::generate_rook_moves (const Position& pos, MoveList& list) {
 }
 
 
-void MoveGen::generate_queen_moves (const Position& pos, MoveList& list) {
-    Color us = pos.game_info.side_to_move;
-    Color them = opposite(us);
-
-    Bitboard friendlies = pos.board.color_bitboards[us];
-    Bitboard enemies = pos.board.color_bitboards[them];
+template <Color Us, MoveGen::GenType Type>
+void MoveGen::generate_queen_moves (const Position& pos, const Masks& masks, ScoredMove*& list) {
+    constexpr Piece Moved = Us == WHITE ? W_QUEEN : B_QUEEN;
 
-    Piece moved = us == WHITE ? W_QUEEN : B_QUEEN;
-
-    Bitboard pieces = pos.get_bitboard(moved);
+    Bitboard pieces = pos.get_bitboard(Moved);
 
     // Early exit
     if (!pieces) return;
 
+    Bitboard target = masks.target & destinations<Us, Type>(pos, QUEEN);
+
     while (pieces) {
 
         int from = __builtin_ctzll (pieces);
         Square square_enum = Square(from);
 
         // Combine bishop and rook attacks from that square into one bitboard
-        Bitboard move_bb = (Bitboards::get_bishop_attacks(square_enum, pos.board.occupancy) | Bitboards::get_rook_attacks(square_enum, pos.board.occupancy)) & ~friendlies;
+        Bitboard move_bb = (Bitboards::get_bishop_attacks(square_enum, pos.board.occupancy) | Bitboards::get_rook_attacks(square_enum, pos.board.occupancy)) & target;
+
+        // Pinned, stay on the line to the king
+        if (masks.pinned & (1ULL << from)) move_bb &= Bitboards::get_line(masks.king, square_enum);
 
         while (move_bb) {
             Square to = Square(__builtin_ctzll(move_bb));
 
-            list.push_back(NORMAL_MOVE(from, to, moved, pos.piece_at(to)));
+            (list++)->move = NORMAL_MOVE(from, to, Moved, pos.piece_at(to));
             move_bb &= move_bb - 1;
         }
 
         // Clear LSB
         pieces &= pieces - 1;
-    }}
-
-
-
-
+    }
+}
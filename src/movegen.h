@@ -2,7 +2,7 @@
  * movegen.h
  * 
  * MoveGen interface
- * Generates moves into a MoveList
+ * Generates legal moves into a buffer the caller owns
  */
 
 #pragma once
@@ -14,12 +14,56 @@
 
 namespace MoveGen {
 
+    // Worked out once per node, so no move has to be made to find out it leaves the king in check
+    struct Masks {
+        Square king;
+        Bitboard checkers;
 
-    MoveList generate_moves (const Position& pos);
-    void generate_pawn_moves (const Position& pos, MoveList& list);
-    void generate_knight_moves (const Position& pos, MoveList& list);
-    void generate_bishop_moves (const Position& pos, MoveList& list);
-    void generate_rook_moves (const Position& pos, MoveList& list);
-    void generate_queen_moves (const Position& pos, MoveList& list);
-    void generate_king_moves (const Position& pos, MoveList& list);
-}
\ No newline at end of file
+        // Our pieces that are the only thing between our king and an enemy slider, they can only move along that line
+        Bitboard pinned;
+
+        // Where every piece but the king may land: anything not ours, or when in check the checker and the squares between it and the king
+        Bitboard target;
+    };
+
+    // Captures include en passant and capturing promotions, promotions are the ones that don't capture
+    // Noisy is both of them, quiets are the rest including castling
+    // Quiet checks are the quiets that check the enemy king directly, no discovered checks or castling
+    enum GenType {
+        CAPTURES,
+        PROMOTIONS,
+        NOISY,
+        QUIETS,
+        QUIET_CHECKS,
+        ALL
+    };
+
+    Masks get_masks (const Position& pos);
+
+    // Only legal moves, in double check just the king ones
+    // Appends them after list and returns where they end, the caller owns the memory so nothing is copied
+    ScoredMove* generate (const Position& pos, GenType type, ScoredMove* list);
+
+    // A list of its own, for callers off the hot path
+    MoveList generate_moves (const Position& pos, GenType type = ALL);
+
+    inline ScoredMove* generate_captures (const Position& pos, ScoredMove* list) {
+        return generate(pos, CAPTURES, list);
+    }
+
+    inline ScoredMove* generate_promotions (const Position& pos, ScoredMove* list) {
+        return generate(pos, PROMOTIONS, list);
+    }
+
+    inline ScoredMove* generate_quiet_checks (const Position& pos, ScoredMove* list) {
+        return generate(pos, QUIET_CHECKS, list);
+    }
+
+    // Specialised on the side to move and the move type, generate picks the right ones once per call
+    template <Color Us, GenType Type> void generate_pawn_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+    template <Color Us, GenType Type> void generate_knight_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+    template <Color Us, GenType Type> void generate_bishop_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+    template <Color Us, GenType Type> void generate_rook_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+    template <Color Us, GenType Type> void generate_queen_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+    template <Color Us, GenType Type> void generate_king_moves (const Position& pos, const Masks& masks, ScoredMove*& list);
+}
@@ -0,0 +1,139 @@
+/**
+ * movepick.cpp
+ *
+ * Staged move picker implementation
+ */
+
+#include "movepick.h"
+
+MovePicker::MovePicker (const Position& position, ScoredMove* buffer, Move tt, Move k1, Move k2) : pos(position), tt_move(tt), killer1(k1), killer2(k2),
+                                                                                                 moves(buffer), end(buffer), next(buffer) {
+    // A table move can come from a key collision, so it is only trusted after checking it against the board
+    if (!pos.is_pseudo_legal(tt_move) || !pos.is_legal(tt_move)) tt_move = NO_MOVE;
+}
+
+MovePicker::MovePicker (const Position& position, ScoredMove* buffer, bool checks) : pos(position), tt_move(NO_MOVE), killer1(NO_MOVE), killer2(NO_MOVE),
+                                                                                      stage(GEN_NOISY), quiescence(true), quiet_checks(checks),
+                                                                                      moves(buffer), end(buffer), next(buffer) {}
+
+// Most valuable victim, least valuable attacker, same as MoveList::sort
+void MovePicker::score_noisy () {
+    for (ScoredMove* it = moves; it != end; it++) {
+        Move m = it->move;
+
+        if (CAPTURED(m) != NO_PIECE) {
+            int victim = std::abs(material[CAPTURED(m)]);
+            int attacker = std::abs(material[MOVED(m)]);
+
+            it->score = 1000000 + (10000 * victim) + (1000 - attacker);
+        }
+
+        else {
+            it->score = 900000 + promo_flag_bonus[FLAG(m) - MOVE_NPROMO_FLAG];
+        }
+    }
+}
+
+void MovePicker::score_quiets () {
+    for (ScoredMove* it = moves; it != end; it++) {
+        it->score = FLAG(it->move) == MOVE_DOUBLE_PUSH_FLAG ? 1000 : 0;
+    }
+}
+
+Move MovePicker::pick_best () {
+    if (next == end) return NO_MOVE;
+
+    ScoredMove* best = next;
+
+    for (ScoredMove* it = next + 1; it != end; it++) {
+        if (it->score > best->score) best = it;
+    }
+
+    std::swap(*best, *next);
+
+    return (next++)->move;
+}
+
+bool MovePicker::is_usable_killer (Move killer) const {
+    if (killer == NO_MOVE || killer == tt_move) return false;
+
+    // Noisy ones were already handed out with the rest
+    if (CAPTURED(killer) != NO_PIECE || FLAG(killer) >= MOVE_NPROMO_FLAG) return false;
+
+    return pos.is_pseudo_legal(killer) && pos.is_legal(killer);
+}
+
+Move MovePicker::next_move () {
+    while (true) {
+        switch (stage) {
+            case TT_MOVE:
+                stage = GEN_NOISY;
+                if (tt_move != NO_MOVE) return tt_move;
+                break;
+
+            case GEN_NOISY:
+                end = MoveGen::generate(pos, MoveGen::NOISY, moves);
+                next = moves;
+                score_noisy();
+                stage = NOISY;
+                break;
+
+            case NOISY: {
+                Move move = pick_best();
+
+                if (move == NO_MOVE) {
+                    stage = !quiescence ? KILLER1 : quiet_checks ? GEN_QUIET_CHECKS : DONE;
+                    break;
+                }
+
+                if (move != tt_move) return move;
+                break;
+            }
+
+            case KILLER1:
+                stage = KILLER2;
+                if (is_usable_killer(killer1)) return killer1;
+                break;
+
+            case KILLER2:
+                stage = GEN_QUIETS;
+                if (killer2 != killer1 && is_usable_killer(killer2)) return killer2;
+                break;
+
+            case GEN_QUIETS:
+                end = MoveGen::generate(pos, MoveGen::QUIETS, moves);
+                next = moves;
+                score_quiets();
+                stage = QUIETS;
+                break;
+
+            case QUIETS: {
+                Move move = pick_best();
+
+                if (move == NO_MOVE) {
+                    stage = DONE;
+                    break;
+                }
+
+                if (move != tt_move && move != killer1 && move != killer2) return move;
+                break;
+            }
+
+            // Every one is worth the same, so they come in generation order
+            case GEN_QUIET_CHECKS:
+                end = MoveGen::generate_quiet_checks(pos, moves);
+                next = moves;
+                stage = QUIET_CHECKS;
+                break;
+
+            case QUIET_CHECKS:
+                if (next != end) return (next++)->move;
+
+                stage = DONE;
+                break;
+
+            case DONE:
+                return NO_MOVE;
+        }
+    }
+}
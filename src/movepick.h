@@ -0,0 +1,66 @@
+/**
+ * movepick.h
+ *
+ * Staged move picker interface
+ * Hands the search one move at a time: the table move, then noisy moves best first, then killers,
+ * and only then the quiet moves. A cutoff on an early move means the later stages never run,
+ * so most cut nodes never generate or score a quiet move.
+ * Quiescence only gets the noisy moves, and the quiet checks when asked for.
+ */
+
+#pragma once
+
+#include "position.h"
+#include "movegen.h"
+
+class MovePicker {
+    enum Stage {
+        TT_MOVE,
+        GEN_NOISY,
+        NOISY,
+        KILLER1,
+        KILLER2,
+        GEN_QUIETS,
+        QUIETS,
+        GEN_QUIET_CHECKS,
+        QUIET_CHECKS,
+        DONE
+    };
+
+    const Position& pos;
+
+    Move tt_move;
+    Move killer1;
+    Move killer2;
+
+    Stage stage = TT_MOVE;
+
+    // Quiescence stops after the noisy moves, or after the quiet checks if it wants those
+    bool quiescence = false;
+    bool quiet_checks = false;
+
+    // The current stage's moves with their scores, in a buffer the search owns for this ply
+    // Every stage generates over the last one, next is where selection carries on from
+    ScoredMove* moves;
+    ScoredMove* end;
+    ScoredMove* next;
+
+    void score_noisy ();
+    void score_quiets ();
+
+    // Selection sort one step at a time, there is no point sorting moves that are never tried
+    Move pick_best ();
+
+    // Killers come from other positions, so they have to be checked against this board
+    bool is_usable_killer (Move killer) const;
+
+    public:
+        // The buffer has to stay untouched until the picker is done, one per ply
+        MovePicker (const Position& position, ScoredMove* buffer, Move tt, Move k1 = NO_MOVE, Move k2 = NO_MOVE);
+
+        // For quiescence, no table move or killers
+        MovePicker (const Position& position, ScoredMove* buffer, bool checks);
+
+        // NO_MOVE once every legal move has been handed out
+        Move next_move ();
+};
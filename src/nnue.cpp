@@ -0,0 +1,272 @@
+/**
+ * nnue.cpp
+ *
+ * NNUE evaluation implementation
+ * Every kernel has an AVX2, SSE4.1 and scalar version, the best one the CPU runs is picked when a network loads
+ */
+
+#include "nnue.h"
+#include "position.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+namespace NNUE {
+
+    bool active = false;
+
+    namespace {
+
+        struct Network {
+            alignas(64) int16_t feature_weights[NNUE_INPUTS * NNUE_HIDDEN];
+            alignas(64) int16_t feature_bias[NNUE_HIDDEN];
+            alignas(64) int8_t output_weights[COLOR_NUM * NNUE_HIDDEN];
+            int32_t output_bias;
+        };
+
+        Network net;
+
+        // Scalar kernels, also the reference the SIMD ones must agree with
+
+        void add_scalar (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i++) acc[i] += row[i];
+        }
+
+        void sub_scalar (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i++) acc[i] -= row[i];
+        }
+
+        int32_t output_scalar (const int16_t* us, const int16_t* them, const int8_t* weights) {
+            int32_t sum = 0;
+
+            for (int i = 0; i < NNUE_HIDDEN; i++) {
+                sum += std::clamp<int>(us[i], 0, NNUE_QA) * weights[i];
+                sum += std::clamp<int>(them[i], 0, NNUE_QA) * weights[NNUE_HIDDEN + i];
+            }
+
+            return sum;
+        }
+
+#ifdef NNUE_X86
+
+        __attribute__((target("sse4.1")))
+        void add_sse41 (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+                __m128i a = _mm_load_si128((const __m128i*) (acc + i));
+                __m128i w = _mm_load_si128((const __m128i*) (row + i));
+                _mm_store_si128((__m128i*) (acc + i), _mm_add_epi16(a, w));
+            }
+        }
+
+        __attribute__((target("sse4.1")))
+        void sub_sse41 (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+                __m128i a = _mm_load_si128((const __m128i*) (acc + i));
+                __m128i w = _mm_load_si128((const __m128i*) (row + i));
+                _mm_store_si128((__m128i*) (acc + i), _mm_sub_epi16(a, w));
+            }
+        }
+
+        // Clip to [0, QA], pack to uint8, then uint8 x int8 pairs into int16 and int16 pairs into int32
+        __attribute__((target("sse4.1")))
+        int32_t output_sse41 (const int16_t* us, const int16_t* them, const int8_t* weights) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i qa = _mm_set1_epi16(NNUE_QA);
+            const __m128i ones = _mm_set1_epi16(1);
+
+            __m128i sum = _mm_setzero_si128();
+
+            const int16_t* halves[COLOR_NUM] = {us, them};
+
+            for (int h = 0; h < COLOR_NUM; h++) {
+                const int16_t* acc = halves[h];
+                const int8_t* w = weights + h * NNUE_HIDDEN;
+
+                for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+                    __m128i a = _mm_load_si128((const __m128i*) (acc + i));
+                    __m128i b = _mm_load_si128((const __m128i*) (acc + i + 8));
+
+                    a = _mm_min_epi16(_mm_max_epi16(a, zero), qa);
+                    b = _mm_min_epi16(_mm_max_epi16(b, zero), qa);
+
+                    __m128i packed = _mm_packus_epi16(a, b);
+                    __m128i product = _mm_maddubs_epi16(packed, _mm_load_si128((const __m128i*) (w + i)));
+
+                    sum = _mm_add_epi32(sum, _mm_madd_epi16(product, ones));
+                }
+            }
+
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+            sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+
+            return _mm_cvtsi128_si32(sum);
+        }
+
+        __attribute__((target("avx2")))
+        void add_avx2 (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+                __m256i a = _mm256_load_si256((const __m256i*) (acc + i));
+                __m256i w = _mm256_load_si256((const __m256i*) (row + i));
+                _mm256_store_si256((__m256i*) (acc + i), _mm256_add_epi16(a, w));
+            }
+        }
+
+        __attribute__((target("avx2")))
+        void sub_avx2 (int16_t* acc, const int16_t* row) {
+            for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+                __m256i a = _mm256_load_si256((const __m256i*) (acc + i));
+                __m256i w = _mm256_load_si256((const __m256i*) (row + i));
+                _mm256_store_si256((__m256i*) (acc + i), _mm256_sub_epi16(a, w));
+            }
+        }
+
+        __attribute__((target("avx2")))
+        int32_t output_avx2 (const int16_t* us, const int16_t* them, const int8_t* weights) {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i qa = _mm256_set1_epi16(NNUE_QA);
+            const __m256i ones = _mm256_set1_epi16(1);
+
+            __m256i sum = _mm256_setzero_si256();
+
+            const int16_t* halves[COLOR_NUM] = {us, them};
+
+            for (int h = 0; h < COLOR_NUM; h++) {
+                const int16_t* acc = halves[h];
+                const int8_t* w = weights + h * NNUE_HIDDEN;
+
+                for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+                    __m256i a = _mm256_load_si256((const __m256i*) (acc + i));
+                    __m256i b = _mm256_load_si256((const __m256i*) (acc + i + 16));
+
+                    a = _mm256_min_epi16(_mm256_max_epi16(a, zero), qa);
+                    b = _mm256_min_epi16(_mm256_max_epi16(b, zero), qa);
+
+                    // packus works per 128 bit lane, put the 64 bit blocks back in order
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+                    __m256i product = _mm256_maddubs_epi16(packed, _mm256_load_si256((const __m256i*) (w + i)));
+
+                    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(product, ones));
+                }
+            }
+
+            __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+            half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+
+            return _mm_cvtsi128_si32(half);
+        }
+
+#endif
+
+        using UpdateFn = void (*) (int16_t* acc, const int16_t* row);
+        using OutputFn = int32_t (*) (const int16_t* us, const int16_t* them, const int8_t* weights);
+
+        UpdateFn add_fn = add_scalar;
+        UpdateFn sub_fn = sub_scalar;
+        OutputFn output_fn = output_scalar;
+        const char* kernel_name = "scalar";
+
+        void select_kernels () {
+            add_fn = add_scalar;
+            sub_fn = sub_scalar;
+            output_fn = output_scalar;
+            kernel_name = "scalar";
+
+#ifdef NNUE_X86
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2")) {
+                add_fn = add_avx2;
+                sub_fn = sub_avx2;
+                output_fn = output_avx2;
+                kernel_name = "avx2";
+            } else if (__builtin_cpu_supports("sse4.1")) {
+                add_fn = add_sse41;
+                sub_fn = sub_sse41;
+                output_fn = output_sse41;
+                kernel_name = "sse4.1";
+            }
+#endif
+        }
+
+        inline const int16_t* feature_row (Color perspective, Piece piece, Square square) {
+            return net.feature_weights + feature_index(perspective, piece, square) * NNUE_HIDDEN;
+        }
+    }
+
+    bool load (const std::string& file) {
+        if (file.empty() || file == "<empty>") {
+            active = false;
+            return true;
+        }
+
+        std::ifstream in (file, std::ios::binary);
+        if (!in) return false;
+
+        uint32_t header[3];
+        in.read((char*) header, sizeof(header));
+
+        if (!in || header[0] != NNUE_MAGIC || header[1] != NNUE_VERSION || header[2] != NNUE_HIDDEN) return false;
+
+        // Read into a scratch copy so a bad file leaves the current network alone
+        std::unique_ptr<Network> loaded = std::make_unique<Network>();
+
+        in.read((char*) loaded->feature_weights, sizeof(loaded->feature_weights));
+        in.read((char*) loaded->feature_bias, sizeof(loaded->feature_bias));
+        in.read((char*) loaded->output_weights, sizeof(loaded->output_weights));
+        in.read((char*) &loaded->output_bias, sizeof(loaded->output_bias));
+
+        if (!in) return false;
+
+        std::memcpy(&net, loaded.get(), sizeof(Network));
+
+        select_kernels();
+        active = true;
+
+        return true;
+    }
+
+    const char* simd_name () {
+        return kernel_name;
+    }
+
+    void reset (Accumulator& acc) {
+        std::memcpy(acc.values[WHITE], net.feature_bias, sizeof(net.feature_bias));
+        std::memcpy(acc.values[BLACK], net.feature_bias, sizeof(net.feature_bias));
+    }
+
+    void add_piece (Accumulator& acc, Piece piece, Square square) {
+        add_fn(acc.values[WHITE], feature_row(WHITE, piece, square));
+        add_fn(acc.values[BLACK], feature_row(BLACK, piece, square));
+    }
+
+    void remove_piece (Accumulator& acc, Piece piece, Square square) {
+        sub_fn(acc.values[WHITE], feature_row(WHITE, piece, square));
+        sub_fn(acc.values[BLACK], feature_row(BLACK, piece, square));
+    }
+
+    void refresh (Accumulator& acc, const Position& pos) {
+        reset(acc);
+
+        for (int square = 0; square < BOARD_SIZE; square++) {
+            Piece piece = pos.piece_at(Square(square));
+            if (piece != NO_PIECE) add_piece(acc, piece, Square(square));
+        }
+    }
+
+    int evaluate (const Position& pos) {
+        Color us = pos.game_info.side_to_move;
+        const Accumulator& acc = pos.accumulator;
+
+        int32_t output = output_fn(acc.values[us], acc.values[opposite(us)], net.output_weights) + net.output_bias;
+
+        return output * NNUE_SCALE / (NNUE_QA * NNUE_QB);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * nnue.h
+ *
+ * NNUE evaluation interface
+ * (768 -> 256) x 2 -> 1, the first layer is kept in the position and updated per piece change
+ *
+ * Network file, little endian:
+ *   uint32 magic "BFNN", uint32 version, uint32 hidden size
+ *   int16 feature weights [768][hidden], int16 feature biases [hidden]
+ *   int8 output weights [2 * hidden], side to move half first, int32 output bias
+ */
+
+#pragma once
+
+#include "type.h"
+#include "constants.h"
+
+#include <string>
+
+struct Position;
+
+namespace NNUE {
+
+    constexpr uint32_t NNUE_MAGIC = 0x4E4E4642;
+    constexpr uint32_t NNUE_VERSION = 1;
+
+    // First layer output, one half per perspective
+    struct alignas(64) Accumulator {
+        int16_t values[COLOR_NUM][NNUE_HIDDEN];
+    };
+
+    // Set once a network is loaded, the position only updates accumulators while it is
+    extern bool active;
+
+    // Loads a network file and picks the kernels for this CPU, an empty path goes back to the classical evaluation
+    bool load (const std::string& file);
+
+    // Name of the kernels in use, for the info string
+    const char* simd_name ();
+
+    // Feature index of a piece on a square seen from a perspective
+    inline int feature_index (Color perspective, Piece piece, Square square) {
+        return perspective == WHITE ? piece * BOARD_SIZE + square
+                                    : ((piece + 6) % PIECE_NUM) * BOARD_SIZE + (square ^ 56);
+    }
+
+    // Incremental updates
+    void reset (Accumulator& acc);
+    void add_piece (Accumulator& acc, Piece piece, Square square);
+    void remove_piece (Accumulator& acc, Piece piece, Square square);
+
+    // Rebuilds the accumulator from the board
+    void refresh (Accumulator& acc, const Position& pos);
+
+    // Score from the side to move's point of view
+    int evaluate (const Position& pos);
+}
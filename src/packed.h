@@ -0,0 +1,70 @@
+/**
+ * packed.h
+ *
+ * Packed training record, written by datagen and read by the trainer
+ * 32 bytes per position, little endian, so files can be concatenated and shuffled as plain arrays
+ */
+
+#pragma once
+
+#include "type.h"
+#include "constants.h"
+
+#include <array>
+
+struct PackedPosition {
+    // Occupied squares, the pieces below are in the same order as the set bits from a1 up
+    uint64_t occupancy;
+
+    // One Piece per occupied square, 4 bits each, low nibble first
+    uint8_t pieces[16];
+
+    // Search score in centipawns from white's point of view
+    int16_t score;
+
+    // Game result from white's point of view, 0 loss, 1 draw, 2 win
+    uint8_t result;
+
+    uint8_t side_to_move;
+
+    // Enough to rebuild the exact position, so game records can replay moves from it
+    uint8_t castling;
+    uint8_t ep_square;
+    uint8_t rule_50_clock;
+    uint8_t padding;
+
+    inline Piece piece (int index) const {
+        return Piece((pieces[index >> 1] >> (4 * (index & 1))) & 0xF);
+    }
+};
+
+static_assert(sizeof(PackedPosition) == 32, "A packed position should be exactly 32 bytes");
+
+constexpr uint8_t RESULT_BLACK_WIN = 0;
+constexpr uint8_t RESULT_DRAW = 1;
+constexpr uint8_t RESULT_WHITE_WIN = 2;
+
+// Legal positions never have more than 32 pieces, so they always fit
+inline PackedPosition pack_position (const std::array<Piece, BOARD_SIZE>& mailbox, Color side_to_move, int score, uint8_t result,
+                                     CastlingRights castling = 0, Square ep_square = NO_SQUARE, int rule_50_clock = 0) {
+    PackedPosition packed {};
+
+    int index = 0;
+
+    for (int square = 0; square < BOARD_SIZE; square++) {
+        if (mailbox[square] == NO_PIECE) continue;
+
+        packed.occupancy |= 1ULL << square;
+        packed.pieces[index >> 1] |= mailbox[square] << (4 * (index & 1));
+        index++;
+    }
+
+    packed.score = int16_t(score);
+    packed.result = result;
+    packed.side_to_move = side_to_move;
+    packed.castling = castling;
+    packed.ep_square = ep_square;
+    packed.rule_50_clock = uint8_t(rule_50_clock);
+
+    return packed;
+}
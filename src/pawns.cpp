@@ -0,0 +1,92 @@
+/**
+ * pawns.cpp
+ *
+ * Pawn structure evaluation implementation
+ * Isolated, doubled, backward and passed pawns
+ */
+
+#include "pawns.h"
+#include "bitboards.h"
+
+namespace Pawns {
+
+    PawnTable::PawnTable () {
+        // A zeroed entry is already right for the only structure keyed 0, no pawns at all
+        table.resize(PAWN_HASH_SIZE, PawnEntry{0ULL, 0});
+    }
+
+    PawnEntry& PawnTable::operator[] (Key key) {
+        return table[key & (PAWN_HASH_SIZE - 1)];
+    }
+
+    // The files next to this one, used for isolated and backward pawns
+    static inline Bitboard adjacent_files (int file) {
+        Bitboard adjacent = 0ULL;
+
+        if (file > 0) adjacent |= Bitboards::file_a << (file - 1);
+        if (file < 7) adjacent |= Bitboards::file_a << (file + 1);
+
+        return adjacent;
+    }
+
+    // The score for one side, positive is good for that side
+    static Score evaluate_side (const Position& pos, Color us) {
+        Color them = opposite(us);
+
+        Bitboard our_pawns = pos.get_bitboard(make_piece(PAWN, us));
+        Bitboard their_pawns = pos.get_bitboard(make_piece(PAWN, them));
+
+        Score score = 0;
+
+        for (Bitboard pawns = our_pawns; pawns; pawns &= pawns - 1) {
+            Square square = Square(__builtin_ctzll(pawns));
+            int file = square & 7;
+            int relative_rank = us == WHITE ? square >> 3 : 7 - (square >> 3);
+
+            Bitboard adjacent = adjacent_files(file);
+            Bitboard in_front = Bitboards::get_passed_pawn_mask(square, us);
+
+            // Isolated, no friendly pawn on either neighbouring file
+            if (!(adjacent & our_pawns)) {
+                score -= make_score(ISOLATED_PAWN_PENALTY, ISOLATED_PAWN_PENALTY);
+            }
+
+            // Doubled, another friendly pawn further up the same file
+            if (in_front & (Bitboards::file_a << file) & our_pawns) {
+                score -= make_score(DOUBLED_PAWN_PENALTY, DOUBLED_PAWN_PENALTY);
+            }
+
+            // Passed, nothing can stop it but pieces, matters more as the board empties
+            if (!(in_front & their_pawns)) {
+                int bonus = passed_pawn_bonuses[relative_rank];
+                score += make_score(bonus / 2, bonus);
+            }
+
+            // Backward, no friendly pawn level or behind on the neighbouring files and the square in front is guarded by a pawn
+            else {
+                Square stop = Square(us == WHITE ? square + 8 : square - 8);
+
+                if (!(adjacent & ~in_front & our_pawns) && (Bitboards::get_pawn_attacks(stop, us) & their_pawns)) {
+                    score -= make_score(BACKWARD_PAWN_PENALTY, BACKWARD_PAWN_PENALTY);
+                }
+            }
+        }
+
+        return score;
+    }
+
+    Score evaluate_pawns (const Position& pos) {
+        return evaluate_side(pos, WHITE) - evaluate_side(pos, BLACK);
+    }
+
+    Score probe (const Position& pos, PawnTable& table) {
+        PawnEntry& entry = table[pos.pawn_hash];
+
+        if (entry.key != pos.pawn_hash) {
+            entry.key = pos.pawn_hash;
+            entry.score = evaluate_pawns(pos);
+        }
+
+        return entry.score;
+    }
+}
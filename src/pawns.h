@@ -0,0 +1,36 @@
+/**
+ * pawns.h
+ *
+ * Pawn structure evaluation interface
+ * Pawn structure rarely changes between nodes, so the result is cached by the pawn hash
+ */
+
+#pragma once
+
+#include "position.h"
+
+#include <vector>
+
+namespace Pawns {
+
+    struct PawnEntry {
+        Key key;
+
+        // White's pawn structure score minus black's
+        Score score;
+    };
+
+    class PawnTable {
+        std::vector<PawnEntry> table;
+
+        public:
+            PawnTable ();
+            PawnEntry& operator[] (Key key);
+    };
+
+    // Computes every pawn structure term from scratch
+    Score evaluate_pawns (const Position& pos);
+
+    // Looks the pawn structure up in the table, evaluating it on a miss
+    Score probe (const Position& pos, PawnTable& table);
+}
@@ -0,0 +1,332 @@
+/**
+ * perft.cpp
+ *
+ * Perft implementation
+ * Uses the same generate/make/undo as the search so it measures what the search pays for
+ */
+
+#include "perft.h"
+#include "movegen.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace Perft {
+
+    // Well known positions, the small ones target en passant, castling and promotion edge cases
+    const std::vector<PerftCase> suite = {
+        {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+        {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+        {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624},
+        {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},
+        {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+        {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+
+        // Illegal en passant, the captured pawn is pinned along the rank
+        {"8/5bk1/8/2Pp4/8/1K6/8/8 w - d6 0 1", 6, 824064},
+        {"8/8/1k6/8/2pP4/8/5BK1/8 b - d3 0 1", 6, 824064},
+
+        // En passant gives check
+        {"8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},
+        {"8/5k2/8/2Pp4/2B5/1K6/8/8 w - d6 0 1", 6, 1440467},
+
+        // Castling gives check
+        {"5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},
+        {"3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},
+
+        // Castling rights lost through rook captures, castling through attacked squares
+        {"r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},
+        {"r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},
+
+        // Promotions
+        {"2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001},
+        {"4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},
+        {"8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},
+
+        // Discovered check, stalemate and checkmate
+        {"8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", 5, 1004658},
+        {"K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},
+        {"8/k1P5/8/1K6/8/8/8/8 w - - 0 1", 7, 567584},
+        {"8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527}
+    };
+
+    PerftTable::PerftTable (size_t mb) {
+        // Power of two so the index is just a mask
+        size_t entries = 1;
+        while (entries * 2 * sizeof(Entry) <= mb * (1 << 20)) entries *= 2;
+
+        table = std::make_unique<Entry[]>(entries);
+        mask = entries - 1;
+    }
+
+    // The same position at a different depth has a different count, so mix the depth into the key
+    static inline Key depth_key (Key hash, int depth) {
+        return hash ^ (depth * 0x9E3779B97F4A7C15ULL);
+    }
+
+    bool PerftTable::probe (Key hash, int depth, uint64_t& nodes) const {
+        Key key = depth_key(hash, depth);
+        const Entry& entry = table[key & mask];
+
+        uint64_t data = entry.data.load(std::memory_order_relaxed);
+        if ((entry.key.load(std::memory_order_relaxed) ^ data) != key) return false;
+
+        nodes = data;
+        return true;
+    }
+
+    void PerftTable::store (Key hash, int depth, uint64_t nodes) {
+        Key key = depth_key(hash, depth);
+        Entry& entry = table[key & mask];
+
+        entry.key.store(key ^ nodes, std::memory_order_relaxed);
+        entry.data.store(nodes, std::memory_order_relaxed);
+    }
+
+    // Every ply generates into its own buffer, the children get the ones after it
+    static uint64_t perft (Position& pos, int depth, MoveBuffer* buffers) {
+        if (depth <= 0) return 1;
+
+        ScoredMove* moves = buffers->data();
+        ScoredMove* end = MoveGen::generate(pos, MoveGen::ALL, moves);
+
+        // Bulk counting, every generated move is legal so the leaves don't need to be made
+        if (depth == 1) return end - moves;
+
+        uint64_t nodes = 0;
+
+        for (ScoredMove* it = moves; it != end; it++) {
+            pos.make_move(it->move);
+            nodes += perft(pos, depth - 1, buffers + 1);
+            pos.undo_move();
+        }
+
+        return nodes;
+    }
+
+    static uint64_t perft (Position& pos, int depth, PerftTable& table, MoveBuffer* buffers) {
+        // Bulk counting is cheaper than a table lookup
+        if (depth <= 1) return perft(pos, depth, buffers);
+
+        uint64_t nodes = 0;
+        if (table.probe(pos.hash, depth, nodes)) return nodes;
+
+        ScoredMove* moves = buffers->data();
+        ScoredMove* end = MoveGen::generate(pos, MoveGen::ALL, moves);
+
+        for (ScoredMove* it = moves; it != end; it++) {
+            pos.make_move(it->move);
+            nodes += perft(pos, depth - 1, table, buffers + 1);
+            pos.undo_move();
+        }
+
+        table.store(pos.hash, depth, nodes);
+        return nodes;
+    }
+
+    uint64_t perft (Position& pos, int depth) {
+        std::vector<MoveBuffer> buffers (std::max(depth, 1));
+        return perft(pos, depth, buffers.data());
+    }
+
+    uint64_t perft (Position& pos, int depth, PerftTable& table) {
+        std::vector<MoveBuffer> buffers (std::max(depth, 1));
+        return perft(pos, depth, table, buffers.data());
+    }
+
+    uint64_t parallel_perft (const Position& pos, int depth, PerftTable& table, int threads) {
+        if (depth <= 1) {
+            Position copy = pos;
+            return perft(copy, depth);
+        }
+
+        MoveList legal = MoveGen::generate_moves(pos);
+
+        // Root moves are handed out one at a time, so a thread stuck on a big subtree doesn't hold up the rest
+        std::atomic<int> next {0};
+        std::atomic<uint64_t> total {0};
+
+        auto worker = [&]() {
+            Position copy = pos;
+            std::vector<MoveBuffer> buffers (depth);
+
+            int i;
+            while ((i = next.fetch_add(1)) < legal.size) {
+                copy.make_move(legal[i]);
+                total += perft(copy, depth - 1, table, buffers.data());
+                copy.undo_move();
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 0; i < threads; i++) {
+            pool.emplace_back(worker);
+        }
+
+        for (std::thread& thread: pool) {
+            thread.join();
+        }
+
+        return total;
+    }
+
+    void go_perft (Position& pos, int depth) {
+        auto start = steady_clock::now();
+        uint64_t nodes = perft(pos, depth);
+        uint64_t elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+        std::cout << "Nodes searched: " << nodes << "\n";
+        std::cout << "Time (ms): " << elapsed << "\n";
+        std::cout << "Nodes/second: " << (nodes * 1000 / std::max<uint64_t>(elapsed, 1)) << "\n" << std::flush;
+    }
+
+    // Perft but every root move gets its own count, for finding where a bug is
+    void divide (Position& pos, int depth) {
+        if (depth < 1) return;
+
+        auto start = steady_clock::now();
+        uint64_t total = 0;
+
+        MoveList moves = MoveGen::generate_moves(pos);
+        std::vector<MoveBuffer> buffers (depth);
+
+        for (Move move: moves) {
+            pos.make_move(move);
+            uint64_t nodes = perft(pos, depth - 1, buffers.data());
+            pos.undo_move();
+
+            total += nodes;
+            std::cout << move_to_string(move) << ": " << nodes << "\n";
+        }
+
+        uint64_t elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+        std::cout << "\nNodes searched: " << total << "\n";
+        std::cout << "Time (ms): " << elapsed << "\n";
+        std::cout << "Nodes/second: " << (total * 1000 / std::max<uint64_t>(elapsed, 1)) << "\n" << std::flush;
+    }
+
+    void run_suite () {
+        uint64_t total_nodes = 0;
+        uint64_t total_ms = 0;
+        int failed = 0;
+
+        for (const PerftCase& test: suite) {
+            Position pos(test.fen);
+
+            auto start = steady_clock::now();
+            uint64_t nodes = perft(pos, test.depth);
+            uint64_t elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+            total_nodes += nodes;
+            total_ms += elapsed;
+
+            bool ok = nodes == test.nodes;
+            failed += !ok;
+
+            std::cout << (ok ? "OK   " : "FAIL ") << test.fen << " depth " << test.depth << ": " << nodes;
+            if (!ok) std::cout << " (expected " << test.nodes << ")";
+            std::cout << "\n";
+        }
+
+        std::cout << "\n===========================\n";
+        std::cout << "Failed          : " << failed << "/" << suite.size() << "\n";
+        std::cout << "Total time (ms) : " << total_ms << "\n";
+        std::cout << "Nodes searched  : " << total_nodes << "\n";
+        std::cout << "Nodes/second    : " << (total_nodes * 1000 / std::max<uint64_t>(total_ms, 1)) << "\n" << std::flush;
+    }
+
+    // Runs an EPD file of lines like "<fen> ;D1 20 ;D2 400 ;D3 8902"
+    void run_epd (const std::string& file, int threads) {
+        std::ifstream in (file);
+
+        if (!in) {
+            std::cout << "info string cannot open " << file << std::endl;
+            return;
+        }
+
+        PerftTable table;
+
+        uint64_t total_nodes = 0;
+        uint64_t total_ms = 0;
+        int lines = 0;
+        int failed = 0;
+
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream iss (line);
+            std::string fen;
+
+            if (!std::getline(iss, fen, ';')) continue;
+
+            // EPD positions may leave out the move counters
+            std::istringstream fields (fen);
+            std::string field;
+            int field_count = 0;
+
+            fen.clear();
+            while (fields >> field) {
+                fen += (field_count++ ? " " : "") + field;
+            }
+
+            if (field_count < 4) continue;
+            if (field_count == 4) fen += " 0 1";
+
+            // Parse the whole line first, so a bad one is skipped before it counts
+            Position pos;
+            std::vector<std::pair<int, uint64_t>> tests;
+
+            try {
+                pos.parse_fen(fen);
+
+                std::string test;
+
+                while (std::getline(iss, test, ';')) {
+                    std::istringstream test_stream (test);
+                    std::string depth_str;
+                    uint64_t expected;
+
+                    if (!(test_stream >> depth_str >> expected) || depth_str.size() < 2 || depth_str[0] != 'D') continue;
+
+                    tests.emplace_back(std::stoi(depth_str.substr(1)), expected);
+                }
+            } catch (const std::exception& e) {
+                std::cout << "info string skipping bad perft line " << line << std::endl;
+                continue;
+            }
+
+            lines++;
+
+            bool line_ok = true;
+
+            for (const auto& [depth, expected]: tests) {
+                auto start = steady_clock::now();
+                uint64_t nodes = parallel_perft(pos, depth, table, threads);
+                total_ms += duration_cast<milliseconds>(steady_clock::now() - start).count();
+                total_nodes += nodes;
+
+                if (nodes != expected) {
+                    std::cout << "FAIL " << fen << " depth " << depth << ": " << nodes << " (expected " << expected << ")\n";
+                    line_ok = false;
+                }
+            }
+
+            failed += !line_ok;
+
+            if (line_ok) std::cout << "OK   " << fen << "\n" << std::flush;
+        }
+
+        std::cout << "\n===========================\n";
+        std::cout << "Failed          : " << failed << "/" << lines << "\n";
+        std::cout << "Threads         : " << threads << "\n";
+        std::cout << "Total time (ms) : " << total_ms << "\n";
+        std::cout << "Nodes counted   : " << total_nodes << "\n";
+        std::cout << "Nodes/second    : " << (total_nodes * 1000 / std::max<uint64_t>(total_ms, 1)) << "\n" << std::flush;
+    }
+}
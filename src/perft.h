@@ -0,0 +1,61 @@
+/**
+ * perft.h
+ *
+ * Perft interface
+ * Counts leaf nodes of the move tree to test move generation speed and correctness
+ */
+
+#pragma once
+
+#include "position.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Perft {
+
+    // A position with its known node count at some depth
+    struct PerftCase {
+        std::string fen;
+        int depth;
+        uint64_t nodes;
+    };
+
+    // The embedded suite
+    extern const std::vector<PerftCase> suite;
+
+    constexpr size_t PERFT_HASH_MB = 128;
+
+    // Subtree counts keyed by position and depth, shared by every perft thread
+    // Each entry stores key ^ data so a torn write from another thread just fails the key check,
+    // the fields are relaxed atomics so that race is still defined behaviour
+    class PerftTable {
+        struct Entry {
+            std::atomic<uint64_t> key {0};
+            std::atomic<uint64_t> data {0};
+        };
+
+        std::unique_ptr<Entry[]> table;
+        size_t mask;
+
+        public:
+            PerftTable (size_t mb = PERFT_HASH_MB);
+            bool probe (Key hash, int depth, uint64_t& nodes) const;
+            void store (Key hash, int depth, uint64_t nodes);
+    };
+
+    // Counts leaves, the last ply is counted without making the moves
+    uint64_t perft (Position& pos, int depth);
+    uint64_t perft (Position& pos, int depth, PerftTable& table);
+
+    // Splits the root moves between threads
+    uint64_t parallel_perft (const Position& pos, int depth, PerftTable& table, int threads);
+
+    // UCI commands
+    void go_perft (Position& pos, int depth);
+    void divide (Position& pos, int depth);
+    void run_suite ();
+    void run_epd (const std::string& file, int threads);
+}
@@ -18,6 +18,19 @@
 
 
 
+// Rights lost when a rook leaves or is captured on its corner
+static constexpr uint8_t castling_mask[64] = {
+
+    WQS_RIGHT, 0, 0, 0, 0, 0, 0, WKS_RIGHT,    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    0, 0, 0, 0, 0, 0, 0, 0,                    
+    BQS_RIGHT, 0, 0, 0, 0, 0, 0, BKS_RIGHT     
+};
+
 // Lookup a certain piece's 
 Bitboard Position::get_bitboard(Piece piece) const {
     assert (piece != NO_PIECE && "Trying to get bitboard of NO_PIECE");
@@ -54,6 +67,45 @@ std::string Position::to_string() const {
     return string.str();
 }
 
+// The move number isn't kept, so it is always 1
+std::string Position::to_fen() const {
+    std::string fen;
+
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+
+        for (int file = 0; file < 8; file++) {
+            Piece piece = piece_at(Square(rank << 3 | file));
+
+            if (piece == NO_PIECE) {
+                empty++;
+                continue;
+            }
+
+            if (empty) fen += char('0' + empty);
+            empty = 0;
+            fen += PIECE_TO_CHAR[piece];
+        }
+
+        if (empty) fen += char('0' + empty);
+        if (rank) fen += '/';
+    }
+
+    fen += game_info.side_to_move == WHITE ? " w " : " b ";
+
+    std::string castling;
+    if (game_info.castling & WKS_RIGHT) castling += 'K';
+    if (game_info.castling & WQS_RIGHT) castling += 'Q';
+    if (game_info.castling & BKS_RIGHT) castling += 'k';
+    if (game_info.castling & BQS_RIGHT) castling += 'q';
+    fen += castling.empty() ? "-" : castling;
+
+    fen += " " + (game_info.ep_square == NO_SQUARE ? std::string("-") : square_to_str(game_info.ep_square));
+    fen += " " + std::to_string(game_info.rule_50_clock) + " 1";
+
+    return fen;
+}
+
 // editing function
 void Position::update_occupancies() {
     board.color_bitboards[WHITE] = get_bitboard(W_PAWN) | get_bitboard(W_KNIGHT) | get_bitboard(W_BISHOP) | get_bitboard(W_ROOK) | get_bitboard(W_QUEEN) | get_bitboard(W_KING);
@@ -71,6 +123,17 @@ void Position::set_square(Square square, Piece piece) {
 
     // HASH BRONW
     hash ^= zobrist.pieces[piece][square];
+
+    psq += EvalTables::psq_table[piece][square];
+    phase += piece_phase[piece];
+
+    if (type_of(piece) == PAWN) {
+        pawn_hash ^= zobrist.pieces[piece][square];
+    }
+
+    material_hash ^= zobrist.material[piece][__builtin_popcountll(board.piece_bitboards[piece])];
+
+    if (NNUE::active) NNUE::add_piece(accumulator, piece, square);
     
     // Mailbox
     board.mailbox[square] = piece;
@@ -88,6 +151,17 @@ void Position::clear_square (Square square) {
     board.piece_bitboards[board.mailbox[square]] &= ~(1ULL << square);
     hash ^= zobrist.pieces[board.mailbox[square]][square]; 
 
+    material_hash ^= zobrist.material[board.mailbox[square]][__builtin_popcountll(board.piece_bitboards[board.mailbox[square]])];
+
+    if (NNUE::active) NNUE::remove_piece(accumulator, board.mailbox[square], square);
+
+    psq -= EvalTables::psq_table[board.mailbox[square]][square];
+    phase -= piece_phase[board.mailbox[square]];
+
+    if (type_of(board.mailbox[square]) == PAWN) {
+        pawn_hash ^= zobrist.pieces[board.mailbox[square]][square];
+    }
+
     board.mailbox[square] = NO_PIECE;
 
     
@@ -108,9 +182,23 @@ void Position::clear_pos () {
     
     hash = zobrist.white_to_move ^ zobrist.castling[0];
 
+    psq = 0;
+    phase = 0;
+    pawn_hash = 0;
+    material_hash = 0;
+
+    // A new position has no moves to undo
+    history.clear();
+
+    if (NNUE::active) NNUE::reset(accumulator);
+
     
 }
 
+void Position::refresh_accumulator () {
+    if (NNUE::active) NNUE::refresh(accumulator, *this);
+}
+
 void Position::set_start_pos () {
     
     parse_fen();
@@ -119,6 +207,15 @@ void Position::set_start_pos () {
 
 void Position::parse_fen(std::string_view fen) {
     
+    // Every caller feeds FENs from outside, so a bad one throws before it can write past the board
+    std::istringstream fields {std::string(fen)};
+    std::string field;
+    int field_count = 0;
+
+    while (fields >> field) field_count++;
+
+    if (field_count < 4) throw std::invalid_argument("Missing FEN fields");
+
     clear_pos(); // start from empty board
     hash = 0;
 
@@ -132,7 +229,7 @@ void Position::parse_fen(std::string_view fen) {
         char c = fen[i];
 
         if (c == '/') {       
-            assert(file == 8);  // Checking
+            if (file != 8 || rank == 0) throw std::invalid_argument("Invalid rank in Board field");
             file = 0;
             rank--;
         }
@@ -140,11 +237,12 @@ void Position::parse_fen(std::string_view fen) {
         // Empty squares
         else if (std::isdigit(c)) {  
             file += c - '0';
+            if (file > 8) throw std::invalid_argument("Invalid rank in Board field");
         }
 
         // Piece
         else {  
-            assert(file < 8 && rank >= 0);
+            if (file >= 8) throw std::invalid_argument("Invalid rank in Board field");
 
             Piece p;
             switch (c) {
@@ -166,14 +264,18 @@ void Position::parse_fen(std::string_view fen) {
             }
 
             Square sq = Square(rank << 3 | file);
-            hash ^= zobrist.pieces[p][sq];
             set_square(sq, p);
             file++;
         }
         i++;
     }
 
-    assert(rank == 0 && file == 8); // Sanity check all squares processed
+    if (rank != 0 || file != 8) throw std::invalid_argument("Incomplete Board field");
+
+    // Move generation assumes exactly one king a side
+    if (__builtin_popcountll(get_bitboard(W_KING)) != 1 || __builtin_popcountll(get_bitboard(B_KING)) != 1) {
+        throw std::invalid_argument("Board field needs one king a side");
+    }
 
     // Parse remaining fields
     fen.remove_prefix(i + 1); 
@@ -205,7 +307,8 @@ void Position::parse_fen(std::string_view fen) {
         fen.remove_prefix(2);
     } else {
         char file_char = fen[0];
-        char rank_char = fen[1];
+        char rank_char = fen.size() > 1 ? fen[1] : ' ';
+        if (file_char < 'a' || file_char > 'h' || rank_char < '1' || rank_char > '8') throw std::invalid_argument("Invalid en passant field");
         game_info.ep_square = Square((rank_char - '1') << 3 | (file_char - 'a'));
         hash ^= zobrist.en_passant[game_info.ep_square];
         fen.remove_prefix(3);
@@ -220,6 +323,19 @@ void Position::parse_fen(std::string_view fen) {
     update_occupancies();
 }
 
+// Every piece of both colors that attacks the square, with a custom occupancy for the sliders
+Bitboard Position::attackers_to (Square square, Bitboard occupancy) const {
+    Bitboard rooks = get_bitboard(W_ROOK) | get_bitboard(B_ROOK) | get_bitboard(W_QUEEN) | get_bitboard(B_QUEEN);
+    Bitboard bishops = get_bitboard(W_BISHOP) | get_bitboard(B_BISHOP) | get_bitboard(W_QUEEN) | get_bitboard(B_QUEEN);
+
+    return (Bitboards::get_pawn_attacks(square, WHITE) & get_bitboard(B_PAWN)) |
+           (Bitboards::get_pawn_attacks(square, BLACK) & get_bitboard(W_PAWN)) |
+           (Bitboards::get_knight_attacks(square) & (get_bitboard(W_KNIGHT) | get_bitboard(B_KNIGHT))) |
+           (Bitboards::get_king_attacks(square) & (get_bitboard(W_KING) | get_bitboard(B_KING))) |
+           (Bitboards::get_rook_attacks(square, occupancy) & rooks) |
+           (Bitboards::get_bishop_attacks(square, occupancy) & bishops);
+}
+
 bool Position::is_square_attacked (Square square, Color color) const {
     Bitboard pawns = color == WHITE ? get_bitboard(W_PAWN): get_bitboard(B_PAWN);
     Bitboard knights = color == WHITE ? get_bitboard(W_KNIGHT): get_bitboard(B_KNIGHT);
@@ -265,95 +381,241 @@ bool Position::is_in_check (Color color) const {
 
 
 
+template <Color Us>
 bool Position::can_castle_ks () const {
-    if (is_in_check(game_info.side_to_move)) return false;
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+    constexpr uint8_t RIGHT = Us == WHITE ? WKS_RIGHT : BKS_RIGHT;
+    constexpr Bitboard BETWEEN = Us == WHITE ? WKS_CASTLE_BETWEEN_SQU : BKS_CASTLE_BETWEEN_SQU;
 
-    if (game_info.side_to_move == WHITE) {
-        // rights
-        if ((game_info.castling & WKS_RIGHT) == 0)
-            return false;
+    // rights
+    if ((game_info.castling & RIGHT) == 0)
+        return false;
 
-        // between squares
-        if ((WKS_CASTLE_BETWEEN_SQU & board.occupancy) != 0ULL)
-            return false;
-        
-        // king and rook
-        if (!(piece_at(E1) == W_KING && piece_at(H1) == W_ROOK))
-            return false;
-        
-        if (is_square_attacked(G1, BLACK) || is_square_attacked(F1, BLACK)) 
-            return false;
+    // between squares
+    if ((BETWEEN & board.occupancy) != 0ULL)
+        return false;
 
-        return true;
-    } else {
-        // rights
-        if ((game_info.castling & BKS_RIGHT) == 0)
-            return false;
+    // king and rook
+    if (!(piece_at(Us == WHITE ? E1 : E8) == make_piece(KING, Us) && piece_at(Us == WHITE ? H1 : H8) == make_piece(ROOK, Us)))
+        return false;
 
-        // between squares
-        if ((BKS_CASTLE_BETWEEN_SQU & board.occupancy) != 0ULL)
-            return false;
-        
-        // king and rook
-        if (!(piece_at(E8) == B_KING && piece_at(H8) == B_ROOK))
-            return false;
-        
-        if (is_square_attacked(G8, WHITE) || is_square_attacked(F8, WHITE)) 
-            return false;
+    if (is_square_attacked(Us == WHITE ? G1 : G8, Them) || is_square_attacked(Us == WHITE ? F1 : F8, Them))
+        return false;
 
-        return true;
-    }
+    return true;
+}
 
-    
-    
+template <Color Us>
+bool Position::can_castle_qs () const {
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
+    constexpr uint8_t RIGHT = Us == WHITE ? WQS_RIGHT : BQS_RIGHT;
+    constexpr Bitboard BETWEEN = Us == WHITE ? WQS_CASTLE_BETWEEN_SQU : BQS_CASTLE_BETWEEN_SQU;
+
+    // rights
+    if ((game_info.castling & RIGHT) == 0)
+        return false;
+
+    // between squares
+    if ((BETWEEN & board.occupancy) != 0ULL)
+        return false;
+
+    // king and rook
+    if (!(piece_at(Us == WHITE ? E1 : E8) == make_piece(KING, Us) && piece_at(Us == WHITE ? A1 : A8) == make_piece(ROOK, Us)))
+        return false;
+
+    if (is_square_attacked(Us == WHITE ? D1 : D8, Them) || is_square_attacked(Us == WHITE ? C1 : C8, Them))
+        return false;
+
+    return true;
+}
+
+// Movegen calls these directly
+template bool Position::can_castle_ks<WHITE> () const;
+template bool Position::can_castle_ks<BLACK> () const;
+template bool Position::can_castle_qs<WHITE> () const;
+template bool Position::can_castle_qs<BLACK> () const;
+
+bool Position::can_castle_ks () const {
+    return game_info.side_to_move == WHITE ? can_castle_ks<WHITE>() : can_castle_ks<BLACK>();
 }
 
 bool Position::can_castle_qs () const {
-    if (is_in_check(game_info.side_to_move)) return false;
+    return game_info.side_to_move == WHITE ? can_castle_qs<WHITE>() : can_castle_qs<BLACK>();
+}
+
+// Instead of make + is_in_check + undo, look at what the occupancy would be after the move
+bool Position::is_legal (Move move) const {
+    const Square from = Square(FROM(move));
+    const Square to = Square(TO(move));
+    const Color us = game_info.side_to_move;
+    const Bitboard enemies = board.color_bitboards[opposite(us)];
 
-    if (game_info.side_to_move == WHITE) {
-        // rights
-        if ((game_info.castling & WQS_RIGHT) == 0)
-            return false;
+    // Castling is only generated out of check and when the king's path is safe
+    if (FLAG(move) == MOVE_CASTLING_FLAG) return true;
 
-        // between squares
-        if ((WQS_CASTLE_BETWEEN_SQU & board.occupancy) != 0ULL)
-            return false;
-        
-        // king and rook
-        if (!(piece_at(E1) == W_KING && piece_at(A1) == W_ROOK))
-            return false;
-        
-        if (is_square_attacked(D1, BLACK) || is_square_attacked(C1, BLACK)) 
-            return false;
+    // The king can't hide behind itself from a slider
+    if (type_of(Piece(MOVED(move))) == KING) {
+        return !(attackers_to(to, board.occupancy ^ (1ULL << from)) & enemies);
+    }
 
-        return true;
-    } else {
-        // rights
-        if ((game_info.castling & BQS_RIGHT) == 0)
-            return false;
+    Square king = Square(__builtin_ctzll(get_bitboard(make_piece(KING, us))));
 
-        // between squares
-        if ((BQS_CASTLE_BETWEEN_SQU & board.occupancy) != 0ULL)
-            return false;
-        
-        // king and rook
-        if (!(piece_at(E8) == B_KING && piece_at(A8) == B_ROOK))
-            return false;
-        
-        if (is_square_attacked(D8, WHITE) || is_square_attacked(C8, WHITE)) 
-            return false;
+    Bitboard occupancy = (board.occupancy ^ (1ULL << from)) | (1ULL << to);
+    Bitboard captured = 1ULL << to;
 
-        return true;
+    // The captured pawn is not on the target square
+    if (FLAG(move) == MOVE_ENPASSANT_FLAG) {
+        captured = 1ULL << (to + (us == WHITE ? -8 : 8));
+        occupancy ^= captured;
     }
 
-    
-    
+    return !(attackers_to(king, occupancy) & enemies & ~captured);
+}
+
+bool Position::is_pseudo_legal (Move move) const {
+    if (move == NO_MOVE) return false;
+
+    const Square from = Square(FROM(move));
+    const Square to = Square(TO(move));
+    const int flag = FLAG(move);
+    const Color us = game_info.side_to_move;
+    const Color them = opposite(us);
+    const Piece moved = Piece(MOVED(move));
+    const Piece captured = Piece(CAPTURED(move));
+
+    if (moved >= NO_PIECE || flag > MOVE_QPROMO_FLAG || color_of(moved) != us || piece_at(from) != moved) return false;
+
+    if (flag == MOVE_ENPASSANT_FLAG) {
+        return type_of(moved) == PAWN && to == game_info.ep_square && captured == make_piece(PAWN, them) &&
+               (Bitboards::get_pawn_attacks(from, us) & (1ULL << to));
+    }
+
+    if (captured != piece_at(to) || (board.color_bitboards[us] & (1ULL << to))) return false;
+
+    if (flag == MOVE_CASTLING_FLAG) {
+        if (type_of(moved) != KING || is_in_check(us)) return false;
+
+        Square king_from = us == WHITE ? E1 : E8;
+        if (from != king_from) return false;
+
+        return (to == king_from + 2 && can_castle_ks()) || (to == king_from - 2 && can_castle_qs());
+    }
+
+    if (type_of(moved) == PAWN) {
+        const int push = us == WHITE ? 8 : -8;
+        const Bitboard promo = us == WHITE ? Bitboards::rank8 : Bitboards::rank1;
+
+        // A pawn reaching the last rank has to promote, and only then
+        if (bool(promo & (1ULL << to)) != (flag >= MOVE_NPROMO_FLAG)) return false;
+
+        if (flag == MOVE_DOUBLE_PUSH_FLAG) {
+            Bitboard start = us == WHITE ? Bitboards::rank2 : Bitboards::rank7;
+
+            return (start & (1ULL << from)) && to == from + 2 * push &&
+                   !(board.occupancy & ((1ULL << (from + push)) | (1ULL << to)));
+        }
+
+        if (Bitboards::get_pawn_attacks(from, us) & (1ULL << to)) return captured != NO_PIECE;
+
+        return to == from + push && captured == NO_PIECE;
+    }
+
+    if (flag != 0) return false;
+
+    switch (type_of(moved)) {
+        case KNIGHT:
+            return Bitboards::get_knight_attacks(from) & (1ULL << to);
+
+        case BISHOP:
+            return Bitboards::get_bishop_attacks(from, board.occupancy) & (1ULL << to);
+
+        case ROOK:
+            return Bitboards::get_rook_attacks(from, board.occupancy) & (1ULL << to);
+
+        case QUEEN:
+            return (Bitboards::get_bishop_attacks(from, board.occupancy) | Bitboards::get_rook_attacks(from, board.occupancy)) & (1ULL << to);
+
+        default:
+            return Bitboards::get_king_attacks(from) & (1ULL << to);
+    }
+}
+
+Move Position::move_from16 (uint16_t move) const {
+    if (move == NO_MOVE16) return NO_MOVE;
+
+    const Square from = Square(move & 0x3F);
+    const Square to = Square((move >> 6) & 0x3F);
+    const int flag = move >> 12;
+
+    const Piece moved = piece_at(from);
+    if (moved == NO_PIECE) return NO_MOVE;
+
+    const Piece captured = flag == MOVE_ENPASSANT_FLAG ? make_piece(PAWN, opposite(game_info.side_to_move)) : piece_at(to);
+
+    return MOVE(from, to, moved, captured, flag);
+}
+
+// Same hash updates as make_move, but nothing on the board changes
+Key Position::key_after (Move move) const {
+    const int flag = FLAG(move);
+    const Square to = Square(TO(move));
+    const Square from = Square(FROM(move));
+
+    const Piece moved_piece = Piece(MOVED(move));
+    const Piece captured = Piece(CAPTURED(move));
+    const Color us = game_info.side_to_move;
+
+    Key key = hash ^ zobrist.white_to_move ^ zobrist.pieces[moved_piece][from];
+
+    switch (flag) {
+        case MOVE_CASTLING_FLAG: {
+            const Square rook_from = (to == G1 || to == G8) ? Square(to + 1) : Square(to - 2);
+            const Square rook_to = (to == G1 || to == G8) ? Square(to - 1) : Square(to + 1);
+            const Piece rook = make_piece(ROOK, us);
+
+            key ^= zobrist.pieces[rook][rook_from] ^ zobrist.pieces[rook][rook_to] ^ zobrist.pieces[moved_piece][to];
+            break;
+        }
+
+        case MOVE_ENPASSANT_FLAG:
+            key ^= zobrist.pieces[captured][to + (us == WHITE ? -8 : 8)] ^ zobrist.pieces[moved_piece][to];
+            break;
+
+        case MOVE_NPROMO_FLAG:
+        case MOVE_BPROMO_FLAG:
+        case MOVE_RPROMO_FLAG:
+        case MOVE_QPROMO_FLAG: {
+            static const PieceType promo_pieces[] = {
+                KNIGHT, BISHOP, ROOK, QUEEN
+            };
+
+            if (captured != NO_PIECE) key ^= zobrist.pieces[captured][to];
+            key ^= zobrist.pieces[make_piece(promo_pieces[flag - MOVE_NPROMO_FLAG], us)][to];
+            break;
+        }
+
+        default:
+            if (captured != NO_PIECE) key ^= zobrist.pieces[captured][to];
+            key ^= zobrist.pieces[moved_piece][to];
+            break;
+    }
+
+    // en croissant
+    if (game_info.ep_square != NO_SQUARE) key ^= zobrist.en_passant[game_info.ep_square];
+    if (flag == MOVE_DOUBLE_PUSH_FLAG) key ^= zobrist.en_passant[to + (us == WHITE ? -8 : 8)];
+
+    // castling rights
+    CastlingRights castling = game_info.castling;
+
+    if (castling_mask[from] && type_of(moved_piece) == ROOK) castling &= ~castling_mask[from];
+    if (castling_mask[to] && captured != NO_PIECE && type_of(captured) == ROOK) castling &= ~castling_mask[to];
+    if (type_of(moved_piece) == KING) castling &= us == WHITE ? ~(WKS_RIGHT | WQS_RIGHT) : ~(BKS_RIGHT | BQS_RIGHT);
+
+    return key ^ zobrist.castling[game_info.castling] ^ zobrist.castling[castling];
 }
 
 void Position::null_move() {
-    move_stack.push_back(NO_MOVE);
-    undo_stack.push_back(PACK_GI(game_info.rule_50_clock, game_info.ep_square, game_info.castling));
+    history.push_back(NO_MOVE, PACK_GI(game_info.rule_50_clock, game_info.ep_square, game_info.castling));
 
     if (game_info.ep_square != NO_SQUARE) {
 
@@ -371,9 +633,12 @@ void Position::null_move() {
 
 // Assumes that the move is legal, or else it does some funky stuff to the position
 // This includes: Pawns on back rank, messed up en passant square, 
-void Position::make_move(Move move) {
+template <Color Us>
+void Position::make_move (Move move) {
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
 
-    
+    // Behind the pawn that just moved, for en passant
+    constexpr int DOWN = Us == WHITE ? -8 : 8;
 
     const int flag = FLAG(move);
     const Square to = Square(TO(move));
@@ -381,13 +646,10 @@ void Position::make_move(Move move) {
     
     const Piece moved_piece = Piece(MOVED(move));
     const Piece captured = Piece(CAPTURED(move));
-    const Color us = game_info.side_to_move;
-    const Color them = opposite(us);
     
     // store in stacks
     
-    move_stack.push_back(move);
-    undo_stack.push_back(PACK_GI(game_info.rule_50_clock, game_info.ep_square, game_info.castling));
+    history.push_back(move, PACK_GI(game_info.rule_50_clock, game_info.ep_square, game_info.castling));
     
     
 
@@ -397,10 +659,10 @@ void Position::make_move(Move move) {
     switch (flag) {
         case MOVE_CASTLING_FLAG: {
             
-            const Square rook_from = (to == G1 || to == G8) ? 
+            const Square rook_from = to == (Us == WHITE ? G1 : G8) ? 
                 Square(to + 1) :  // H file rook
                 Square(to - 2);   // A file rook
-            const Square rook_to = (to == G1 || to == G8) ? 
+            const Square rook_to = to == (Us == WHITE ? G1 : G8) ? 
                 Square(to - 1) :  // F file
                 Square(to + 1);   // D file
             
@@ -416,20 +678,14 @@ void Position::make_move(Move move) {
             // this is the way!!!
             
             // update castling rights
-            if (us == WHITE) {
-                hash ^= zobrist.castling[game_info.castling];
-                game_info.castling &= ~(WKS_RIGHT | WQS_RIGHT);
-                hash ^= zobrist.castling[game_info.castling];
-            } else {
-                hash ^= zobrist.castling[game_info.castling];
-                game_info.castling &= ~(BKS_RIGHT | BQS_RIGHT);
-                hash ^= zobrist.castling[game_info.castling];
-            }
+            hash ^= zobrist.castling[game_info.castling];
+            game_info.castling &= Us == WHITE ? ~(WKS_RIGHT | WQS_RIGHT) : ~(BKS_RIGHT | BQS_RIGHT);
+            hash ^= zobrist.castling[game_info.castling];
             break;
         }
         
         case MOVE_ENPASSANT_FLAG: {
-            const Square ep_capture_sq = Square(to + (us == WHITE ? -8 : 8));
+            const Square ep_capture_sq = Square(to + DOWN);
             clear_square(ep_capture_sq);
             set_square(to, moved_piece);
             break;
@@ -440,7 +696,7 @@ void Position::make_move(Move move) {
             if (game_info.ep_square != NO_SQUARE)
                 hash ^= zobrist.en_passant[game_info.ep_square];
 
-            game_info.ep_square = Square(to + (us == WHITE ? -8 : 8));
+            game_info.ep_square = Square(to + DOWN);
 
             if (game_info.ep_square != NO_SQUARE)
                 hash ^= zobrist.en_passant[game_info.ep_square];
@@ -457,7 +713,7 @@ void Position::make_move(Move move) {
                 KNIGHT, BISHOP, ROOK, QUEEN
             };
             const PieceType promo_type = promo_pieces[flag - MOVE_NPROMO_FLAG];
-            const Piece promoted_piece = make_piece(promo_type, us);
+            const Piece promoted_piece = make_piece(promo_type, Us);
             
             if (captured != NO_PIECE) {
                 clear_square(to);
@@ -478,18 +734,6 @@ void Position::make_move(Move move) {
     }
     
     
-    static const uint8_t castling_mask[64] = {
-    
-        WQS_RIGHT, 0, 0, 0, 0, 0, 0, WKS_RIGHT,    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        0, 0, 0, 0, 0, 0, 0, 0,                    
-        BQS_RIGHT, 0, 0, 0, 0, 0, 0, BKS_RIGHT     
-    };
-    
     if (castling_mask[from] && type_of(moved_piece) == ROOK) {
         hash ^= zobrist.castling[game_info.castling];
         game_info.castling &= ~castling_mask[from];
@@ -504,7 +748,7 @@ void Position::make_move(Move move) {
     // king moved
     if (type_of(moved_piece) == KING) {
         hash ^= zobrist.castling[game_info.castling];
-        const uint8_t king_mask = us == WHITE ? (WKS_RIGHT | WQS_RIGHT) : (BKS_RIGHT | BQS_RIGHT);
+        constexpr uint8_t king_mask = Us == WHITE ? (WKS_RIGHT | WQS_RIGHT) : (BKS_RIGHT | BQS_RIGHT);
         game_info.castling &= ~king_mask;
         hash ^= zobrist.castling[game_info.castling];
     }
@@ -527,21 +771,22 @@ void Position::make_move(Move move) {
     }
     
     
-    game_info.side_to_move = them;
+    game_info.side_to_move = Them;
     hash ^= zobrist.white_to_move;
 }
 
 
+template <Color Us>
 void Position::undo_move () {
-    
-    game_info.side_to_move = opposite(game_info.side_to_move);
-    hash ^= zobrist.white_to_move;
+    constexpr Color Them = Us == WHITE ? BLACK : WHITE;
 
-    Move move = move_stack.pop();
+    game_info.side_to_move = Us;
+    hash ^= zobrist.white_to_move;
 
-    
+    Undo undo = history.pop();
 
-    uint32_t prev_gi = undo_stack.pop();
+    Move move = undo.move;
+    uint32_t prev_gi = undo.info;
 
     hash ^= zobrist.castling[game_info.castling];
     game_info.castling = CASTLING(prev_gi);
@@ -569,8 +814,6 @@ void Position::undo_move () {
     
     const Piece moved_piece = Piece(MOVED(move));  
     const Piece captured_piece = Piece(CAPTURED(move));
-    const Color us = game_info.side_to_move;  
-    const Color them = opposite(us);
 
 
     
@@ -578,10 +821,10 @@ void Position::undo_move () {
     switch (flag) {
         case MOVE_CASTLING_FLAG: {
             
-            const Square rook_from = (to == G1 || to == G8) ? 
+            const Square rook_from = to == (Us == WHITE ? G1 : G8) ? 
                 Square(to + 1) :  
                 Square(to - 2);  
-            const Square rook_to = (to == G1 || to == G8) ? 
+            const Square rook_to = to == (Us == WHITE ? G1 : G8) ? 
                 Square(to - 1) :  
                 Square(to + 1);   
             
@@ -606,8 +849,8 @@ void Position::undo_move () {
             set_square(from, moved_piece);
             
             // restore captured
-            const Square ep_capture_sq = Square(to + (us == WHITE ? -8 : 8));
-            const Piece captured_pawn = make_piece(PAWN, them);
+            const Square ep_capture_sq = Square(to + (Us == WHITE ? -8 : 8));
+            const Piece captured_pawn = make_piece(PAWN, Them);
             set_square(ep_capture_sq, captured_pawn);
 
             
@@ -659,4 +902,16 @@ void Position::undo_move () {
     }
     
 
-}
\ No newline at end of file
+}
+
+// The side to move is looked at once, the rest is specialised on it
+void Position::make_move (Move move) {
+    if (game_info.side_to_move == WHITE) make_move<WHITE>(move);
+    else make_move<BLACK>(move);
+}
+
+// The side that made the last move is the one not to move now
+void Position::undo_move () {
+    if (game_info.side_to_move == WHITE) undo_move<BLACK>();
+    else undo_move<WHITE>();
+}
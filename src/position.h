@@ -12,6 +12,7 @@
 #include "type.h"
 #include "constants.h"
 #include "move.h"
+#include "nnue.h"
 
 // BitFish uses 12 unsigned long long bitboards, one per piece, and a mailbox for piece lookups
 // Extra bitboards for faster Move Generation
@@ -31,35 +32,29 @@ struct GameInfo {
     uint8_t rule_50_clock;
 };
 
-// A stack for GameInfos packed into a 32 bit integer
-struct UndoStack {
-    std::array<PackedGI, 256> list;
-    int size = 0;
+// What undo_move needs to take a move back, the GameInfo is packed into a 32 bit integer
+struct Undo {
+    Move move;
+    PackedGI info;
+};
 
-    inline void push_back (PackedGI info) {
-        list[size++] = info;
-    }
+// Only the line being searched lives here, game moves are cleared as they are played
+// so it never has to be deeper than the search goes
+struct History {
+    std::array<Undo, MAX_PLY> list;
+    int size = 0;
 
-    inline Move pop () {
-        size --;
-        return list[size];
+    inline void push_back (Move move, PackedGI info) {
+        list[size++] = {move, info};
     }
 
-    inline Move peek () {
-        return list[size - 1];
+    inline Undo pop () {
+        return list[--size];
     }
 
     inline void clear () {
         size = 0;
     }
-
-    inline Move operator[](int index) const {
-        return list[index];
-    }
-    
-    inline Move& operator[](int index) {
-        return list[index];
-    }
 };
 
 struct Position {
@@ -69,12 +64,24 @@ struct Position {
     GameInfo game_info;
 
     // Move History
-    MoveList move_stack;
-    UndoStack undo_stack;
+    History history;
     
     // Hash Brown
     uint64_t hash;
 
+    // Only the pawns, for the pawn structure table
+    Key pawn_hash;
+
+    // Only the piece counts, for the material table
+    Key material_hash;
+
+    // Material and piece square score plus the game phase, kept up to date by set_square and clear_square
+    Score psq;
+    int phase;
+
+    // NNUE first layer, only kept up to date while a network is loaded
+    NNUE::Accumulator accumulator;
+
     // Constructors, parses FEN, or else sets the starting position
     Position() {
         set_start_pos();
@@ -90,27 +97,58 @@ struct Position {
 
     // For printing the position
     std::string to_string() const;
+    std::string to_fen() const;
 
     // Editting functions
     void update_occupancies();
     void set_square(Square square, Piece piece);
     void clear_square (Square square);
     void clear_pos();
+    void refresh_accumulator();
 
     void set_start_pos();
     void parse_fen(const std::string_view fen = STARTING_POS_FEN);
     
+    Bitboard attackers_to (Square square, Bitboard occupancy) const;
     bool is_square_attacked (Square square, Color color) const;
     bool is_in_check (Color color) const;
     bool can_cap_king () const;
+
+    // The caller makes sure the king isn't in check, movegen already knows
     bool can_castle_ks () const;
     bool can_castle_qs () const;
 
+    // Same, for a side known at compile time
+    template <Color Us> bool can_castle_ks () const;
+    template <Color Us> bool can_castle_qs () const;
+
+    // Legality test for a pseudo legal move without making it, movegen only needs it for en passant
+    bool is_legal (Move move) const;
+
+    // For moves that weren't generated from this position, like table moves and killers
+    // Everything in the move has to match the board, moved and captured pieces included
+    bool is_pseudo_legal (Move move) const;
+
+    // Rebuilds a full move from a transposition table move, it still needs to be checked for legality
+    Move move_from16 (uint16_t move) const;
+
     
 
+    // The hash the position would have after the move, for prefetching
+    Key key_after (Move move) const;
+
+    // Moves made since the position was set up, which is the ply once a search starts from it
+    inline int ply () const {
+        return history.size;
+    }
+
     void make_move (Move move);
     void undo_move ();
 
+    // Specialised on the side that moves, make_move and undo_move pick one
+    template <Color Us> void make_move (Move move);
+    template <Color Us> void undo_move ();
+
     void null_move ();
 };
 
@@ -0,0 +1,127 @@
+/**
+ * selfplay.cpp
+ *
+ * Engine against engine games implementation
+ */
+
+#include "selfplay.h"
+#include "material.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace SelfPlay {
+
+    void play (Position& pos, Move move, std::vector<Key>& history) {
+        pos.make_move(move);
+        pos.history.clear();
+
+        // Nothing before a capture or pawn move can repeat
+        if (pos.game_info.rule_50_clock == 0) history.clear();
+        history.push_back(pos.hash);
+    }
+
+    bool is_threefold (const Position& pos, const std::vector<Key>& history) {
+        return std::count(history.begin(), history.end(), pos.hash) >= 3;
+    }
+
+    bool is_over (const Position& pos, const std::vector<Key>& history, uint8_t& result) {
+        Color us = pos.game_info.side_to_move;
+
+        if (MoveGen::generate_moves(pos).size == 0) {
+            result = !pos.is_in_check(us) ? RESULT_DRAW : us == WHITE ? RESULT_BLACK_WIN : RESULT_WHITE_WIN;
+            return true;
+        }
+
+        // Only asked once a move, so the entry is computed without a table
+        Material::MaterialEntry material;
+        Material::compute(pos, material);
+
+        if (pos.game_info.rule_50_clock >= 100 || is_threefold(pos, history) || material.dead_draw) {
+            result = RESULT_DRAW;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool random_opening (Position& pos, std::vector<Key>& history, int plies, std::mt19937_64& rng) {
+        pos.parse_fen(STARTING_POS_FEN);
+        history.assign(1, pos.hash);
+
+        for (int ply = 0; ply < plies; ply++) {
+            MoveList legal = MoveGen::generate_moves(pos);
+            if (legal.size == 0) return false;
+
+            play(pos, legal[rng() % legal.size], history);
+        }
+
+        return MoveGen::generate_moves(pos).size > 0;
+    }
+
+    std::mt19937_64 worker_rng (int id) {
+        std::random_device device;
+        return std::mt19937_64 (device() ^ (uint64_t(id) << 32) ^ steady_clock::now().time_since_epoch().count());
+    }
+
+    void run_workers (int threads, const std::function<void (int)>& worker, const std::function<void ()>& report) {
+        std::atomic<int> running {threads};
+        std::vector<std::thread> pool;
+
+        for (int i = 0; i < threads; i++) {
+            pool.emplace_back([&worker, &running, i] () {
+                worker(i);
+                running--;
+            });
+        }
+
+        // Progress every ten seconds until the workers are done
+        auto last_report = steady_clock::now();
+
+        while (running > 0) {
+            std::this_thread::sleep_for(milliseconds(100));
+
+            auto now = steady_clock::now();
+            if (now - last_report < seconds(10) || running == 0) continue;
+
+            last_report = now;
+            report();
+        }
+
+        for (std::thread& thread: pool) {
+            thread.join();
+        }
+    }
+
+    uint8_t play_game (BitFish::SearchContext& white, BitFish::SearchContext& black,
+                       const Position& start, std::vector<Key> history, const Limits& limits) {
+        Position pos = start;
+        uint8_t result = RESULT_DRAW;
+
+        for (int ply = 0; ply < MAX_GAME_PLIES; ply++) {
+            if (is_over(pos, history, result)) return result;
+
+            Color us = pos.game_info.side_to_move;
+            BitFish::SearchContext& engine = us == WHITE ? white : black;
+
+            engine.current_pos = pos;
+            BitFish::SearchResult search = engine.go(limits.depth, limits.move_time, limits.nodes);
+
+            // Mates and known won endings are not played out
+            if (std::abs(search.eval) >= KNOWN_WIN) {
+                return (search.eval > 0) == (us == WHITE) ? RESULT_WHITE_WIN : RESULT_BLACK_WIN;
+            }
+
+            MoveList legal = MoveGen::generate_moves(pos);
+            Move move = search.best_move;
+
+            if (std::find(legal.begin(), legal.end(), move) == legal.end()) move = legal[0];
+
+            play(pos, move, history);
+        }
+
+        return RESULT_DRAW;
+    }
+}
@@ -0,0 +1,51 @@
+/**
+ * selfplay.h
+ *
+ * Engine against engine games inside one process, shared by datagen and the tuners
+ * Games are played on a plain Position with the search contexts only asked for moves,
+ * so any number of games can run side by side
+ */
+
+#pragma once
+
+#include "bitfish.h"
+#include "packed.h"
+
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace SelfPlay {
+
+    // Games that reach this many plies are called a draw
+    constexpr int MAX_GAME_PLIES = 400;
+
+    struct Limits {
+        int depth = MAX_DEPTH;
+        int move_time = 0;
+        uint64_t nodes = 0;
+    };
+
+    // Game moves are never undone, so the stacks are emptied and a long game can't overflow them
+    // history holds the keys since the last capture or pawn move, for repetitions
+    void play (Position& pos, Move move, std::vector<Key>& history);
+
+    bool is_threefold (const Position& pos, const std::vector<Key>& history);
+
+    // Game over by the rules or with a dead draw on the board, the result is from white's point of view
+    bool is_over (const Position& pos, const std::vector<Key>& history, uint8_t& result);
+
+    // Plays random legal moves from the starting position, false if the game ended on the way
+    bool random_opening (Position& pos, std::vector<Key>& history, int plies, std::mt19937_64& rng);
+
+    // A fresh seed for every worker and every run, so workers and resumed runs don't replay the same openings
+    std::mt19937_64 worker_rng (int id);
+
+    // Runs worker(id) for every id below threads, and calls report every ten seconds until they have all returned
+    void run_workers (int threads, const std::function<void (int)>& worker, const std::function<void ()>& report);
+
+    // One game from the given position, with a score of KNOWN_WIN or more taken as the end
+    // Both contexts keep their own tables and params, the result is from white's point of view
+    uint8_t play_game (BitFish::SearchContext& white, BitFish::SearchContext& black,
+                       const Position& start, std::vector<Key> history, const Limits& limits);
+}
@@ -0,0 +1,189 @@
+/**
+ * spsa.cpp
+ *
+ * SPSA tuner implementation
+ */
+
+#include "spsa.h"
+#include "selfplay.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+using namespace std::chrono;
+
+namespace Spsa {
+
+    namespace {
+
+        constexpr size_t TUNABLE_COUNT = BitFish::TUNABLES.size();
+
+        struct Shared {
+            const Options& options;
+
+            // Current values, kept as reals so small steps add up
+            std::array<double, TUNABLE_COUNT> theta;
+            std::mutex theta_mutex;
+
+            std::atomic<uint64_t> next_step {0};
+            std::atomic<uint64_t> pairs_done {0};
+
+            // Games won, drawn and lost by the plus side
+            std::atomic<uint64_t> wins {0}, draws {0}, losses {0};
+
+            Shared (const Options& opts) : options(opts) {}
+        };
+
+        // The values an engine plays with, rounded and kept in range
+        BitFish::SearchParams to_params (const std::array<double, TUNABLE_COUNT>& values) {
+            BitFish::SearchParams params;
+
+            for (size_t i = 0; i < TUNABLE_COUNT; i++) {
+                const BitFish::Tunable& tunable = BitFish::TUNABLES[i];
+                params.*tunable.value = std::clamp(int(std::lround(values[i])), tunable.min, tunable.max);
+            }
+
+            return params;
+        }
+
+        std::string describe (const std::array<double, TUNABLE_COUNT>& values) {
+            std::ostringstream out;
+            out.precision(1);
+            out << std::fixed;
+
+            for (size_t i = 0; i < TUNABLE_COUNT; i++) {
+                out << " " << BitFish::TUNABLES[i].name << " " << values[i];
+            }
+
+            return out.str();
+        }
+
+        void worker (Shared& shared, int id) {
+            const Options& options = shared.options;
+
+            SelfPlay::Limits limits;
+            limits.move_time = options.move_time;
+            limits.nodes = options.nodes > 0 ? options.nodes : options.move_time > 0 ? 0 : DEFAULT_NODES;
+
+            HashTable plus_table (options.hash_mb), minus_table (options.hash_mb);
+            BitFish::SearchContext plus (plus_table, 1), minus (minus_table, 1);
+            plus.uci_output = minus.uci_output = false;
+
+            std::mt19937_64 rng = SelfPlay::worker_rng(id);
+
+            double n = double(options.pairs);
+            double big_a = 0.1 * n;
+
+            Position pos;
+            std::vector<Key> history;
+
+            while (true) {
+                uint64_t step = shared.next_step.fetch_add(1) + 1;
+                if (step > options.pairs) break;
+
+                while (!SelfPlay::random_opening(pos, history, options.random_plies, rng));
+
+                // Perturbation sizes shrink slowly to c_end, step sizes faster to R_END * c_end^2
+                double c_scale = std::pow(n / step, GAMMA);
+                double a_scale = std::pow((big_a + n) / (big_a + step), ALPHA);
+
+                std::array<double, TUNABLE_COUNT> theta, plus_values, minus_values, c;
+                std::array<int, TUNABLE_COUNT> delta;
+
+                {
+                    std::lock_guard<std::mutex> lock (shared.theta_mutex);
+                    theta = shared.theta;
+                }
+
+                for (size_t i = 0; i < TUNABLE_COUNT; i++) {
+                    delta[i] = rng() & 1 ? 1 : -1;
+                    c[i] = BitFish::TUNABLES[i].c_end * c_scale;
+
+                    plus_values[i] = theta[i] + c[i] * delta[i];
+                    minus_values[i] = theta[i] - c[i] * delta[i];
+                }
+
+                plus.params = to_params(plus_values);
+                minus.params = to_params(minus_values);
+
+                // Both colours from the same opening, so the opening itself cancels out
+                int result = 0;
+
+                for (int game = 0; game < 2; game++) {
+                    plus_table.clear();
+                    minus_table.clear();
+                    plus.reset_killers();
+                    minus.reset_killers();
+
+                    bool plus_white = game == 0;
+
+                    uint8_t outcome = plus_white ? SelfPlay::play_game(plus, minus, pos, history, limits)
+                                                 : SelfPlay::play_game(minus, plus, pos, history, limits);
+
+                    int score = (int(outcome) - RESULT_DRAW) * (plus_white ? 1 : -1);
+                    result += score;
+
+                    (score > 0 ? shared.wins : score < 0 ? shared.losses : shared.draws)++;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock (shared.theta_mutex);
+
+                    for (size_t i = 0; i < TUNABLE_COUNT; i++) {
+                        const BitFish::Tunable& tunable = BitFish::TUNABLES[i];
+
+                        // a_k / c_k^2 * c_k * result * delta, with a_k = R_END * c_end^2 * a_scale
+                        double a = R_END * tunable.c_end * tunable.c_end * a_scale;
+                        shared.theta[i] += a / c[i] * result * delta[i];
+                        shared.theta[i] = std::clamp(shared.theta[i], double(tunable.min), double(tunable.max));
+                    }
+                }
+
+                shared.pairs_done++;
+            }
+        }
+    }
+
+    void run (const Options& options) {
+        Shared shared (options);
+
+        for (size_t i = 0; i < TUNABLE_COUNT; i++) {
+            shared.theta[i] = BitFish::engine.params.*BitFish::TUNABLES[i].value;
+        }
+
+        std::cout << "info string spsa start" << describe(shared.theta) << std::endl;
+
+        auto start = steady_clock::now();
+
+        auto report = [&shared, start] () {
+            uint64_t elapsed = std::max<uint64_t>(duration_cast<milliseconds>(steady_clock::now() - start).count(), 1);
+
+            std::array<double, TUNABLE_COUNT> theta;
+            {
+                std::lock_guard<std::mutex> lock (shared.theta_mutex);
+                theta = shared.theta;
+            }
+
+            std::cout << "info string spsa pairs " << shared.pairs_done << "/" << shared.options.pairs
+                      << " games/hour " << shared.pairs_done * 2 * 3600000 / elapsed
+                      << " plus +" << shared.wins << " =" << shared.draws << " -" << shared.losses
+                      << describe(theta) << std::endl;
+        };
+
+        SelfPlay::run_workers(options.threads, [&shared] (int id) { worker(shared, id); }, report);
+        report();
+
+        BitFish::engine.params = to_params(shared.theta);
+
+        std::cout << "info string spsa done" << describe(shared.theta) << std::endl;
+
+        for (const BitFish::Tunable& tunable: BitFish::TUNABLES) {
+            std::cout << "info string spsa result " << tunable.name << " " << BitFish::engine.params.*tunable.value << std::endl;
+        }
+    }
+}
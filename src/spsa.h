@@ -0,0 +1,44 @@
+/**
+ * spsa.h
+ *
+ * SPSA tuner for the search parameters
+ * Every step nudges all tunables at once by a random +-c, plays a game pair between the two
+ * perturbed engines and moves the values towards whichever side won. Workers run steps side by side,
+ * each with its own pair of engines, and share only the current values.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+namespace Spsa {
+
+    constexpr uint64_t DEFAULT_PAIRS = 20000;
+    constexpr uint64_t DEFAULT_NODES = 5000;
+    constexpr int DEFAULT_RANDOM_PLIES = 8;
+    constexpr int DEFAULT_HASH = 4;
+
+    // Gain schedule, the usual exponents, and the step size at the end relative to c_end squared
+    constexpr double ALPHA = 0.602;
+    constexpr double GAMMA = 0.101;
+    constexpr double R_END = 0.002;
+
+    struct Options {
+        // One SPSA step per game pair
+        uint64_t pairs = DEFAULT_PAIRS;
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+
+        // Per move, with neither set the node limit is used
+        uint64_t nodes = 0;
+        int move_time = 0;
+
+        int random_plies = DEFAULT_RANDOM_PLIES;
+        int hash_mb = DEFAULT_HASH;
+    };
+
+    // Starts from the engine's current values and leaves the tuned ones in it
+    // Usage: spsa [pairs N] [threads N] [nodes N] [movetime MS] [random N] [hash MB]
+    void run (const Options& options);
+}
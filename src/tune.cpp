@@ -0,0 +1,700 @@
+/**
+ * tune.cpp
+ *
+ * Texel tuner implementation
+ * The trace below walks the same terms as classical_evaluate, loading checks the two agree
+ */
+
+#include "tune.h"
+#include "bitfish.h"
+#include "bitboards.h"
+#include "datafile.h"
+#include "material.h"
+#include "nnue.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std::chrono;
+
+namespace Tune {
+
+    namespace {
+
+        // Scores are turned into win probabilities with this many centipawns per unit of the logistic, like the trainer
+        constexpr double CP_SCALE = 400.0;
+
+        constexpr double ADAM_BETA1 = 0.9;
+        constexpr double ADAM_BETA2 = 0.999;
+        constexpr double ADAM_EPSILON = 1e-8;
+
+        // Allowed difference between the traced and the real evaluation, integer rounding in the engine
+        constexpr double TRACE_TOLERANCE = 4.0;
+
+        // Where each group of weights starts, piece square tables are indexed by white's square
+        enum Param : int {
+            MATERIAL = 0,
+            PAWN_MG = MATERIAL + 5,
+            PAWN_EG = PAWN_MG + BOARD_SIZE,
+            KNIGHT_PSQ = PAWN_EG + BOARD_SIZE,
+            BISHOP_PSQ = KNIGHT_PSQ + BOARD_SIZE,
+            ROOK_PSQ = BISHOP_PSQ + BOARD_SIZE,
+            QUEEN_PSQ = ROOK_PSQ + BOARD_SIZE,
+            KING_MG = QUEEN_PSQ + BOARD_SIZE,
+            KING_EG = KING_MG + BOARD_SIZE,
+            PASSED = KING_EG + BOARD_SIZE,
+            ISOLATED = PASSED + 8,
+            DOUBLED,
+            BACKWARD,
+            BISHOP_PAIR,
+            KNIGHT_PAWN,
+            ROOK_PAWN,
+            MOBILITY,
+            KINGSIDE_CASTLING = MOBILITY + 4,
+            QUEENSIDE_CASTLING,
+            BISHOP_BLOCKED,
+            PARAM_COUNT
+        };
+
+        // How much of a weight goes into the middlegame and the endgame score
+        // Terms added after tapering count fully in both, which tapers to the same thing
+        struct Taper {
+            double mg;
+            double eg;
+        };
+
+        const std::array<Taper, PARAM_COUNT> tapers = [] {
+            std::array<Taper, PARAM_COUNT> table;
+
+            for (int param = 0; param < PARAM_COUNT; param++) {
+                bool mg_only = (param >= PAWN_MG && param < PAWN_EG) || (param >= KING_MG && param < KING_EG);
+                bool eg_only = (param >= PAWN_EG && param < KNIGHT_PSQ) || (param >= KING_EG && param < PASSED);
+
+                // Passed pawns get half their bonus in the middlegame
+                bool passed = param >= PASSED && param < ISOLATED;
+
+                table[param] = mg_only ? Taper{1, 0} : eg_only ? Taper{0, 1} : passed ? Taper{0.5, 1} : Taper{1, 1};
+            }
+
+            return table;
+        }();
+
+        std::vector<double> initial_weights () {
+            std::vector<double> weights (PARAM_COUNT);
+
+            for (int pt = PAWN; pt <= QUEEN; pt++) {
+                weights[MATERIAL + pt] = material[pt];
+            }
+
+            for (int square = 0; square < BOARD_SIZE; square++) {
+                weights[PAWN_MG + square] = EvalTables::pawn_table_mg[square];
+                weights[PAWN_EG + square] = EvalTables::pawn_table_eg[square];
+                weights[KNIGHT_PSQ + square] = EvalTables::knight_table[square];
+                weights[BISHOP_PSQ + square] = EvalTables::bishop_table[square];
+                weights[ROOK_PSQ + square] = EvalTables::rook_table[square];
+                weights[QUEEN_PSQ + square] = EvalTables::queen_table[square];
+                weights[KING_MG + square] = EvalTables::king_table_mg[square];
+                weights[KING_EG + square] = EvalTables::king_table_eg[square];
+            }
+
+            for (int rank = 0; rank < 8; rank++) {
+                weights[PASSED + rank] = passed_pawn_bonuses[rank];
+            }
+
+            weights[ISOLATED] = ISOLATED_PAWN_PENALTY;
+            weights[DOUBLED] = DOUBLED_PAWN_PENALTY;
+            weights[BACKWARD] = BACKWARD_PAWN_PENALTY;
+            weights[BISHOP_PAIR] = BISHOP_PAIR_BONUS;
+            weights[KNIGHT_PAWN] = KNIGHT_PAWN_ADJUSTMENT;
+            weights[ROOK_PAWN] = ROOK_PAWN_ADJUSTMENT;
+            weights[MOBILITY + 0] = KNIGHT_MOB_BONUS;
+            weights[MOBILITY + 1] = BISHOP_MOB_BONUS;
+            weights[MOBILITY + 2] = ROOK_MOB_BONUS;
+            weights[MOBILITY + 3] = QUEEN_MOB_BONUS;
+            weights[KINGSIDE_CASTLING] = KINGSIDE_CASTLING_BONUS;
+            weights[QUEENSIDE_CASTLING] = QUEENSIDE_CASTLING_BONUS;
+            weights[BISHOP_BLOCKED] = BISHOP_BLOCKED_PENALTY;
+
+            return weights;
+        }
+
+        // One weight and how many times white uses it minus black
+        struct Entry {
+            uint16_t param;
+            int16_t count;
+        };
+
+        struct Sample {
+            uint64_t first;
+            uint16_t size;
+            uint8_t phase;
+
+            // Scale factor when white or black is the side ahead
+            uint8_t factor[COLOR_NUM];
+
+            float target;
+        };
+
+        struct Data {
+            std::vector<Sample> samples;
+            std::vector<Entry> entries;
+        };
+
+        // Counts how often each weight is added for white minus for black, term by term like classical_evaluate
+        void trace (const Position& pos, int phase, std::array<int, PARAM_COUNT>& counts) {
+            counts.fill(0);
+
+            static constexpr int psq_start[KING + 1] = {PAWN_MG, KNIGHT_PSQ, BISHOP_PSQ, ROOK_PSQ, QUEEN_PSQ, KING_MG};
+
+            Bitboard occupancy = pos.board.occupancy;
+
+            for (Bitboard pieces = occupancy; pieces; pieces &= pieces - 1) {
+                Square square = Square(__builtin_ctzll(pieces));
+                Piece piece = pos.piece_at(square);
+                PieceType pt = type_of(piece);
+                Color color = color_of(piece);
+
+                int sign = color == WHITE ? 1 : -1;
+
+                // Black reads the piece square tables rotated by 180 degrees
+                int psq_square = color == WHITE ? square : 63 - square;
+
+                if (pt != KING) counts[int(MATERIAL) + pt] += sign;
+
+                counts[psq_start[pt] + psq_square] += sign;
+
+                // Pawns and kings have a separate endgame table right after the middlegame one
+                if (pt == PAWN || pt == KING) counts[psq_start[pt] + BOARD_SIZE + psq_square] += sign;
+
+                // Mobility
+                Bitboard attacks = pt == KNIGHT ? Bitboards::get_knight_attacks(square)
+                                 : pt == BISHOP ? Bitboards::get_bishop_attacks(square, occupancy)
+                                 : pt == ROOK ? Bitboards::get_rook_attacks(square, occupancy)
+                                 : pt == QUEEN ? Bitboards::get_rook_attacks(square, occupancy) | Bitboards::get_bishop_attacks(square, occupancy)
+                                 : 0ULL;
+
+                if (pt >= KNIGHT && pt <= QUEEN) counts[int(MOBILITY) + pt - KNIGHT] += sign * __builtin_popcountll(attacks);
+            }
+
+            for (Color us: {WHITE, BLACK}) {
+                Color them = opposite(us);
+                int sign = us == WHITE ? 1 : -1;
+
+                auto n = [&](PieceType pt) { return __builtin_popcountll(pos.get_bitboard(make_piece(pt, us))); };
+
+                // Imbalance
+                if (n(BISHOP) >= 2) counts[BISHOP_PAIR] += sign;
+                counts[KNIGHT_PAWN] += sign * n(KNIGHT) * (n(PAWN) - 5);
+                counts[ROOK_PAWN] -= sign * n(ROOK) * (n(PAWN) - 5);
+
+                // Pawn structure
+                Bitboard our_pawns = pos.get_bitboard(make_piece(PAWN, us));
+                Bitboard their_pawns = pos.get_bitboard(make_piece(PAWN, them));
+
+                for (Bitboard pawns = our_pawns; pawns; pawns &= pawns - 1) {
+                    Square square = Square(__builtin_ctzll(pawns));
+                    int file = square & 7;
+                    int relative_rank = us == WHITE ? square >> 3 : 7 - (square >> 3);
+
+                    Bitboard adjacent = 0ULL;
+                    if (file > 0) adjacent |= Bitboards::file_a << (file - 1);
+                    if (file < 7) adjacent |= Bitboards::file_a << (file + 1);
+
+                    Bitboard in_front = Bitboards::get_passed_pawn_mask(square, us);
+
+                    if (!(adjacent & our_pawns)) counts[ISOLATED] -= sign;
+                    if (in_front & (Bitboards::file_a << file) & our_pawns) counts[DOUBLED] -= sign;
+
+                    if (!(in_front & their_pawns)) {
+                        counts[PASSED + relative_rank] += sign;
+                    } else {
+                        Square stop = Square(us == WHITE ? square + 8 : square - 8);
+
+                        if (!(adjacent & ~in_front & our_pawns) && (Bitboards::get_pawn_attacks(stop, us) & their_pawns)) {
+                            counts[BACKWARD] -= sign;
+                        }
+                    }
+                }
+            }
+
+            CastlingRights castling = pos.game_info.castling;
+            counts[KINGSIDE_CASTLING] += bool(castling & WKS_RIGHT) - bool(castling & BKS_RIGHT);
+            counts[QUEENSIDE_CASTLING] += bool(castling & WQS_RIGHT) - bool(castling & BQS_RIGHT);
+
+            if (2 * phase > MAX_GAME_PHASE) {
+                counts[BISHOP_BLOCKED] -= (pos.piece_at(E3) == W_BISHOP && pos.piece_at(E2) == W_PAWN)
+                                        + (pos.piece_at(D3) == W_BISHOP && pos.piece_at(D2) == W_PAWN);
+                counts[BISHOP_BLOCKED] += (pos.piece_at(E6) == B_BISHOP && pos.piece_at(E7) == B_PAWN)
+                                        + (pos.piece_at(D6) == B_BISHOP && pos.piece_at(D7) == B_PAWN);
+            }
+        }
+
+        // The weights split into their middlegame and endgame parts, so an evaluation is two dot products
+        struct Split {
+            std::vector<double> mg;
+            std::vector<double> eg;
+
+            Split (const std::vector<double>& weights) : mg(PARAM_COUNT), eg(PARAM_COUNT) {
+                for (int param = 0; param < PARAM_COUNT; param++) {
+                    mg[param] = weights[param] * tapers[param].mg;
+                    eg[param] = weights[param] * tapers[param].eg;
+                }
+            }
+        };
+
+        // White's evaluation before scaling
+        inline double linear_eval (const Sample& sample, const Entry* entries, const Split& split) {
+            double mg = 0.0, eg = 0.0;
+
+            for (int i = 0; i < sample.size; i++) {
+                mg += entries[i].count * split.mg[entries[i].param];
+                eg += entries[i].count * split.eg[entries[i].param];
+            }
+
+            return (mg * sample.phase + eg * (MAX_GAME_PHASE - sample.phase)) / MAX_GAME_PHASE;
+        }
+
+        inline double scale_of (const Sample& sample, double eval) {
+            return double(sample.factor[eval > 0 ? WHITE : BLACK]) / SCALE_NORMAL;
+        }
+
+        inline double sigmoid (double x) {
+            return 1.0 / (1.0 + std::exp(-x));
+        }
+
+        template <typename F>
+        void parallel_for (size_t count, int threads, F&& fn) {
+            std::vector<std::thread> pool;
+
+            for (int t = 0; t < threads; t++) {
+                size_t begin = count * t / threads;
+                size_t end = count * (t + 1) / threads;
+
+                pool.emplace_back([&fn, t, begin, end] { fn(t, begin, end); });
+            }
+
+            for (std::thread& thread: pool) {
+                thread.join();
+            }
+        }
+
+        // Mean squared error of the predicted win probability, and its gradient when one is passed in
+        double pass (const Data& data, const std::vector<double>& weights, double k, std::vector<double>* gradient, int threads) {
+            Split split (weights);
+
+            std::vector<double> losses (threads, 0.0);
+            std::vector<std::vector<double>> mg_grads (threads), eg_grads (threads);
+
+            parallel_for(data.samples.size(), threads, [&](int t, size_t begin, size_t end) {
+                std::vector<double> mg_grad (gradient ? PARAM_COUNT : 0, 0.0);
+                std::vector<double> eg_grad (gradient ? PARAM_COUNT : 0, 0.0);
+                double loss = 0.0;
+
+                for (size_t i = begin; i < end; i++) {
+                    const Sample& sample = data.samples[i];
+                    const Entry* entries = data.entries.data() + sample.first;
+
+                    double eval = linear_eval(sample, entries, split);
+                    double scale = scale_of(sample, eval);
+                    double prediction = sigmoid(k * eval * scale / CP_SCALE);
+                    double error = prediction - sample.target;
+
+                    loss += error * error;
+
+                    if (!gradient) continue;
+
+                    // d loss / d eval, then spread over the two halves of the taper
+                    double d_eval = 2.0 * error * prediction * (1.0 - prediction) * k * scale / CP_SCALE;
+                    double d_mg = d_eval * sample.phase / MAX_GAME_PHASE;
+                    double d_eg = d_eval * (MAX_GAME_PHASE - sample.phase) / MAX_GAME_PHASE;
+
+                    for (int j = 0; j < sample.size; j++) {
+                        mg_grad[entries[j].param] += entries[j].count * d_mg;
+                        eg_grad[entries[j].param] += entries[j].count * d_eg;
+                    }
+                }
+
+                losses[t] = loss;
+                mg_grads[t] = std::move(mg_grad);
+                eg_grads[t] = std::move(eg_grad);
+            });
+
+            double n = std::max<size_t>(data.samples.size(), 1);
+
+            if (gradient) {
+                gradient->assign(PARAM_COUNT, 0.0);
+
+                for (int t = 0; t < threads; t++) {
+                    for (int param = 0; param < PARAM_COUNT; param++) {
+                        (*gradient)[param] += (mg_grads[t][param] * tapers[param].mg + eg_grads[t][param] * tapers[param].eg) / n;
+                    }
+                }
+            }
+
+            double loss = 0.0;
+            for (double l: losses) loss += l;
+
+            return loss / n;
+        }
+
+        // The logistic scale that fits the current weights best, golden section search
+        double fit_k (const Data& data, const std::vector<double>& weights, int threads) {
+            const double ratio = (std::sqrt(5.0) - 1.0) / 2.0;
+
+            double low = 0.05, high = 4.0;
+            double a = high - ratio * (high - low), b = low + ratio * (high - low);
+            double loss_a = pass(data, weights, a, nullptr, threads);
+            double loss_b = pass(data, weights, b, nullptr, threads);
+
+            for (int i = 0; i < 25; i++) {
+                if (loss_a < loss_b) {
+                    high = b;
+                    b = a;
+                    loss_b = loss_a;
+                    a = high - ratio * (high - low);
+                    loss_a = pass(data, weights, a, nullptr, threads);
+                } else {
+                    low = a;
+                    a = b;
+                    loss_a = loss_b;
+                    b = low + ratio * (high - low);
+                    loss_b = pass(data, weights, b, nullptr, threads);
+                }
+            }
+
+            return (low + high) / 2;
+        }
+
+        // "fen result" in the usual spellings: 1-0, 0-1, 1/2-1/2, [1.0], [0.5], [0.0], c9 "1-0";
+        bool parse_epd (const std::string& line, std::string& fen, float& result) {
+            std::istringstream iss (line);
+            std::string fields[4];
+
+            for (std::string& field: fields) {
+                if (!(iss >> field)) return false;
+            }
+
+            fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+
+            std::string rest;
+            std::getline(iss, rest);
+
+            // Move counters are optional in EPD
+            std::istringstream counters (rest);
+            std::string clock, move_number;
+
+            auto numeric = [](const std::string& s) {
+                return !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isdigit(c); });
+            };
+
+            if (counters >> clock >> move_number && numeric(clock) && numeric(move_number)) fen += " " + clock + " " + move_number;
+            else fen += " 0 1";
+
+            if (rest.find("1/2-1/2") != std::string::npos || rest.find("0.5") != std::string::npos) result = 0.5f;
+            else if (rest.find("1-0") != std::string::npos || rest.find("1.0") != std::string::npos) result = 1.0f;
+            else if (rest.find("0-1") != std::string::npos || rest.find("0.0") != std::string::npos) result = 0.0f;
+            else return false;
+
+            return true;
+        }
+
+        struct Raw {
+            std::vector<PackedPosition> packed;
+
+            // EPD positions with their result from white's point of view
+            std::vector<std::pair<std::string, float>> lines;
+        };
+
+        void read_input (const std::string& file, Raw& raw) {
+            std::ifstream in (file, std::ios::binary);
+
+            if (!in) {
+                std::cout << "info string cannot read " << file << std::endl;
+                return;
+            }
+
+            uint32_t magic = 0;
+            in.read((char*) &magic, sizeof(magic));
+
+            if (magic == DataFile::FILE_MAGIC) {
+                DataFile::Reader reader (file);
+                PackedPosition packed;
+                Key hash;
+
+                while (reader.next(packed, hash)) {
+                    raw.packed.push_back(packed);
+                }
+
+                return;
+            }
+
+            std::string extension = std::filesystem::path(file).extension().string();
+
+            if (extension == ".epd" || extension == ".txt") {
+                in.clear();
+                in.seekg(0);
+
+                std::string line, fen;
+                float result;
+                uint64_t bad = 0;
+
+                while (std::getline(in, line)) {
+                    if (parse_epd(line, fen, result)) raw.lines.emplace_back(fen, result);
+                    else if (!line.empty()) bad++;
+                }
+
+                if (bad) std::cout << "info string " << bad << " lines without a result in " << file << std::endl;
+                return;
+            }
+
+            // Otherwise a flat file of packed records, like the shuffle writes
+            in.seekg(0, std::ios::end);
+            size_t count = size_t(in.tellg()) / sizeof(PackedPosition);
+            size_t old_size = raw.packed.size();
+
+            raw.packed.resize(old_size + count);
+            in.seekg(0);
+            in.read((char*) (raw.packed.data() + old_size), count * sizeof(PackedPosition));
+        }
+
+        struct LoadStats {
+            uint64_t skipped = 0;
+            uint64_t mismatched = 0;
+            double max_difference = 0.0;
+        };
+
+        // Traces every usable position, each thread into its own Data, which are joined afterwards
+        Data load (const Raw& raw, double wdl, int threads) {
+            const std::vector<double> weights = initial_weights();
+            const Split split (weights);
+
+            std::vector<Data> parts (threads);
+            std::vector<LoadStats> stats (threads);
+
+            size_t total = raw.packed.size() + raw.lines.size();
+
+            parallel_for(total, threads, [&](int t, size_t begin, size_t end) {
+                Data& data = parts[t];
+                LoadStats& stat = stats[t];
+
+                Position pos;
+                std::array<int, PARAM_COUNT> counts;
+
+                Pawns::PawnTable pawn_table;
+                Material::MaterialTable material_table;
+
+                for (size_t i = begin; i < end; i++) {
+                    float target;
+
+                    try {
+                        if (i < raw.packed.size()) {
+                            const PackedPosition& packed = raw.packed[i];
+                            DataFile::unpack(packed, pos);
+
+                            double result = packed.result / 2.0;
+                            target = float(wdl * result + (1.0 - wdl) * sigmoid(packed.score / CP_SCALE));
+                        } else {
+                            const auto& [fen, result] = raw.lines[i - raw.packed.size()];
+                            pos.parse_fen(fen);
+                            target = result;
+                        }
+                    } catch (const std::exception& e) {
+                        stat.skipped++;
+                        continue;
+                    }
+
+                    // Only positions the classical evaluation itself would score
+                    Material::MaterialEntry* entry = Material::probe(pos, material_table);
+
+                    if (pos.is_in_check(pos.game_info.side_to_move) || pos.game_info.rule_50_clock >= 100
+                        || entry->eval_fn || entry->dead_draw) {
+                        stat.skipped++;
+                        continue;
+                    }
+
+                    trace(pos, entry->phase, counts);
+
+                    Sample sample {data.entries.size(), 0, uint8_t(entry->phase),
+                                   {uint8_t(entry->scale_factor(pos, WHITE)), uint8_t(entry->scale_factor(pos, BLACK))}, target};
+
+                    for (int param = 0; param < PARAM_COUNT; param++) {
+                        if (counts[param]) data.entries.push_back({uint16_t(param), int16_t(counts[param])});
+                    }
+
+                    sample.size = uint16_t(data.entries.size() - sample.first);
+                    data.samples.push_back(sample);
+
+                    // The trace is only worth tuning if it is the evaluation
+                    if (!NNUE::active) {
+                        double eval = linear_eval(sample, data.entries.data() + sample.first, split);
+                        eval *= scale_of(sample, eval);
+
+                        int real = BitFish::evaluate(pos, pawn_table, material_table) * (pos.game_info.side_to_move == WHITE ? 1 : -1);
+
+                        if (std::abs(real) < MAX_CP) {
+                            double difference = std::abs(eval - real);
+
+                            stat.max_difference = std::max(stat.max_difference, difference);
+                            stat.mismatched += difference > TRACE_TOLERANCE;
+                        }
+                    }
+                }
+            });
+
+            Data data;
+            LoadStats total_stats;
+
+            for (int t = 0; t < threads; t++) {
+                uint64_t offset = data.entries.size();
+
+                for (Sample& sample: parts[t].samples) {
+                    sample.first += offset;
+                }
+
+                data.samples.insert(data.samples.end(), parts[t].samples.begin(), parts[t].samples.end());
+                data.entries.insert(data.entries.end(), parts[t].entries.begin(), parts[t].entries.end());
+
+                total_stats.skipped += stats[t].skipped;
+                total_stats.mismatched += stats[t].mismatched;
+                total_stats.max_difference = std::max(total_stats.max_difference, stats[t].max_difference);
+
+                parts[t] = Data{};
+            }
+
+            std::cout << "info string tune loaded " << data.samples.size() << " positions, skipped " << total_stats.skipped
+                      << ", " << data.entries.size() / std::max<size_t>(data.samples.size(), 1) << " weights per position" << std::endl;
+
+            if (total_stats.mismatched) {
+                std::cout << "info string tune trace differs from evaluate in " << total_stats.mismatched
+                          << " positions, by up to " << total_stats.max_difference << " cp" << std::endl;
+            }
+
+            return data;
+        }
+
+        void write_table (std::ostream& out, const char* name, const std::vector<double>& weights, int first) {
+            out << "    constexpr std::array<int, BOARD_SIZE> " << name << " = {\n";
+
+            for (int rank = 0; rank < 8; rank++) {
+                out << "       ";
+
+                for (int file = 0; file < 8; file++) {
+                    int square = rank * 8 + file;
+                    out << std::setw(5) << std::lround(weights[first + square]) << (square < BOARD_SIZE - 1 ? "," : "");
+                }
+
+                out << "\n";
+            }
+
+            out << "    };\n\n";
+        }
+
+        // The tuned weights as the definitions they replace in constants.h
+        void write_source (const std::string& file, const std::vector<double>& weights, size_t positions, double loss) {
+            std::ofstream out (file, std::ios::trunc);
+
+            auto w = [&](int param) { return std::lround(weights[param]); };
+
+            out << "// Tuned on " << positions << " positions, loss " << loss << "\n";
+            out << "// Paste over the matching definitions in constants.h\n\n";
+
+            out << "constexpr std::array<int, PIECE_NUM + 1> material = {\n    ";
+            for (int pt = PAWN; pt <= QUEEN; pt++) out << w(MATERIAL + pt) << ", ";
+            out << "0, ";
+            for (int pt = PAWN; pt <= QUEEN; pt++) out << -w(MATERIAL + pt) << ", ";
+            out << "0, 0\n};\n\n";
+
+            out << "constexpr int KINGSIDE_CASTLING_BONUS = " << w(KINGSIDE_CASTLING) << ";\n";
+            out << "constexpr int QUEENSIDE_CASTLING_BONUS = " << w(QUEENSIDE_CASTLING) << ";\n\n";
+            out << "constexpr int BISHOP_BLOCKED_PENALTY = " << w(BISHOP_BLOCKED) << ";\n\n";
+
+            out << "constexpr int KNIGHT_MOB_BONUS = " << w(MOBILITY + 0) << ";\n";
+            out << "constexpr int BISHOP_MOB_BONUS = " << w(MOBILITY + 1) << ";\n";
+            out << "constexpr int ROOK_MOB_BONUS = " << w(MOBILITY + 2) << ";\n";
+            out << "constexpr int QUEEN_MOB_BONUS = " << w(MOBILITY + 3) << ";\n\n";
+
+            out << "constexpr int BISHOP_PAIR_BONUS = " << w(BISHOP_PAIR) << ";\n\n";
+
+            out << "constexpr std::array<int, 8> passed_pawn_bonuses = {\n    ";
+            for (int rank = 0; rank < 8; rank++) out << w(PASSED + rank) << (rank < 7 ? ", " : "\n");
+            out << "};\n\n";
+
+            out << "constexpr int ISOLATED_PAWN_PENALTY = " << w(ISOLATED) << ";\n";
+            out << "constexpr int DOUBLED_PAWN_PENALTY = " << w(DOUBLED) << ";\n";
+            out << "constexpr int BACKWARD_PAWN_PENALTY = " << w(BACKWARD) << ";\n\n";
+
+            out << "constexpr int KNIGHT_PAWN_ADJUSTMENT = " << w(KNIGHT_PAWN) << ";\n";
+            out << "constexpr int ROOK_PAWN_ADJUSTMENT = " << w(ROOK_PAWN) << ";\n\n";
+
+            out << "namespace EvalTables {\n";
+            write_table(out, "pawn_table_mg", weights, PAWN_MG);
+            write_table(out, "pawn_table_eg", weights, PAWN_EG);
+            write_table(out, "knight_table", weights, KNIGHT_PSQ);
+            write_table(out, "bishop_table", weights, BISHOP_PSQ);
+            write_table(out, "rook_table", weights, ROOK_PSQ);
+            write_table(out, "queen_table", weights, QUEEN_PSQ);
+            write_table(out, "king_table_mg", weights, KING_MG);
+            write_table(out, "king_table_eg", weights, KING_EG);
+            out << "}\n";
+        }
+    }
+
+    void run (const Options& options) {
+        auto start = steady_clock::now();
+
+        Raw raw;
+        for (const std::string& file: options.inputs) {
+            read_input(file, raw);
+        }
+
+        Data data = load(raw, options.wdl, options.threads);
+        raw = Raw{};
+
+        if (data.samples.empty()) {
+            std::cout << "info string tune has no positions" << std::endl;
+            return;
+        }
+
+        std::vector<double> weights = initial_weights();
+
+        double k = fit_k(data, weights, options.threads);
+        double loss = pass(data, weights, k, nullptr, options.threads);
+
+        std::cout << "info string tune K " << k << " loss " << loss << " setup "
+                  << duration_cast<milliseconds>(steady_clock::now() - start).count() << " ms" << std::endl;
+
+        std::vector<double> gradient, m (PARAM_COUNT, 0.0), v (PARAM_COUNT, 0.0);
+        auto epochs_start = steady_clock::now();
+
+        for (int epoch = 1; epoch <= options.epochs; epoch++) {
+            loss = pass(data, weights, k, &gradient, options.threads);
+
+            double correction1 = 1.0 - std::pow(ADAM_BETA1, epoch);
+            double correction2 = 1.0 - std::pow(ADAM_BETA2, epoch);
+
+            for (int param = 0; param < PARAM_COUNT; param++) {
+                m[param] = ADAM_BETA1 * m[param] + (1.0 - ADAM_BETA1) * gradient[param];
+                v[param] = ADAM_BETA2 * v[param] + (1.0 - ADAM_BETA2) * gradient[param] * gradient[param];
+
+                weights[param] -= options.lr * (m[param] / correction1) / (std::sqrt(v[param] / correction2) + ADAM_EPSILON);
+            }
+
+            if (epoch % REPORT_INTERVAL == 0 || epoch == options.epochs) {
+                uint64_t elapsed = std::max<uint64_t>(duration_cast<milliseconds>(steady_clock::now() - epochs_start).count(), 1);
+
+                std::cout << "info string tune epoch " << epoch << " loss " << loss
+                          << " positions/s " << uint64_t(data.samples.size() * epoch * 1000.0 / elapsed) << std::endl;
+
+                write_source(options.output, weights, data.samples.size(), loss);
+            }
+        }
+
+        std::cout << "info string tune wrote " << options.output << std::endl;
+    }
+}
@@ -0,0 +1,44 @@
+/**
+ * tune.h
+ *
+ * Texel tuner interface
+ * Every classical evaluation term is linear in its weight, so each position is traced once into
+ * a short list of (weight, count) pairs and the evaluation becomes a dot product with the weight vector.
+ * Epochs then never touch a board again, and the full-batch gradient is split across threads.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Tune {
+
+    constexpr int DEFAULT_EPOCHS = 500;
+    constexpr double DEFAULT_LR = 1.0;
+
+    // Epochs between progress reports, the output file is rewritten at every report
+    constexpr int REPORT_INTERVAL = 50;
+
+    struct Options {
+        // Flat PackedPosition files, datagen containers (.bfd) or EPD lines with a result (.epd, .txt)
+        std::vector<std::string> inputs;
+        std::string output = "tuned.h";
+
+        int epochs = DEFAULT_EPOCHS;
+
+        // Adam step size, roughly centipawns per epoch
+        double lr = DEFAULT_LR;
+
+        // Weight of the game result in the target, the rest is the search score, EPD lines only have a result
+        double wdl = 1.0;
+
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    // Usage: tune <input>... [output F] [epochs N] [lr X] [wdl X] [threads N]
+    void run (const Options& options);
+}
@@ -20,6 +20,10 @@ using Move = uint32_t;
 using Key = uint64_t;
 using PackedGI = uint32_t;
 
+// Middlegame and endgame score in one integer, the endgame half is the upper 16 bits
+// Adding and subtracting works on both halves at once
+using Score = int32_t;
+
 
 
 
@@ -74,41 +78,110 @@ enum HTFlag {
     AT_MOST
 };
 
+// 8 bytes so a whole bucket fits in one cache line
+// The move is stored in 16 bits (from, to, flag) and rebuilt from the position on probe
 struct HTEntry {
-    Key hash;
-    int depth;
-    int score;
-    HTFlag flag;
-    Move best_move;
+    uint16_t key;
+    uint16_t move;
+    int16_t score;
+    uint8_t depth;
+
+    // generation << 2 | flag
+    uint8_t gen_flag;
+
+    inline HTFlag flag () const {
+        return HTFlag(gen_flag & 3);
+    }
+
+    inline uint8_t generation () const {
+        return gen_flag >> 2;
+    }
+};
+
+constexpr int HT_BUCKET_SIZE = 8;
+
+struct alignas(64) HTBucket {
+    HTEntry entries[HT_BUCKET_SIZE];
 };
 
+static_assert(sizeof(HTBucket) == 64, "A bucket should be exactly one cache line");
+
 struct SearchInfo {
     int depth = 0;
-    uint64_t nodes = 0;
+
+    // Atomic so other threads can sum it while this thread is searching
+    std::atomic<uint64_t> nodes {0};
 
     steady_clock::time_point start_time;
     int max_time_ms = 0;
 
+    // Summed over every thread of the search, 0 means no limit
+    uint64_t max_nodes = 0;
+
     std::atomic<bool> stop {false};
 
     void reset ();
 
+    // Only the owning thread writes the count, so a relaxed load and store will do instead of a locked add
+    inline void add_node () {
+        nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
 };
 
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
 class HashTable {
-    std::vector <HTEntry> table;
+    // 2MB aligned so the kernel can back it with huge pages
+    HTBucket* table = nullptr;
+    size_t bucket_count = 0;
+
+    // Bumped every search, entries from older searches are replaced first
+    uint8_t generation = 0;
 
     public: 
         HashTable (size_t mb = 64);
-        void clear();
+        ~HashTable ();
+
+        HashTable (const HashTable&) = delete;
+        HashTable& operator= (const HashTable&) = delete;
+
+        // Reallocates and clears, anything stored is lost
+        void resize (size_t mb, int threads = 1);
+
+        // Splits the table between threads, each zeroes its own slice
+        void clear(int threads = 1);
+        void new_search();
         HTEntry* probe (Key hash);
-        void store (Key hash, int depth, int score, HTFlag flag, Move best_move);
+
+        // Starts loading the bucket into cache, so the probe after make_move doesn't wait on memory
+        inline void prefetch (Key hash) {
+            __builtin_prefetch(&bucket(hash));
+        }
+
+        void store (Key hash, int depth, int score, HTFlag flag, uint16_t best_move);
     private:
-        size_t index (Key hash) const;
+        // Multiply shift instead of a modulo, maps the hash onto [0, size) with one multiplication
+        inline HTBucket& bucket (Key hash) {
+            return table[(static_cast<unsigned __int128>(hash) * bucket_count) >> 64];
+        }
 };
 
 
 
+constexpr Score make_score (int mg, int eg) {
+    return static_cast<Score>(static_cast<uint32_t>(eg) << 16) + mg;
+}
+
+inline int mg_value (Score score) {
+    return static_cast<int16_t>(static_cast<uint16_t>(static_cast<uint32_t>(score)));
+}
+
+// The + 0x8000 undoes the borrow a negative middlegame half takes from the endgame half
+inline int eg_value (Score score) {
+    return static_cast<int16_t>(static_cast<uint16_t>((static_cast<uint32_t>(score) + 0x8000) >> 16));
+}
+
 inline std::string square_to_str (Square square) {
     char file = 'a' + (square & 7);
     char rank = '1' + (square >> 3);
@@ -9,6 +9,14 @@
 #include "bitfish.h"
 #include "movegen.h"
 #include "constants.h"
+#include "bench.h"
+#include "perft.h"
+#include "datagen.h"
+#include "datafile.h"
+#include "tune.h"
+#include "spsa.h"
+#include "match.h"
+#include "nnue.h"
 
 #include <sstream>
 #include <string>
@@ -33,12 +41,26 @@ namespace {
         throw std::invalid_argument("Cannot parse string " + str);
     }
     
+    // Game moves are never undone, so a long game can't fill up the stacks the search needs
+    void play_move (Position& pos, const std::string& str) {
+        pos.make_move(parse_move(pos, str));
+        pos.history.clear();
+    }
+
     void cleanup_search_thread() {
         if (search_thread.joinable()) {
             search_thread.join();
         }
         is_searching = false;
     }
+
+    // Ends a running search and waits for its thread, for every command that can't run alongside one
+    void stop_search() {
+        if (is_searching) {
+            BitFish::engine.stop();
+        }
+        cleanup_search_thread();
+    }
 }
 
 void UCI::info_depth (int depth, int eval, uint64_t nodes, uint64_t elapsed, const std::vector<Move>& pv) {
@@ -73,6 +95,15 @@ void UCI::info_string (const std::string& message) {
 void UCI::uci () {
     std::cout << "id name BitFish " << VERSION << std::endl;
     std::cout << "id author GoobusTheNoobus" << std::endl;
+    std::cout << "option name Hash type spin default " << DEFAULT_HASH_MB << " min 1 max " << MAX_HASH_MB << std::endl;
+    std::cout << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << std::endl;
+    std::cout << "option name EvalFile type string default <empty>" << std::endl;
+
+    for (const BitFish::Tunable& tunable: BitFish::TUNABLES) {
+        std::cout << "option name " << tunable.name << " type spin default " << BitFish::SearchParams{}.*tunable.value
+                  << " min " << tunable.min << " max " << tunable.max << std::endl;
+    }
+
     std::cout << "uciok" << std::endl << std::flush;
 }
 
@@ -84,8 +115,8 @@ void UCI::ucinewgame () {
     // Wait for any ongoing search to finish
     cleanup_search_thread();
     
-    BitFish::tt.clear();
-    BitFish::reset_killers();
+    BitFish::tt.clear(BitFish::engine.threads.size());
+    BitFish::engine.reset_killers();
 }
 
 void UCI::parse_position (const std::string& command) {
@@ -100,13 +131,13 @@ void UCI::parse_position (const std::string& command) {
     iss >> token;
 
     if (token == "startpos") {
-        BitFish::position(STARTING_POS_FEN);
+        BitFish::engine.position(STARTING_POS_FEN);
 
         iss >> token;
 
         if (token == "moves") {
             while (iss >> token) {
-                BitFish::current_pos.make_move(parse_move(BitFish::current_pos, token));
+                play_move(BitFish::engine.current_pos, token);
             }
         } 
     } else if (token == "fen") {
@@ -117,32 +148,83 @@ void UCI::parse_position (const std::string& command) {
         }
 
         try {
-            BitFish::position(fen);
+            BitFish::engine.position(fen);
         } catch (std::exception e) {
             info_string("Error parsing fen");
         }
 
         if (token == "moves") {
             while (iss >> token) {
-                BitFish::current_pos.make_move(parse_move(BitFish::current_pos, token));
+                play_move(BitFish::engine.current_pos, token);
+            }
+        }
+    }
+}
+
+void UCI::parse_setoption (const std::string& command) {
+    // Options can't change under a running search
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+    std::string name;
+    std::string value;
+
+    // setoption name <name> value <value>
+    iss >> token >> token;
+
+    while ((iss >> token) && token != "value") {
+        name += (name.empty() ? "" : " ") + token;
+    }
+
+    // The rest of the line, file names can have spaces
+    std::getline(iss >> std::ws, value);
+    value.erase(value.find_last_not_of(" \t\r") + 1);
+
+    try {
+        if (name == "Hash") {
+            BitFish::tt.resize(std::clamp(std::stoi(value), 1, MAX_HASH_MB), BitFish::engine.threads.size());
+        } else if (name == "Threads") {
+            BitFish::engine.set_threads(std::clamp(std::stoi(value), 1, MAX_THREADS));
+        } else if (name == "EvalFile") {
+            if (!NNUE::load(value)) {
+                info_string("cannot load network " + value + ", keeping the " + (NNUE::active ? "old network" : "classical evaluation"));
+            } else if (NNUE::active) {
+                info_string("loaded network " + value + " using " + NNUE::simd_name() + " kernels");
+            } else {
+                info_string("using the classical evaluation");
+            }
+
+            // The accumulator only follows the board while a network is loaded
+            BitFish::engine.current_pos.refresh_accumulator();
+        } else {
+            auto tunable = std::find_if(BitFish::TUNABLES.begin(), BitFish::TUNABLES.end(), [&](const BitFish::Tunable& t) {
+                return name == t.name;
+            });
+
+            if (tunable != BitFish::TUNABLES.end()) {
+                BitFish::engine.params.*tunable->value = std::clamp(std::stoi(value), tunable->min, tunable->max);
+            } else {
+                info_string("unknown option " + name);
             }
         }
+    } catch (const std::bad_alloc& e) {
+        info_string("not enough memory for " + value + " MB, keeping the old table");
+    } catch (const std::exception& e) {
+        info_string("invalid value " + value + " for option " + name);
     }
 }
 
 void UCI::parse_go(const std::string& command) {
     // Stop any ongoing search first
-    if (is_searching) {
-        BitFish::stop();
-        
-    }
-    cleanup_search_thread();
+    stop_search();
     
     std::istringstream iss (command);
     std::string token;
 
     int depth = MAX_DEPTH;
     int movetime = 0;
+    uint64_t nodes = 0;
 
     int wtime = 0;
     int btime = 0;
@@ -154,10 +236,19 @@ void UCI::parse_go(const std::string& command) {
     iss >> token;
 
     while (iss >> token) {
-        if (token == "depth") {
+        if (token == "perft") {
+            int perft_depth = 1;
+            iss >> perft_depth;
+
+            // perft runs right here, there is nothing to stop
+            Perft::go_perft(BitFish::engine.current_pos, perft_depth);
+            return;
+        } else if (token == "depth") {
             iss >> depth;
         } else if (token == "movetime") {
             iss >> movetime;
+        } else if (token == "nodes") {
+            iss >> nodes;
         } else if (token == "wtime") {
             iss >> wtime;
         } else if (token == "btime") {
@@ -174,85 +265,365 @@ void UCI::parse_go(const std::string& command) {
     if (movetime > 0) {
         time_limit = movetime;
     } else if (wtime > 0 || btime > 0) {
-        
-        int our_time = (BitFish::current_pos.game_info.side_to_move == WHITE) ? wtime + winc  : btime + binc ;
-        
-        // use 1/40 of remaining time
-        if (our_time > 100) {
-            time_limit = std::min(our_time - 100, our_time / 40);
-            time_limit = std::max(100, time_limit);  
-        }
+        bool white = BitFish::engine.current_pos.game_info.side_to_move == WHITE;
+
+        time_limit = BitFish::time_for_move(white ? wtime : btime, white ? winc : binc);
     }
 
     // Launch search in separate thread
     is_searching = true;
-    BitFish::search_info.stop.store(false, std::memory_order_relaxed);
+    BitFish::engine.search_info.stop.store(false, std::memory_order_relaxed);
     
-    search_thread = std::thread([depth, time_limit]() {
-        BitFish::go(depth, time_limit);
+    search_thread = std::thread([depth, time_limit, nodes]() {
+        BitFish::engine.go(depth, time_limit, nodes);
         is_searching = false;
     });
 }
 
 void UCI::stop() {
-    if (is_searching) {
-        BitFish::stop();
-        cleanup_search_thread();
-    }
+    stop_search();
 }
 
 void UCI::d () {
-    std::cout << BitFish::current_pos.to_string() << "\n" << std::flush;
+    std::cout << BitFish::engine.current_pos.to_string() << "\n" << std::flush;
 }
 
 void UCI::eval () {
-    std::cout << BitFish::current_pos.to_string() << "\n";
-    std::cout << "Current evaluation: " << BitFish::evaluate(BitFish::current_pos) << std::flush;
+    Pawns::PawnTable pawn_table;
+    Material::MaterialTable material_table;
+
+    std::cout << BitFish::engine.current_pos.to_string() << "\n";
+    std::cout << "Current evaluation: " << BitFish::evaluate(BitFish::engine.current_pos, pawn_table, material_table) << std::flush;
 }
 
-void UCI::loop () {
-    while (true) {
-        std::string string;
-        std::getline(std::cin, string);
-
-        if (std::all_of(string.begin(), string.end(), [](unsigned char c) {
-            return std::isspace(c);
-        })) continue;
-
-        std::istringstream iss (string);
-
-        
-
-        std::string command;
-
-        iss >> command;
-
-        if (command == "go") {
-            parse_go (string);
-        } else if (command == "stop") {
-            stop();
-        } else if (command == "position") {
-            parse_position(string);
-        } else if (command == "uci") {
-            uci ();
-        } else if (command == "isready") {
-            isready();
-        } else if (command == "ucinewgame") {
-            ucinewgame();
-        } else if (command == "d") {
-            d();
-        } else if (command == "eval") {
-            eval();
-        } else if (command == "quit") {
-            // Clean up before exiting
-            if (is_searching) {
-                stop();
+void UCI::bench (const std::string& command) {
+    // The bench searches synchronously, so nothing else can be running
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    int depth = Bench::DEFAULT_DEPTH;
+    int hash = Bench::DEFAULT_HASH;
+    int threads = Bench::DEFAULT_THREADS;
+
+    // skip bench
+    iss >> token;
+
+    // A failed read would zero the value, so each one only replaces its default when it parses
+    int value;
+
+    if (iss >> value) {
+        depth = std::clamp(value, 1, MAX_DEPTH);
+
+        if (iss >> value) {
+            hash = std::clamp(value, 1, MAX_HASH_MB);
+
+            if (iss >> value) threads = std::clamp(value, 1, MAX_THREADS);
+        }
+    }
+
+    Bench::run(depth, hash, threads);
+}
+
+void UCI::divide (const std::string& command) {
+    // Would make and undo moves on the position the search copies
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    int depth = 1;
+
+    // skip divide
+    iss >> token;
+    iss >> depth;
+
+    Perft::divide(BitFish::engine.current_pos, depth);
+}
+
+void UCI::perftsuite (const std::string& command) {
+    // Would compete with the search for every core
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+    std::string file;
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // skip perftsuite
+    iss >> token;
+
+    // Without a file the embedded suite is run single threaded, without the table, to time the move generator
+    if (!(iss >> file)) {
+        Perft::run_suite();
+        return;
+    }
+
+    iss >> threads;
+
+    Perft::run_epd(file, std::max(1, threads));
+}
+
+void UCI::datagen (const std::string& command) {
+    // Runs right here until the games are done, the engine's own search is not used
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    Datagen::Options options;
+
+    // skip datagen
+    iss >> token;
+
+    try {
+        while (iss >> token) {
+            std::string value;
+            if (!(iss >> value)) break;
+
+            if (token == "file") options.file = value;
+            else if (token == "threads") options.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+            else if (token == "nodes") options.nodes = std::stoull(value);
+            else if (token == "depth") options.depth = std::clamp(std::stoi(value), 1, MAX_DEPTH);
+            else if (token == "games") options.games = std::stoull(value);
+            else if (token == "random") options.random_plies = std::max(0, std::stoi(value));
+            else if (token == "hash") options.hash_mb = std::clamp(std::stoi(value), 1, MAX_HASH_MB);
+            else info_string("unknown datagen option " + token);
+        }
+    } catch (const std::exception& e) {
+        info_string("invalid datagen value after " + token);
+        return;
+    }
+
+    Datagen::run(options);
+}
+
+void UCI::shuffle (const std::string& command) {
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token, output;
+    std::vector<std::string> inputs;
+    size_t memory_mb = DataFile::DEFAULT_SHUFFLE_MB;
+
+    // skip shuffle
+    iss >> token >> output;
+
+    try {
+        while (iss >> token) {
+            if (token != "memory") {
+                inputs.push_back(token);
+                continue;
             }
-            cleanup_search_thread();
-            break;
-        } 
-        else {
-            info_string("invalid command");
+
+            if (!(iss >> token)) break;
+            memory_mb = std::max(1, std::stoi(token));
+        }
+    } catch (const std::exception& e) {
+        info_string("invalid shuffle memory " + token);
+        return;
+    }
+
+    if (output.empty() || inputs.empty()) {
+        info_string("usage: shuffle <output> <input>... [memory MB]");
+        return;
+    }
+
+    DataFile::shuffle(inputs, output, memory_mb);
+}
+
+void UCI::tune (const std::string& command) {
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    Tune::Options options;
+
+    // skip tune
+    iss >> token;
+
+    try {
+        while (iss >> token) {
+            if (token != "output" && token != "epochs" && token != "lr" && token != "wdl" && token != "threads") {
+                options.inputs.push_back(token);
+                continue;
+            }
+
+            std::string value;
+            if (!(iss >> value)) break;
+
+            if (token == "output") options.output = value;
+            else if (token == "epochs") options.epochs = std::max(1, std::stoi(value));
+            else if (token == "lr") options.lr = std::stod(value);
+            else if (token == "wdl") options.wdl = std::clamp(std::stod(value), 0.0, 1.0);
+            else options.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+        }
+    } catch (const std::exception& e) {
+        info_string("invalid tune value after " + token);
+        return;
+    }
+
+    if (options.inputs.empty()) {
+        info_string("usage: tune <input>... [output F] [epochs N] [lr X] [wdl X] [threads N]");
+        return;
+    }
+
+    Tune::run(options);
+}
+
+void UCI::spsa (const std::string& command) {
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    Spsa::Options options;
+
+    // skip spsa
+    iss >> token;
+
+    try {
+        while (iss >> token) {
+            std::string value;
+            if (!(iss >> value)) break;
+
+            if (token == "pairs") options.pairs = std::max<uint64_t>(1, std::stoull(value));
+            else if (token == "threads") options.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+            else if (token == "nodes") options.nodes = std::stoull(value);
+            else if (token == "movetime") options.move_time = std::max(1, std::stoi(value));
+            else if (token == "random") options.random_plies = std::max(0, std::stoi(value));
+            else if (token == "hash") options.hash_mb = std::clamp(std::stoi(value), 1, MAX_HASH_MB);
+            else info_string("unknown spsa option " + token);
         }
+    } catch (const std::exception& e) {
+        info_string("invalid spsa value after " + token);
+        return;
     }
-}
\ No newline at end of file
+
+    Spsa::run(options);
+}
+
+void UCI::match (const std::string& command) {
+    stop_search();
+
+    std::istringstream iss (command);
+    std::string token;
+
+    Match::Options options;
+
+    // skip match
+    iss >> token;
+
+    try {
+        while (iss >> token) {
+            std::string value;
+            if (!(iss >> value)) break;
+
+            if (token == "engine1") options.engines[0] = value;
+            else if (token == "engine2") options.engines[1] = value;
+            else if (token == "games") options.games = std::max<uint64_t>(1, std::stoull(value));
+            else if (token == "concurrency") options.concurrency = std::clamp(std::stoi(value), 1, MAX_THREADS);
+            else if (token == "tc") {
+                // Seconds, base+increment
+                size_t plus = value.find('+');
+                options.base_time = int(std::stod(value.substr(0, plus)) * 1000);
+                options.increment = plus == std::string::npos ? 0 : int(std::stod(value.substr(plus + 1)) * 1000);
+            }
+            else if (token == "movetime") options.move_time = std::max(1, std::stoi(value));
+            else if (token == "nodes") options.nodes = std::stoull(value);
+            else if (token == "openings") options.openings = value;
+            else if (token == "random") options.random_plies = std::max(0, std::stoi(value));
+            else if (token == "hash") options.hash_mb = std::clamp(std::stoi(value), 1, MAX_HASH_MB);
+            else if (token == "sprt") {
+                std::string elo1;
+                if (!(iss >> elo1)) break;
+
+                options.sprt = true;
+                options.elo0 = std::stod(value);
+                options.elo1 = std::stod(elo1);
+            }
+            else if (token == "alpha") options.alpha = std::clamp(std::stod(value), 1e-6, 0.5);
+            else if (token == "beta") options.beta = std::clamp(std::stod(value), 1e-6, 0.5);
+            else info_string("unknown match option " + token);
+        }
+    } catch (const std::exception& e) {
+        info_string("invalid match value after " + token);
+        return;
+    }
+
+    // A bad spec would otherwise only show up inside a worker
+    if (!Match::check_engine(options.engines[0]) || !Match::check_engine(options.engines[1])) return;
+
+    Match::run(options);
+}
+
+bool UCI::execute (const std::string& string) {
+    if (std::all_of(string.begin(), string.end(), [](unsigned char c) {
+        return std::isspace(c);
+    })) return true;
+
+    std::istringstream iss (string);
+
+    std::string command;
+
+    iss >> command;
+
+    if (command == "go") {
+        parse_go (string);
+    } else if (command == "stop") {
+        stop();
+    } else if (command == "position") {
+        parse_position(string);
+    } else if (command == "setoption") {
+        parse_setoption(string);
+    } else if (command == "uci") {
+        uci ();
+    } else if (command == "isready") {
+        isready();
+    } else if (command == "ucinewgame") {
+        ucinewgame();
+    } else if (command == "d") {
+        d();
+    } else if (command == "eval") {
+        eval();
+    } else if (command == "bench") {
+        bench(string);
+    } else if (command == "divide") {
+        divide(string);
+    } else if (command == "perftsuite") {
+        perftsuite(string);
+    } else if (command == "datagen") {
+        datagen(string);
+    } else if (command == "shuffle") {
+        shuffle(string);
+    } else if (command == "tune") {
+        tune(string);
+    } else if (command == "spsa") {
+        spsa(string);
+    } else if (command == "match") {
+        match(string);
+    } else if (command == "quit") {
+        // Clean up before exiting
+        stop_search();
+        return false;
+    } 
+    else {
+        info_string("invalid command");
+    }
+
+    return true;
+}
+
+void UCI::loop () {
+    std::string string;
+
+    // EOF is treated like quit
+    while (std::getline(std::cin, string)) {
+        if (!execute(string)) return;
+    }
+
+    execute("quit");
+}
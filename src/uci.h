@@ -20,6 +20,7 @@ namespace UCI {
     // commands
     void parse_position(const std::string& command);
     void parse_go(const std::string& command);
+    void parse_setoption(const std::string& command);
     void uci();
     void isready();
     void ucinewgame();
@@ -27,7 +28,17 @@ namespace UCI {
     // as a rip off of stockfish, i must include these stockfish exclusive command
     void d(); 
     void eval();
+    void bench(const std::string& command);
+    void divide(const std::string& command);
+    void perftsuite(const std::string& command);
+    void datagen(const std::string& command);
+    void shuffle(const std::string& command);
+    void tune(const std::string& command);
+    void spsa(const std::string& command);
+    void match(const std::string& command);
 
+    // runs a single command, returns false on quit
+    bool execute(const std::string& command);
     void loop();
 
     void stop();
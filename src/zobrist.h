@@ -2,26 +2,77 @@
  * zobrist.h
  * 
  * Generates random numbers for zobrist hashing
+ * The keys are made at compile time, with the same generator and seed as std::mt19937_64(6767),
+ * so they are the same numbers the engine always used and every hash and bench count stays put
  */
 
 #pragma once
 
-#include <random>
 #include <array>
 
 #include "type.h"
 #include "constants.h"
 
+// std::mt19937_64 is not constexpr, this is the same engine written so it can be
+class ConstexprMT64 {
+    static constexpr int N = 312;
+    static constexpr int M = 156;
+
+    static constexpr uint64_t UPPER_MASK = 0xFFFFFFFF80000000ULL;
+    static constexpr uint64_t LOWER_MASK = 0x7FFFFFFFULL;
+
+    std::array<uint64_t, N> state {};
+    int index = N;
+
+    constexpr void twist () {
+        for (int i = 0; i < N; i++) {
+            uint64_t x = (state[i] & UPPER_MASK) | (state[(i + 1) % N] & LOWER_MASK);
+            uint64_t y = x >> 1;
+
+            if (x & 1) y ^= 0xB5026F5AA96619E9ULL;
+
+            state[i] = state[(i + M) % N] ^ y;
+        }
+
+        index = 0;
+    }
+
+    public:
+        constexpr explicit ConstexprMT64 (uint64_t seed) {
+            state[0] = seed;
+
+            for (int i = 1; i < N; i++) {
+                state[i] = 6364136223846793005ULL * (state[i - 1] ^ (state[i - 1] >> 62)) + uint64_t(i);
+            }
+        }
+
+        constexpr uint64_t operator() () {
+            if (index >= N) twist();
+
+            uint64_t x = state[index++];
+
+            x ^= (x >> 29) & 0x5555555555555555ULL;
+            x ^= (x << 17) & 0x71D67FFFEDA60000ULL;
+            x ^= (x << 37) & 0xFFF7EEE000000000ULL;
+            x ^= x >> 43;
+
+            return x;
+        }
+};
+
 struct Zobrist {
-    std::array<std::array<Key, BOARD_SIZE>, PIECE_NUM> pieces;
-    std::array<Key, 16> castling;
-    std::array<Key, BOARD_SIZE> en_passant;
+    std::array<std::array<Key, BOARD_SIZE>, PIECE_NUM> pieces {};
+    std::array<Key, 16> castling {};
+    std::array<Key, BOARD_SIZE> en_passant {};
+
+    // Indexed by piece count instead of square, for the material key
+    std::array<std::array<Key, BOARD_SIZE>, PIECE_NUM> material {};
     
-    Key white_to_move;
+    Key white_to_move = 0;
     
-    Zobrist () {
+    constexpr Zobrist () {
         // Sorry its not funny ik
-        std::mt19937_64 rng(6767);
+        ConstexprMT64 rng (6767);
 
         for (int piece = 0; piece < PIECE_NUM; ++piece) {
             for (int square = 0; square < BOARD_SIZE; ++square) {
@@ -38,8 +89,14 @@ struct Zobrist {
         for (int i = 0; i < BOARD_SIZE; i++) {
             en_passant[i] = rng();
         }
+
+        for (int piece = 0; piece < PIECE_NUM; ++piece) {
+            for (int count = 0; count < BOARD_SIZE; ++count) {
+                material[piece][count] = rng();
+            }
+        }
     }
 
 };
 
-inline Zobrist zobrist;
\ No newline at end of file
+inline constexpr Zobrist zobrist {};
@@ -0,0 +1,203 @@
+/**
+ * magics.cpp
+ *
+ * bitfish-magics, finds the fancy magic numbers for the rook and bishop tables and writes src/magic.h
+ *
+ * Build from the repository root:
+ *   g++ -O2 -std=c++17 tools/magics.cpp -o bitfish-magics
+ *
+ * Usage:
+ *   bitfish-magics [-s seed] [-o src/magic.h]
+ *
+ * Every square gets exactly 2^bits slots for its bits relevant blockers, and the squares are packed
+ * one after another into one shared table, so nothing is wasted on the 4096 slot worst case.
+ * A magic is good when every blocker subset either gets a slot of its own or shares one with a
+ * subset that has the same attacks. Candidates are sparse random numbers, which hit far more often.
+ * The seed is fixed so the same file comes out every time.
+ */
+
+#include "../src/type.h"
+#include "../src/constants.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Magics {
+
+    constexpr uint64_t DEFAULT_SEED = 6767;
+
+    // The edge square of a ray never changes the attacks, so it is left out of the mask
+    Bitboard slider_mask (int square, bool rook) {
+        const int directions[2][4][2] = {
+            {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}},
+            {{1, 0}, {-1, 0}, {0, 1}, {0, -1}}
+        };
+
+        Bitboard mask = 0ULL;
+
+        for (const auto& d: directions[rook]) {
+            int rank = (square >> 3) + d[0];
+            int file = (square & 7) + d[1];
+
+            while (rank + d[0] >= 0 && rank + d[0] <= 7 && file + d[1] >= 0 && file + d[1] <= 7) {
+                mask |= 1ULL << (rank << 3 | file);
+                rank += d[0];
+                file += d[1];
+            }
+        }
+
+        return mask;
+    }
+
+    Bitboard slider_attacks (int square, Bitboard blockers, bool rook) {
+        const int directions[2][4][2] = {
+            {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}},
+            {{1, 0}, {-1, 0}, {0, 1}, {0, -1}}
+        };
+
+        Bitboard attacks = 0ULL;
+
+        for (const auto& d: directions[rook]) {
+            int rank = (square >> 3) + d[0];
+            int file = (square & 7) + d[1];
+
+            while (rank >= 0 && rank <= 7 && file >= 0 && file <= 7) {
+                Bitboard bb = 1ULL << (rank << 3 | file);
+                attacks |= bb;
+
+                if (blockers & bb) break;
+
+                rank += d[0];
+                file += d[1];
+            }
+        }
+
+        return attacks;
+    }
+
+    uint64_t find_magic (int square, bool rook, std::mt19937_64& rng) {
+        Bitboard mask = slider_mask(square, rook);
+        int bits = __builtin_popcountll(mask);
+        int size = 1 << bits;
+
+        // Every blocker subset of the mask, walked with the carry rippler
+        std::vector<Bitboard> blockers, attacks;
+        Bitboard subset = 0ULL;
+
+        do {
+            blockers.push_back(subset);
+            attacks.push_back(slider_attacks(square, subset, rook));
+            subset = (subset - mask) & mask;
+        } while (subset);
+
+        // Slots are tagged with the attempt that filled them, so nothing has to be cleared between attempts
+        std::vector<Bitboard> used (size);
+        std::vector<int> epoch (size, 0);
+
+        for (int attempt = 1; ; attempt++) {
+            uint64_t magic = rng() & rng() & rng();
+
+            // Too few bits in the top byte of the product rarely spreads the subsets out
+            if (__builtin_popcountll((mask * magic) & 0xFF00000000000000ULL) < 6) continue;
+
+            bool good = true;
+
+            for (size_t i = 0; i < blockers.size() && good; i++) {
+                int index = int((blockers[i] * magic) >> (64 - bits));
+
+                if (epoch[index] != attempt) {
+                    epoch[index] = attempt;
+                    used[index] = attacks[i];
+                }
+
+                else if (used[index] != attacks[i]) {
+                    good = false;
+                }
+            }
+
+            if (good) return magic;
+        }
+    }
+
+    void write_table (std::ostream& out, const char* name, const std::array<uint64_t, BOARD_SIZE>& magics) {
+        out << "constexpr std::array<uint64_t, BOARD_SIZE> " << name << " = {\n";
+
+        for (uint64_t magic: magics) {
+            char line[32];
+            std::snprintf(line, sizeof(line), "    0x%llxULL,\n", (unsigned long long) magic);
+            out << line;
+        }
+
+        out << "};\n";
+    }
+
+    void write_header (std::ostream& out, uint64_t seed, const std::array<uint64_t, BOARD_SIZE>& rook,
+                       const std::array<uint64_t, BOARD_SIZE>& bishop) {
+        out << "/**\n"
+            << " * magic.h\n"
+            << " * \n"
+            << " * Contains Magic Numbers used for magic bitboards\n"
+            << " * Generated by tools/magics.cpp with seed " << seed << ", for the shift 64 - relevant bits\n"
+            << " * Not used when the engine is built with BMI2, PEXT needs no magics\n"
+            << " */\n"
+            << "\n"
+            << "#pragma once\n"
+            << "\n"
+            << "#include <array>\n"
+            << "#include \"constants.h\"\n"
+            << "\n"
+            << "\n";
+
+        write_table(out, "rook_magic", rook);
+        out << "\n\n";
+        write_table(out, "bishop_magic", bishop);
+    }
+}
+
+int main (int argc, char* argv[]) {
+    uint64_t seed = Magics::DEFAULT_SEED;
+    std::string output = "src/magic.h";
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-s" && i + 1 < argc) seed = std::stoull(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc) output = argv[++i];
+        else {
+            std::cerr << "Usage: bitfish-magics [-s seed] [-o src/magic.h]\n";
+            return 1;
+        }
+    }
+
+    std::mt19937_64 rng (seed);
+    std::array<uint64_t, BOARD_SIZE> rook, bishop;
+    size_t rook_slots = 0, bishop_slots = 0;
+
+    for (int square = 0; square < BOARD_SIZE; square++) {
+        rook[square] = Magics::find_magic(square, true, rng);
+        bishop[square] = Magics::find_magic(square, false, rng);
+
+        rook_slots += 1ULL << __builtin_popcountll(Magics::slider_mask(square, true));
+        bishop_slots += 1ULL << __builtin_popcountll(Magics::slider_mask(square, false));
+    }
+
+    std::ofstream out (output);
+
+    if (!out) {
+        std::cerr << "Cannot open " << output << "\n";
+        return 1;
+    }
+
+    Magics::write_header(out, seed, rook, bishop);
+
+    std::cout << "Wrote " << output << ", " << rook_slots << " rook and " << bishop_slots << " bishop slots, "
+              << (rook_slots + bishop_slots) * sizeof(Bitboard) / 1024 << " KB\n";
+
+    return 0;
+}
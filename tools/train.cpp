@@ -0,0 +1,380 @@
+/**
+ * train.cpp
+ *
+ * bitfish-train, trains the NNUE network on the CPU from packed records (src/packed.h)
+ * and writes the quantised file the engine loads with "setoption name EvalFile"
+ *
+ * Build from the repository root:
+ *   g++ -O3 -march=native -std=c++17 -pthread tools/train.cpp -o bitfish-train
+ *
+ * Usage:
+ *   bitfish-train -o net.nnue [-e epochs] [-b batch] [-l lr] [-w wdl] [-t threads] data.bin...
+ *
+ * Each mini-batch is split between the threads. Every thread runs the forward and backward pass on
+ * its share into its own gradient buffers, then the buffers are summed and Adam updates the weights.
+ * The first layer is sparse: at most 32 inputs per perspective are active, so a sample only reads
+ * and writes those rows. The rest of the work is loops over contiguous hidden-sized float arrays,
+ * which -O3 -march=native vectorises.
+ */
+
+#include "../src/packed.h"
+#include "../src/nnue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Train {
+
+    constexpr int H = NNUE_HIDDEN;
+
+    // Scores are turned into win probabilities with this many centipawns per unit of the logistic
+    constexpr float CP_SCALE = 400.0f;
+
+    // The quantised weights have to fit their integer types
+    constexpr float FEATURE_CLIP = 1.98f;
+    constexpr float OUTPUT_CLIP = 127.0f / NNUE_QB;
+
+    constexpr float ADAM_BETA1 = 0.9f;
+    constexpr float ADAM_BETA2 = 0.999f;
+    constexpr float ADAM_EPSILON = 1e-8f;
+
+    struct Options {
+        std::vector<std::string> inputs;
+        std::string output = "net.nnue";
+        int epochs = 10;
+        int batch_size = 16384;
+        float lr = 0.001f;
+        float wdl = 0.3f;
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    // All parameters in one block, used for the weights, the gradients and both Adam moments
+    struct Parameters {
+        std::vector<float> feature_weights;
+        std::vector<float> feature_bias;
+        std::vector<float> output_weights;
+        float output_bias = 0.0f;
+
+        Parameters () : feature_weights(NNUE_INPUTS * H, 0.0f), feature_bias(H, 0.0f), output_weights(2 * H, 0.0f) {}
+
+        void zero () {
+            std::fill(feature_weights.begin(), feature_weights.end(), 0.0f);
+            std::fill(feature_bias.begin(), feature_bias.end(), 0.0f);
+            std::fill(output_weights.begin(), output_weights.end(), 0.0f);
+            output_bias = 0.0f;
+        }
+    };
+
+    // Active inputs of one position, side to move first
+    struct Sample {
+        int features[COLOR_NUM][32];
+        int count;
+        float target;
+    };
+
+    inline float sigmoid (float x) {
+        return 1.0f / (1.0f + std::exp(-x));
+    }
+
+    Sample decode (const PackedPosition& packed, float wdl) {
+        Sample sample;
+        sample.count = 0;
+
+        Color us = Color(packed.side_to_move);
+
+        int index = 0;
+        for (uint64_t occupancy = packed.occupancy; occupancy; occupancy &= occupancy - 1) {
+            Square square = Square(__builtin_ctzll(occupancy));
+            Piece piece = packed.piece(index++);
+
+            sample.features[0][sample.count] = NNUE::feature_index(us, piece, square);
+            sample.features[1][sample.count] = NNUE::feature_index(opposite(us), piece, square);
+            sample.count++;
+        }
+
+        // Blend the search score with the game result, both from the side to move
+        float score = us == WHITE ? packed.score : -packed.score;
+        float result = packed.result / 2.0f;
+        if (us == BLACK) result = 1.0f - result;
+
+        sample.target = (1.0f - wdl) * sigmoid(score / CP_SCALE) + wdl * result;
+
+        return sample;
+    }
+
+    // Forward and backward pass for one sample, adds its gradient and returns its loss
+    float train_sample (const Parameters& net, Parameters& grad, const Sample& sample) {
+        alignas(64) float acc[COLOR_NUM][H];
+
+        for (int p = 0; p < COLOR_NUM; p++) {
+            std::memcpy(acc[p], net.feature_bias.data(), H * sizeof(float));
+
+            for (int i = 0; i < sample.count; i++) {
+                const float* row = &net.feature_weights[sample.features[p][i] * H];
+                for (int j = 0; j < H; j++) acc[p][j] += row[j];
+            }
+        }
+
+        float out = net.output_bias;
+
+        for (int p = 0; p < COLOR_NUM; p++) {
+            const float* w = &net.output_weights[p * H];
+            for (int j = 0; j < H; j++) out += std::clamp(acc[p][j], 0.0f, 1.0f) * w[j];
+        }
+
+        float prediction = sigmoid(out * NNUE_SCALE / CP_SCALE);
+        float error = prediction - sample.target;
+
+        // d loss / d out for a squared error through the sigmoid
+        float d_out = 2.0f * error * prediction * (1.0f - prediction) * NNUE_SCALE / CP_SCALE;
+
+        grad.output_bias += d_out;
+
+        for (int p = 0; p < COLOR_NUM; p++) {
+            const float* w = &net.output_weights[p * H];
+            float* gw = &grad.output_weights[p * H];
+
+            alignas(64) float d_acc[H];
+
+            for (int j = 0; j < H; j++) {
+                float a = acc[p][j];
+                bool live = a > 0.0f && a < 1.0f;
+
+                gw[j] += d_out * std::clamp(a, 0.0f, 1.0f);
+                d_acc[j] = live ? d_out * w[j] : 0.0f;
+            }
+
+            for (int j = 0; j < H; j++) grad.feature_bias[j] += d_acc[j];
+
+            for (int i = 0; i < sample.count; i++) {
+                float* row = &grad.feature_weights[sample.features[p][i] * H];
+                for (int j = 0; j < H; j++) row[j] += d_acc[j];
+            }
+        }
+
+        return error * error;
+    }
+
+    class Trainer {
+        Options options;
+
+        std::vector<PackedPosition> data;
+
+        Parameters net;
+        Parameters first_moment;
+        Parameters second_moment;
+
+        // One gradient per thread, summed into the first after every batch
+        std::vector<Parameters> grads;
+
+        int step = 0;
+
+        void adam (std::vector<float>& weights, const std::vector<float>& g, std::vector<float>& m, std::vector<float>& v,
+                   float lr, float scale, float clip) {
+            float correction1 = 1.0f - std::pow(ADAM_BETA1, step);
+            float correction2 = 1.0f - std::pow(ADAM_BETA2, step);
+
+            for (size_t i = 0; i < weights.size(); i++) {
+                float gradient = g[i] * scale;
+
+                m[i] = ADAM_BETA1 * m[i] + (1.0f - ADAM_BETA1) * gradient;
+                v[i] = ADAM_BETA2 * v[i] + (1.0f - ADAM_BETA2) * gradient * gradient;
+
+                weights[i] -= lr * (m[i] / correction1) / (std::sqrt(v[i] / correction2) + ADAM_EPSILON);
+                weights[i] = std::clamp(weights[i], -clip, clip);
+            }
+        }
+
+        void update (float lr, int batch) {
+            step++;
+
+            // Sum the thread gradients, each thread reduces its own slice of the rows
+            std::vector<std::thread> pool;
+            int rows_per_thread = (NNUE_INPUTS + options.threads - 1) / options.threads;
+
+            for (int t = 0; t < options.threads; t++) {
+                pool.emplace_back([&, t]() {
+                    size_t begin = size_t(std::min(NNUE_INPUTS, t * rows_per_thread)) * H;
+                    size_t end = size_t(std::min(NNUE_INPUTS, (t + 1) * rows_per_thread)) * H;
+
+                    for (int other = 1; other < options.threads; other++) {
+                        const float* src = grads[other].feature_weights.data();
+                        float* dst = grads[0].feature_weights.data();
+                        for (size_t i = begin; i < end; i++) dst[i] += src[i];
+                    }
+                });
+            }
+
+            for (std::thread& thread: pool) thread.join();
+
+            for (int other = 1; other < options.threads; other++) {
+                for (int j = 0; j < H; j++) grads[0].feature_bias[j] += grads[other].feature_bias[j];
+                for (int j = 0; j < 2 * H; j++) grads[0].output_weights[j] += grads[other].output_weights[j];
+                grads[0].output_bias += grads[other].output_bias;
+            }
+
+            float scale = 1.0f / batch;
+            Parameters& g = grads[0];
+
+            adam(net.feature_weights, g.feature_weights, first_moment.feature_weights, second_moment.feature_weights, lr, scale, FEATURE_CLIP);
+            adam(net.feature_bias, g.feature_bias, first_moment.feature_bias, second_moment.feature_bias, lr, scale, FEATURE_CLIP);
+            adam(net.output_weights, g.output_weights, first_moment.output_weights, second_moment.output_weights, lr, scale, OUTPUT_CLIP);
+
+            std::vector<float> bias {net.output_bias}, bias_grad {g.output_bias}, bias_m {first_moment.output_bias}, bias_v {second_moment.output_bias};
+            adam(bias, bias_grad, bias_m, bias_v, lr, scale, 1e6f);
+            net.output_bias = bias[0];
+            first_moment.output_bias = bias_m[0];
+            second_moment.output_bias = bias_v[0];
+        }
+
+        public:
+            Trainer (const Options& opts) : options(opts), grads(opts.threads) {
+                std::mt19937 rng (6767);
+                std::uniform_real_distribution<float> feature_init (-0.1f, 0.1f);
+                std::uniform_real_distribution<float> output_init (-1.0f / std::sqrt(2.0f * H), 1.0f / std::sqrt(2.0f * H));
+
+                for (float& w: net.feature_weights) w = feature_init(rng);
+                for (float& w: net.output_weights) w = output_init(rng);
+            }
+
+            bool load_data () {
+                for (const std::string& file: options.inputs) {
+                    std::ifstream in (file, std::ios::binary | std::ios::ate);
+
+                    if (!in) {
+                        std::cerr << "cannot open " << file << "\n";
+                        return false;
+                    }
+
+                    size_t count = size_t(in.tellg()) / sizeof(PackedPosition);
+                    in.seekg(0);
+
+                    size_t old_size = data.size();
+                    data.resize(old_size + count);
+                    in.read((char*) (data.data() + old_size), count * sizeof(PackedPosition));
+                }
+
+                std::cout << "Positions: " << data.size() << "\n" << std::flush;
+                return !data.empty();
+            }
+
+            void run () {
+                std::mt19937_64 rng (6767);
+                std::vector<uint32_t> order (data.size());
+
+                for (int epoch = 1; epoch <= options.epochs; epoch++) {
+                    // Drop the learning rate for the last quarter
+                    float lr = epoch > options.epochs * 3 / 4 ? options.lr * 0.1f : options.lr;
+
+                    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+                    std::shuffle(order.begin(), order.end(), rng);
+
+                    auto start = steady_clock::now();
+                    double epoch_loss = 0.0;
+
+                    for (size_t first = 0; first < order.size(); first += options.batch_size) {
+                        size_t batch = std::min<size_t>(options.batch_size, order.size() - first);
+
+                        std::vector<std::thread> pool;
+                        std::vector<double> losses (options.threads, 0.0);
+
+                        for (int t = 0; t < options.threads; t++) {
+                            pool.emplace_back([&, t]() {
+                                Parameters& grad = grads[t];
+                                grad.zero();
+
+                                // Interleaved so every thread gets the same amount of work
+                                for (size_t i = t; i < batch; i += options.threads) {
+                                    Sample sample = decode(data[order[first + i]], options.wdl);
+                                    losses[t] += train_sample(net, grad, sample);
+                                }
+                            });
+                        }
+
+                        for (std::thread& thread: pool) thread.join();
+                        for (double loss: losses) epoch_loss += loss;
+
+                        update(lr, batch);
+                    }
+
+                    double seconds = duration_cast<milliseconds>(steady_clock::now() - start).count() / 1000.0;
+                    double pos_per_second = data.size() / std::max(seconds, 1e-3);
+
+                    std::cout << "Epoch " << epoch << "/" << options.epochs
+                              << " loss " << epoch_loss / data.size()
+                              << " lr " << lr
+                              << " pos/s " << uint64_t(pos_per_second)
+                              << " pos/s/core " << uint64_t(pos_per_second / options.threads) << "\n" << std::flush;
+
+                    // A usable network after every epoch
+                    save(options.output);
+                }
+            }
+
+            // Same layout as NNUE::load
+            void save (const std::string& file) const {
+                std::ofstream out (file, std::ios::binary);
+
+                uint32_t header[3] = {NNUE::NNUE_MAGIC, NNUE::NNUE_VERSION, uint32_t(H)};
+                out.write((const char*) header, sizeof(header));
+
+                auto quantise = [](float value, float scale, float limit) {
+                    return std::clamp(std::round(value * scale), -limit, limit);
+                };
+
+                std::vector<int16_t> feature_weights (net.feature_weights.size());
+                for (size_t i = 0; i < feature_weights.size(); i++) feature_weights[i] = int16_t(quantise(net.feature_weights[i], NNUE_QA, 32767));
+
+                std::vector<int16_t> feature_bias (H);
+                for (int i = 0; i < H; i++) feature_bias[i] = int16_t(quantise(net.feature_bias[i], NNUE_QA, 32767));
+
+                std::vector<int8_t> output_weights (2 * H);
+                for (int i = 0; i < 2 * H; i++) output_weights[i] = int8_t(quantise(net.output_weights[i], NNUE_QB, 127));
+
+                int32_t output_bias = int32_t(std::round(net.output_bias * NNUE_QA * NNUE_QB));
+
+                out.write((const char*) feature_weights.data(), feature_weights.size() * sizeof(int16_t));
+                out.write((const char*) feature_bias.data(), feature_bias.size() * sizeof(int16_t));
+                out.write((const char*) output_weights.data(), output_weights.size() * sizeof(int8_t));
+                out.write((const char*) &output_bias, sizeof(output_bias));
+            }
+    };
+}
+
+int main (int argc, char* argv[]) {
+    Train::Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 < argc && arg == "-o") options.output = argv[++i];
+        else if (i + 1 < argc && arg == "-e") options.epochs = std::stoi(argv[++i]);
+        else if (i + 1 < argc && arg == "-b") options.batch_size = std::max(1, std::stoi(argv[++i]));
+        else if (i + 1 < argc && arg == "-l") options.lr = std::stof(argv[++i]);
+        else if (i + 1 < argc && arg == "-w") options.wdl = std::stof(argv[++i]);
+        else if (i + 1 < argc && arg == "-t") options.threads = std::max(1, std::stoi(argv[++i]));
+        else options.inputs.push_back(arg);
+    }
+
+    if (options.inputs.empty()) {
+        std::cerr << "usage: bitfish-train -o net.nnue [-e epochs] [-b batch] [-l lr] [-w wdl] [-t threads] data.bin...\n";
+        return 1;
+    }
+
+    Train::Trainer trainer (options);
+
+    if (!trainer.load_data()) return 1;
+
+    trainer.run();
+
+    return 0;
+}